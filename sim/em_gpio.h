@@ -0,0 +1,2 @@
+/* Host stand-in, see sim_hal.h */
+#include "sim_hal.h"
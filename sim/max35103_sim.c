@@ -0,0 +1,454 @@
+/*
+ * max35103_sim.c
+ *
+ * Behavioral model of the MAX35103
+ *
+ * Covers what the firmware relies on: the SPI frame format, configuration
+ * registers with their flash copy, TOF_DIFF and TEMPERATURE conversions with
+ * all result registers, the event timing engine, the RTC and the interrupt
+ * status register driving the INT pin. Results come from a flow profile
+ * through an ideal transit time meter, so conversion times and analog effects
+ * are approximations and only as exact as needed for firmware timing.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include "max_macros.h"
+#include "max35103_sim.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* @var MAX_SIM_RTC_EPOCH  RTC reading at reset, 2018-06-01 00:00:00 */
+#define MAX_SIM_RTC_EPOCH       1527811200LL
+
+#define MAX_SIM_WVR             0x0080
+
+/* ----- Profiles ----- */
+
+double max_sim_velocity(const SIM_Profile_t *p, double t)
+{
+    switch(p->shape) {
+    case SIM_FLOW_SINE:
+        return p->velocity + p->amplitude * sin(2 * M_PI * t / p->period);
+    case SIM_FLOW_STEP:
+        return p->velocity + p->amplitude * floor(t / p->period);
+    case SIM_FLOW_RAMP:
+        return p->velocity + p->amplitude * t / p->period;
+    default:
+        return p->velocity;
+    }
+}
+
+double max_sim_temperature(const SIM_Profile_t *p, double t)
+{
+    return p->tempC + p->tempSlope * t;
+}
+
+// Speed of sound in pure water, Marczak 1997, 0..95 degrees C
+double max_sim_sound_speed(double tempC)
+{
+    double t = tempC;
+
+    return 1.402385e3 + 5.038813 * t - 5.799136e-2 * t * t + 3.287156e-4 * t * t * t
+           - 1.398845e-6 * t * t * t * t + 2.787860e-9 * t * t * t * t * t;
+}
+
+static double max_sim_uniform(MAX_Sim_t *m)
+{
+    // xorshift32, reproducible across runs
+    m->rng ^= m->rng << 13;
+    m->rng ^= m->rng >> 17;
+    m->rng ^= m->rng << 5;
+    return (m->rng + 1.0) / 4294967297.0;
+}
+
+static double max_sim_gauss(MAX_Sim_t *m)
+{
+    return sqrt(-2 * log(max_sim_uniform(m))) * cos(2 * M_PI * max_sim_uniform(m));
+}
+
+/* ----- Registers ----- */
+
+// Q16.16 in 4 MHz clock periods, written to an INT/FRAC register pair
+static void max_sim_set_q16(MAX_Sim_t *m, uint8_t opInt, double seconds)
+{
+    int32_t q = (int32_t)llround(seconds * MAX_SIM_CLOCK_HZ * 65536.0);
+
+    m->reg[opInt] = (uint32_t)q >> 16;
+    m->reg[opInt + 1] = q & 0xFFFF;
+}
+
+static double max_sim_seconds(void)
+{
+    return sim_now_us / 1e6;
+}
+
+static uint8_t max_sim_bcd(int v)
+{
+    return ((v / 10) << 4) | (v % 10);
+}
+
+static uint16_t max_sim_rtc(MAX_Sim_t *m, uint8_t opcode)
+{
+    time_t t = (time_t)(MAX_SIM_RTC_EPOCH + m->rtcOffsetS + (int64_t)(sim_now_us / 1000000));
+    struct tm tm;
+    int hundredths = (sim_now_us / 10000) % 100;
+
+    gmtime_r(&t, &tm);
+
+    switch(opcode) {
+    case READ_RTC_SECS:
+        return (max_sim_bcd(hundredths) << 8) | max_sim_bcd(tm.tm_sec);
+    case READ_RTC_MIN_HRS:
+        return (max_sim_bcd(tm.tm_min) << 8) | max_sim_bcd(tm.tm_hour);
+    case READ_RTC_DAY_DATE:
+        return ((tm.tm_wday + 1) << 8) | max_sim_bcd(tm.tm_mday);
+    default:
+        return (max_sim_bcd(tm.tm_mon + 1) << 8) | max_sim_bcd(tm.tm_year % 100);
+    }
+}
+
+static void max_sim_int_update(MAX_Sim_t *m)
+{
+    if(!m->reg[READ_INT_STAT_REG]) {
+        m->intSuppressed = false;
+    }
+    sim_gpio_drive(m->intPort, m->intPin, m->reg[READ_INT_STAT_REG] && !m->intSuppressed ? 0 : 1);
+}
+
+static void max_sim_raise(MAX_Sim_t *m, uint16_t flags)
+{
+    if(m->reg[READ_INT_STAT_REG]) {
+        m->stats.overruns++;
+    }
+    else {
+        if(m->evtmg) {
+            m->stats.evtInts++;
+        }
+        if(m->profile.intLossRate && max_sim_uniform(m) < m->profile.intLossRate) {
+            m->intSuppressed = true;
+            m->stats.intLost++;
+        }
+    }
+    m->reg[READ_INT_STAT_REG] |= flags;
+    max_sim_int_update(m);
+}
+
+/* ----- Conversions ----- */
+
+// Wave of HITn as selected in TOF3..TOF5
+static uint32_t max_sim_hit_wave(MAX_Sim_t *m, uint32_t hit)
+{
+    uint16_t r = m->reg[READ_TOF3 + hit / 2];
+
+    return hit & 1 ? r & 0x3F : (r >> 8) & 0x3F;
+}
+
+static double max_sim_direction(MAX_Sim_t *m, double tof, uint8_t opHit1, uint8_t opAvg, uint8_t opWvr)
+{
+    uint32_t hits = ((m->reg[READ_TOF2] >> 13) & 0x7) + 1;
+    double period = 1.0 / MAX_SIM_XDCR_HZ;
+    double sum = 0;
+    double hit;
+    uint32_t i;
+
+    if(hits > 6) {
+        hits = 6;
+    }
+
+    for(i = 0; i < 6; i++) {
+        if(i >= hits) {
+            m->reg[opHit1 + 2 * i] = 0;
+            m->reg[opHit1 + 2 * i + 1] = 0;
+            continue;
+        }
+        hit = tof + max_sim_hit_wave(m, i) * period + max_sim_gauss(m) * m->profile.noisePs * 1e-12;
+        if(max_sim_uniform(m) < m->profile.slipRate) {
+            hit += max_sim_uniform(m) < 0.5 ? -period : period;
+        }
+        max_sim_set_q16(m, opHit1 + 2 * i, hit);
+        sum += hit;
+    }
+
+    m->reg[opWvr] = MAX_SIM_WVR;
+    max_sim_set_q16(m, opAvg, sum / hits);
+    return sum / hits;
+}
+
+// One TOF_DIFF, returns false on a missing echo
+static bool max_sim_tof(MAX_Sim_t *m, double *diff, double *up, double *dn)
+{
+    double t = max_sim_seconds();
+    double v = max_sim_velocity(&m->profile, t);
+    double c = max_sim_sound_speed(max_sim_temperature(&m->profile, t));
+
+    m->stats.tofMeasurements++;
+    if(max_sim_uniform(m) < m->profile.missRate) {
+        m->stats.timeouts++;
+        return false;
+    }
+
+    m->truth = (MAX_SIM_PATH_M / (c - v) - MAX_SIM_PATH_M / (c + v)) * 1e12;
+    *up = max_sim_direction(m, MAX_SIM_PATH_M / (c - v), HIT1_UP_INT, AVG_UP_INT, WVRUP);
+    *dn = max_sim_direction(m, MAX_SIM_PATH_M / (c + v), HIT1_DN_INT, AVG_DN_INT, WVRDN);
+    *diff = *up - *dn;
+    max_sim_set_q16(m, TOF_DIFF_INT, *diff);
+    return true;
+}
+
+// PT1000 on T2/T4, reference resistor on T1/T3
+static void max_sim_temp(MAX_Sim_t *m, double *t)
+{
+    double tc = max_sim_temperature(&m->profile, max_sim_seconds());
+    double r = 1000.0 * (1 + 3.9083e-3 * tc - 5.775e-7 * tc * tc);
+    uint32_t i;
+
+    m->stats.tempMeasurements++;
+    t[0] = t[2] = MAX_SIM_TREF_S;
+    t[1] = t[3] = MAX_SIM_TREF_S * r / MAX_SIM_RREF_OHM;
+    for(i = 0; i < 4; i++) {
+        t[i] += max_sim_gauss(m) * 10e-12;
+        max_sim_set_q16(m, T1_INT + 2 * i, t[i]);
+    }
+}
+
+static void max_sim_done(void *arg, uint32_t opcode)
+{
+    MAX_Sim_t *m = arg;
+    double r[4];
+
+    m->running = NULL_CMD;
+
+    if(opcode == TEMPERATURE) {
+        max_sim_temp(m, r);
+        max_sim_raise(m, INT_STAT_TE);
+    }
+    else if(max_sim_tof(m, &r[0], &r[1], &r[2])) {
+        max_sim_raise(m, INT_STAT_TOF);
+    }
+    else {
+        max_sim_raise(m, INT_STAT_TO);
+    }
+}
+
+/*******************************************************************************
+ * @function    max_sim_evtmg()
+ * @abstract    One step of the event timing engine
+ * @discussion  EVT_TIMING1 gives the TOF_DIFF period as (TDF + 1) * 0.5 s,
+ *              TDM + 1 measurements per sequence and a temperature period of
+ *              (TMF + 1) s. Only the end of a sequence raises INT.
+ ******************************************************************************/
+static void max_sim_evtmg(void *arg, uint32_t param)
+{
+    MAX_Sim_t *m = arg;
+    uint16_t evt = m->reg[READ_EVT_TIMING1];
+    uint64_t tofPeriod = (((evt >> 12) & 0xF) + 1) * 500000ULL;
+    uint32_t perSeq = ((evt >> 7) & 0x1F) + 1;
+    uint64_t tempPeriod = (((evt >> 1) & 0x3F) + 1) * 1000000ULL;
+    double r[4];
+    uint32_t i;
+
+    (void)param;
+
+    if(m->evtmg != EVTMG2) {
+        if(max_sim_tof(m, &r[0], &r[1], &r[2])) {
+            for(i = 0; i < 3; i++) {
+                m->evtTofSum[i] += r[i];
+            }
+            m->evtTofCount++;
+        }
+        if(++m->evtSteps >= perSeq) {
+            m->evtSteps = 0;
+            m->stats.sequences++;
+            if(m->evtTofCount) {
+                max_sim_set_q16(m, TOF_DIFF_AVG_INT, m->evtTofSum[0] / m->evtTofCount);
+                max_sim_set_q16(m, AVG_UP_INT, m->evtTofSum[1] / m->evtTofCount);
+                max_sim_set_q16(m, AVG_DN_INT, m->evtTofSum[2] / m->evtTofCount);
+                max_sim_raise(m, INT_STAT_TOF_EVTMG);
+            }
+            else {
+                max_sim_raise(m, INT_STAT_TO);
+            }
+            memset(m->evtTofSum, 0, sizeof(m->evtTofSum));
+            m->evtTofCount = 0;
+        }
+    }
+
+    if(m->evtmg != EVTMG1 && sim_now_us >= m->evtNextTemp) {
+        max_sim_temp(m, r);
+        for(i = 0; i < 4; i++) {
+            max_sim_set_q16(m, T1_AVG_INT + 2 * i, r[i]);
+        }
+        max_sim_raise(m, INT_STAT_TEMP_EVTMG);
+        m->evtNextTemp = sim_now_us + tempPeriod;
+    }
+
+    sim_schedule(m->evtmg == EVTMG2 ? tempPeriod : tofPeriod, max_sim_evtmg, m, 0);
+}
+
+static void max_sim_halt(MAX_Sim_t *m)
+{
+    sim_cancel(max_sim_done, m);
+    sim_cancel(max_sim_evtmg, m);
+    m->running = NULL_CMD;
+    m->evtmg = 0;
+}
+
+static void max_sim_execute(MAX_Sim_t *m, uint8_t opcode)
+{
+    uint32_t i;
+
+    switch(opcode) {
+    case RESET:
+        max_sim_halt(m);
+        for(i = READ_TOF1; i <= READ_CLBRT_CTRL; i++) {
+            m->reg[i] = m->flash[i];
+        }
+        m->reg[READ_INT_STAT_REG] = 0;
+        max_sim_int_update(m);
+        return;
+    case HALT:
+        max_sim_halt(m);
+        return;
+    case TX_CONFIG_FLASH:
+        memcpy(m->flash, m->reg, sizeof(m->flash));
+        m->stats.flashWrites++;
+        return;
+    case INITIALIZE:
+    case LDO_TIMED:
+    case LDO_ON:
+    case LDO_OFF:
+    case CLBRT:
+        return;
+    default:
+        break;
+    }
+
+    if(m->running != NULL_CMD || m->evtmg) {
+        m->stats.busyCommands++;
+        return;
+    }
+
+    switch(opcode) {
+    case TOF_UP:
+    case TOF_DOWN:
+    case TOF_DIFF:
+        m->running = opcode;
+        sim_schedule(MAX_SIM_TOF_US, max_sim_done, m, opcode);
+        break;
+    case TEMPERATURE:
+        m->running = opcode;
+        sim_schedule(MAX_SIM_TEMP_US, max_sim_done, m, opcode);
+        break;
+    case EVTMG1:
+    case EVTMG2:
+    case EVTMG3:
+        m->evtmg = opcode;
+        m->evtNextTemp = sim_now_us;
+        m->evtSteps = 0;
+        m->evtTofCount = 0;
+        memset(m->evtTofSum, 0, sizeof(m->evtTofSum));
+        sim_schedule(0, max_sim_evtmg, m, 0);
+        break;
+    default:
+        break;
+    }
+}
+
+/* ----- SPI ----- */
+
+static void max_sim_select(void *dev, bool active)
+{
+    MAX_Sim_t *m = dev;
+
+    (void)active;
+    m->index = 0;
+}
+
+/*******************************************************************************
+ * @function    max_sim_exchange()
+ * @abstract    One byte on the bus while CS is low
+ * @discussion  The first byte of a frame is the opcode. Reads shift the
+ *              register out MSB first during the next two bytes, writes take
+ *              it in the same way. Execution opcodes act immediately.
+ ******************************************************************************/
+static uint8_t max_sim_exchange(void *dev, uint8_t tx)
+{
+    MAX_Sim_t *m = dev;
+    uint8_t rx = 0;
+
+    if(m->index == 0) {
+        m->opcode = tx;
+        if(tx <= CLBRT) {
+            max_sim_execute(m, tx);
+        }
+        else if(tx == READ_INT_STAT_REG) {
+            // Cleared on read, INT is released with it
+            m->out = m->reg[READ_INT_STAT_REG];
+            m->reg[READ_INT_STAT_REG] = 0;
+            m->stats.statusReads++;
+            if(m->evtmg) {
+                m->stats.evtStatusReads++;
+            }
+            max_sim_int_update(m);
+        }
+        else if(tx >= READ_RTC_SECS && tx <= READ_RTC_M_Y) {
+            m->out = max_sim_rtc(m, tx);
+        }
+        else if(tx & 0x80) {
+            m->out = m->reg[tx];
+        }
+    }
+    else if(m->index == 1) {
+        rx = m->out >> 8;
+        m->in = tx << 8;
+    }
+    else if(m->index == 2) {
+        rx = m->out & 0xFF;
+        m->in |= tx;
+        if(m->opcode >= WRITE_RTC_SECS && m->opcode <= WRITE_RTC) {
+            m->reg[m->opcode | 0x80] = m->in;
+            if(m->opcode >= WRITE_TOF1) {
+                m->stats.configWrites++;
+            }
+        }
+    }
+
+    if(m->index < 255) {
+        m->index++;
+    }
+    return rx;
+}
+
+/*******************************************************************************
+ * @function    max_sim_init()
+ * @abstract    Power up a simulated MAX35103 and put it on the SPI bus
+ *
+ * @param       m        Device state
+ * @param       profile  Flow and temperature it will measure
+ * @param       csPort   Chip select driven by the firmware
+ * @param       csPin
+ * @param       intPort  INT output, active low
+ * @param       intPin
+ *
+ * @return      void
+ ******************************************************************************/
+void max_sim_init(MAX_Sim_t *m, const SIM_Profile_t *profile,
+                  GPIO_Port_TypeDef csPort, unsigned int csPin,
+                  GPIO_Port_TypeDef intPort, unsigned int intPin)
+{
+    SIM_Bus_t bus = { max_sim_select, max_sim_exchange, m, csPort, csPin };
+
+    memset(m, 0, sizeof(*m));
+    m->profile = *profile;
+    m->intPort = intPort;
+    m->intPin = intPin;
+    m->running = NULL_CMD;
+    m->rng = 0x2545F491 ^ (csPin << 8) ^ csPort;
+
+    sim_bus_attach(&bus);
+    max_sim_int_update(m);
+}
@@ -0,0 +1,125 @@
+/*
+ * max35103_sim.h
+ *
+ * Behavioral model of the MAX35103 for the host simulator
+ */
+
+#ifndef MAX35103_SIM
+#define MAX35103_SIM
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sim_hal.h"
+
+/*******************************************************************************
+ * @enum        SIM_FlowShape_t
+ * @abstract    Time course of the synthetic flow velocity
+ * @discussion  SIM_FLOW_CONSTANT  velocity
+ *              SIM_FLOW_SINE      velocity + amplitude * sin(2 pi t / period)
+ *              SIM_FLOW_STEP      velocity, jumping by amplitude every period
+ *              SIM_FLOW_RAMP      velocity rising by amplitude per period
+ ******************************************************************************/
+typedef enum {
+    SIM_FLOW_CONSTANT,
+    SIM_FLOW_SINE,
+    SIM_FLOW_STEP,
+    SIM_FLOW_RAMP
+} SIM_FlowShape_t;
+
+/*******************************************************************************
+ * @struct      SIM_Profile_t
+ * @abstract    Synthetic flow and temperature the model measures
+ * @discussion  Hits get gaussian jitter of noisePs. With probability slipRate a
+ *              single hit locks onto the neighbouring wave (one period off),
+ *              the way bubbles show up on a real meter. missRate is the
+ *              fraction of TOF measurements that end in a timeout. With
+ *              probability intLossRate a result sets the status without
+ *              pulling INT low, as if the edge was missed, until the status
+ *              is read.
+ ******************************************************************************/
+typedef struct {
+    SIM_FlowShape_t shape;
+    double velocity;        // m/s
+    double amplitude;       // m/s
+    double period;          // s
+    double noisePs;         // rms jitter per hit
+    double slipRate;
+    double missRate;
+    double tempC;           // water temperature at t = 0
+    double tempSlope;       // degrees C per second
+    double intLossRate;
+} SIM_Profile_t;
+
+/* ----- Meter geometry and front end ----- */
+#define MAX_SIM_PATH_M          0.100       // acoustic path length
+#define MAX_SIM_XDCR_HZ         1000000.0   // transducer frequency
+#define MAX_SIM_CLOCK_HZ        4000000.0   // 4 MHz reference, 1 LSB of *_INT
+#define MAX_SIM_RREF_OHM        1000.0      // reference resistor on T1/T3
+#define MAX_SIM_TREF_S          100e-6      // discharge time through RREF
+
+/* ----- Conversion times ----- */
+#define MAX_SIM_TOF_US          900         // TOF_DIFF, both directions
+#define MAX_SIM_TEMP_US         2400        // TEMPERATURE, 4 ports
+
+typedef struct {
+    uint64_t tofMeasurements;
+    uint64_t tempMeasurements;
+    uint64_t timeouts;
+    uint64_t sequences;
+    uint64_t configWrites;
+    uint64_t flashWrites;
+    uint64_t statusReads;
+    uint64_t overruns;          // result completed while INT still pending
+    uint64_t busyCommands;      // command while a measurement was running
+    uint64_t intLost;           // results raised without an INT edge
+    uint64_t evtInts;           // INT edges of the event timing engine
+    uint64_t evtStatusReads;    // status reads while event timing runs
+} MAX_SimStats_t;
+
+/*******************************************************************************
+ * @struct      MAX_Sim_t
+ * @abstract    One simulated MAX35103
+ * @discussion  reg holds every register by its read opcode. flash is the
+ *              configuration flash, loaded on RESET and written by
+ *              TX_CONFIG_FLASH. truth keeps the TOF_DIFF the profile asked
+ *              for, in picoseconds, before noise, for checking the firmware.
+ ******************************************************************************/
+typedef struct {
+    uint16_t reg[256];
+    uint16_t flash[256];
+    SIM_Profile_t profile;
+
+    GPIO_Port_TypeDef intPort;
+    unsigned int intPin;
+    bool intSuppressed;         // INT held high until the status is read
+
+    // SPI frame state
+    uint8_t index;
+    uint8_t opcode;
+    uint16_t out;
+    uint16_t in;
+
+    // Measurement state
+    uint8_t running;            // opcode in progress, NULL_CMD if idle
+    uint8_t evtmg;              // EVTMGn running, 0 if halted
+    uint32_t evtSteps;
+    uint32_t evtTofCount;
+    double evtTofSum[3];        // TOF_DIFF, AVG_UP, AVG_DN
+    uint64_t evtNextTemp;
+
+    int64_t rtcOffsetS;
+    uint32_t rng;
+    double truth;
+
+    MAX_SimStats_t stats;
+} MAX_Sim_t;
+
+void max_sim_init(MAX_Sim_t *m, const SIM_Profile_t *profile,
+                  GPIO_Port_TypeDef csPort, unsigned int csPin,
+                  GPIO_Port_TypeDef intPort, unsigned int intPin);
+
+double max_sim_velocity(const SIM_Profile_t *p, double t);
+double max_sim_temperature(const SIM_Profile_t *p, double t);
+double max_sim_sound_speed(double tempC);
+
+#endif /* MAX35103_SIM */
@@ -0,0 +1,1283 @@
+/*
+ * sim_hal.c
+ *
+ * Event loop and peripheral behaviour behind sim_hal.h
+ */
+
+#include <string.h>
+#include "sim_hal.h"
+
+uint64_t sim_now_us;
+uint64_t sim_end_us;
+jmp_buf sim_exit;
+SIM_Stats_t sim_stats;
+
+GPIO_TypeDef sim_gpio;
+USART_TypeDef sim_usart0;
+USART_TypeDef sim_usart1;
+LEUART_TypeDef sim_leuart0;
+
+/* ----- Event loop ----- */
+
+#define SIM_MAX_EVENTS  64
+
+typedef struct {
+    bool used;
+    uint64_t time;
+    uint64_t seq;
+    SIM_EventFn_t fn;
+    void *arg;
+    uint32_t param;
+} SIM_Event_t;
+
+static SIM_Event_t sim_events[SIM_MAX_EVENTS];
+static uint64_t sim_seq;
+
+void sim_schedule(uint64_t delay_us, SIM_EventFn_t fn, void *arg, uint32_t param)
+{
+    uint32_t i;
+
+    for(i = 0; i < SIM_MAX_EVENTS; i++) {
+        if(!sim_events[i].used) {
+            sim_events[i].used = true;
+            sim_events[i].time = sim_now_us + delay_us;
+            sim_events[i].seq = sim_seq++;
+            sim_events[i].fn = fn;
+            sim_events[i].arg = arg;
+            sim_events[i].param = param;
+            return;
+        }
+    }
+    assert(!"sim event queue full");
+}
+
+void sim_cancel(SIM_EventFn_t fn, void *arg)
+{
+    uint32_t i;
+
+    for(i = 0; i < SIM_MAX_EVENTS; i++) {
+        if(sim_events[i].used && sim_events[i].fn == fn && sim_events[i].arg == arg) {
+            sim_events[i].used = false;
+        }
+    }
+}
+
+/*******************************************************************************
+ * @function    sim_step()
+ * @abstract    Run the earliest pending event
+ * @discussion  Events with the same time run in the order they were scheduled.
+ *              If nothing is due before limit_us the clock moves to limit_us.
+ *
+ * @return      false if no event ran
+ ******************************************************************************/
+bool sim_step(uint64_t limit_us)
+{
+    SIM_Event_t *next = NULL;
+    SIM_Event_t e;
+    uint32_t i;
+
+    for(i = 0; i < SIM_MAX_EVENTS; i++) {
+        if(sim_events[i].used &&
+           (!next || sim_events[i].time < next->time ||
+            (sim_events[i].time == next->time && sim_events[i].seq < next->seq))) {
+            next = &sim_events[i];
+        }
+    }
+
+    if(!next || next->time > limit_us) {
+        if(sim_now_us < limit_us) {
+            sim_now_us = limit_us;
+        }
+        return false;
+    }
+
+    e = *next;
+    next->used = false;
+    if(e.time > sim_now_us) {
+        sim_now_us = e.time;
+    }
+    e.fn(e.arg, e.param);
+    return true;
+}
+
+/* ----- Core, CMU ----- */
+
+void CHIP_Init(void)
+{
+}
+
+// Sleeps until the next event, which is the next interrupt on the board
+void EMU_EnterEM1(void)
+{
+    sim_step(sim_end_us);
+    if(sim_now_us >= sim_end_us) {
+        longjmp(sim_exit, 1);
+    }
+}
+
+// Events that run while this is set happen with the HF clock off
+static bool sim_in_em2;
+
+// Every clock the firmware uses keeps running apart from USART0 receive, EM2
+// otherwise only differs in the count
+void EMU_EnterEM2(bool restore)
+{
+    (void)restore;
+
+    sim_stats.em2Sleeps++;
+    sim_in_em2 = true;
+    EMU_EnterEM1();
+    sim_in_em2 = false;
+}
+
+/* ----- MSC ----- */
+
+uint8_t sim_flash[FLASH_SIZE] __attribute__((aligned(FLASH_PAGE_SIZE)));
+static bool sim_msc_ready;
+
+void MSC_Init(void)
+{
+    sim_msc_ready = true;
+}
+
+MSC_Status_TypeDef MSC_ErasePage(uint32_t *startAddress)
+{
+    uintptr_t offset = (uintptr_t)startAddress - FLASH_BASE;
+
+    if(!sim_msc_ready) {
+        return mscReturnLocked;
+    }
+    if(offset >= FLASH_SIZE || offset % FLASH_PAGE_SIZE) {
+        return mscReturnInvalidAddr;
+    }
+    memset(&sim_flash[offset], 0xFF, FLASH_PAGE_SIZE);
+    sim_stats.flashErases++;
+    return mscReturnOk;
+}
+
+MSC_Status_TypeDef MSC_WriteWord(uint32_t *address, void const *data, uint32_t numBytes)
+{
+    uintptr_t offset = (uintptr_t)address - FLASH_BASE;
+    const uint8_t *src = data;
+    uint32_t i;
+
+    if(!sim_msc_ready) {
+        return mscReturnLocked;
+    }
+    if(offset % 4 || numBytes % 4) {
+        return mscReturnUnaligned;
+    }
+    if(offset >= FLASH_SIZE || numBytes > FLASH_SIZE - offset) {
+        return mscReturnInvalidAddr;
+    }
+    for(i = 0; i < numBytes; i++) {
+        sim_flash[offset + i] &= src[i];
+    }
+    sim_stats.flashWords += numBytes / 4;
+    return mscReturnOk;
+}
+
+/* ----- Sleep driver ----- */
+
+static uint8_t sim_sleep_blocks[sleepEM4 + 1];
+static SLEEP_CbFuncPtr_t sim_sleep_cb;
+static SLEEP_CbFuncPtr_t sim_wakeup_cb;
+
+void SLEEP_Init(SLEEP_CbFuncPtr_t sleepCb, SLEEP_CbFuncPtr_t wakeupCb)
+{
+    memset(sim_sleep_blocks, 0, sizeof(sim_sleep_blocks));
+    sim_sleep_cb = sleepCb;
+    sim_wakeup_cb = wakeupCb;
+}
+
+void SLEEP_SleepBlockBegin(SLEEP_EnergyMode_t mode)
+{
+    assert(mode >= sleepEM1 && mode <= sleepEM3 && sim_sleep_blocks[mode] < 0xFF);
+    sim_sleep_blocks[mode]++;
+}
+
+void SLEEP_SleepBlockEnd(SLEEP_EnergyMode_t mode)
+{
+    assert(mode >= sleepEM1 && mode <= sleepEM3 && sim_sleep_blocks[mode]);
+    sim_sleep_blocks[mode]--;
+}
+
+SLEEP_EnergyMode_t SLEEP_LowestEnergyModeGet(void)
+{
+    uint32_t mode;
+
+    for(mode = sleepEM1; mode <= sleepEM3; mode++) {
+        if(sim_sleep_blocks[mode]) {
+            return (SLEEP_EnergyMode_t)(mode - 1);
+        }
+    }
+    return sleepEM3;
+}
+
+// Sleep in progress, sleepEM0 while awake
+static SLEEP_EnergyMode_t sim_sleeping;
+static uint64_t sim_sleep_start;
+
+// Account the sleep and wake up, also for the last one cut short by sim_exit
+void sim_sleep_end(void)
+{
+    SLEEP_EnergyMode_t mode = sim_sleeping;
+
+    if(mode == sleepEM0) {
+        return;
+    }
+    sim_sleeping = sleepEM0;
+    if(mode == sleepEM2) {
+        sim_stats.em2Us += sim_now_us - sim_sleep_start;
+    }
+    else {
+        sim_stats.em1Us += sim_now_us - sim_sleep_start;
+    }
+    if(sim_wakeup_cb) {
+        sim_wakeup_cb(mode);
+    }
+}
+
+// EM3 would stop the RTC model, the firmware has to block it
+SLEEP_EnergyMode_t SLEEP_Sleep(void)
+{
+    SLEEP_EnergyMode_t mode = SLEEP_LowestEnergyModeGet();
+
+    assert(mode != sleepEM3);
+    if(mode == sleepEM0) {
+        return mode;
+    }
+    if(sim_sleep_cb) {
+        sim_sleep_cb(mode);
+    }
+    sim_stats.sleeps++;
+    sim_sleeping = mode;
+    sim_sleep_start = sim_now_us;
+    if(mode == sleepEM2) {
+        EMU_EnterEM2(true);
+    }
+    else {
+        EMU_EnterEM1();
+    }
+    sim_sleep_end();
+    return mode;
+}
+
+void CMU_ClockEnable(CMU_Clock_TypeDef clock, bool enable)
+{
+    (void)clock;
+    (void)enable;
+}
+
+void CMU_ClockSelectSet(CMU_Clock_TypeDef clock, CMU_Select_TypeDef ref)
+{
+    (void)clock;
+    (void)ref;
+}
+
+/* ----- SPI slave and bus timing ----- */
+
+#define SIM_MAX_SLAVES  8
+
+static SIM_Bus_t sim_slaves[SIM_MAX_SLAVES];
+static bool sim_selected[SIM_MAX_SLAVES];
+static uint32_t sim_slave_count;
+static uint32_t sim_spi_bitrate = 1000000;
+static uint64_t sim_spi_free_at;
+
+void sim_bus_attach(const SIM_Bus_t *slave)
+{
+    assert(sim_slave_count < SIM_MAX_SLAVES);
+    sim_selected[sim_slave_count] = false;
+    sim_slaves[sim_slave_count++] = *slave;
+}
+
+static void sim_cs_update(void)
+{
+    SIM_Bus_t *s;
+    bool selected;
+    uint32_t i;
+
+    for(i = 0; i < sim_slave_count; i++) {
+        s = &sim_slaves[i];
+        selected = !(sim_gpio.P[s->csPort].DOUT & (1 << s->csPin));
+        if(selected != sim_selected[i]) {
+            sim_selected[i] = selected;
+            if(selected) {
+                sim_stats.spiFrames++;
+            }
+            s->select(s->dev, selected);
+        }
+    }
+}
+
+// MISO of every selected slave, two at once is a CS bug and reads garbage
+static uint8_t sim_spi_byte(uint8_t tx)
+{
+    uint8_t rx = 0xFF;
+    uint32_t active = 0;
+    uint32_t i;
+
+    sim_stats.spiBytes++;
+    for(i = 0; i < sim_slave_count; i++) {
+        if(sim_selected[i]) {
+            rx &= sim_slaves[i].exchange(sim_slaves[i].dev, tx);
+            active++;
+        }
+    }
+    if(active > 1) {
+        sim_stats.spiCsConflicts++;
+    }
+    return rx;
+}
+
+static uint64_t sim_spi_duration(uint32_t bytes)
+{
+    return ((uint64_t)bytes * 8 * 1000000 + sim_spi_bitrate - 1) / sim_spi_bitrate;
+}
+
+// A new transfer while the previous one is still clocking is a firmware bug
+static void sim_spi_claim(uint64_t duration)
+{
+    if(sim_now_us < sim_spi_free_at) {
+        sim_stats.spiBusyErrors++;
+    }
+    sim_spi_free_at = sim_now_us + duration;
+}
+
+/* ----- GPIO ----- */
+
+static GPIOINT_IrqCallbackPtr_t sim_gpioint[16];
+static GPIO_Port_TypeDef sim_extint_port[16];
+static uint32_t sim_pin_in[6];
+static bool sim_gpio_irq_pending;
+
+static void sim_gpio_irq(void *arg, uint32_t param)
+{
+    uint32_t flags;
+    uint32_t pin;
+
+    (void)arg;
+    (void)param;
+
+    sim_gpio_irq_pending = false;
+    flags = sim_gpio.IF & sim_gpio.IEN;
+    // GPIOINT clears the flags before dispatching, like GPIO_EVEN/ODD_IRQHandler
+    sim_gpio.IF &= ~flags;
+    for(pin = 0; pin < 16; pin++) {
+        if((flags & (1 << pin)) && sim_gpioint[pin]) {
+            sim_stats.gpioIrqs++;
+            sim_gpioint[pin](pin);
+        }
+    }
+}
+
+static void sim_gpio_check_irq(void)
+{
+    if((sim_gpio.IF & sim_gpio.IEN) && !sim_gpio_irq_pending) {
+        sim_gpio_irq_pending = true;
+        sim_schedule(0, sim_gpio_irq, NULL, 0);
+    }
+}
+
+void GPIO_PinModeSet(GPIO_Port_TypeDef port, unsigned int pin, GPIO_Mode_TypeDef mode, unsigned int out)
+{
+    if(mode == gpioModePushPull) {
+        if(out) {
+            GPIO_PinOutSet(port, pin);
+        }
+        else {
+            GPIO_PinOutClear(port, pin);
+        }
+    }
+    // Input levels come from sim_gpio_drive()
+}
+
+void GPIO_PinOutSet(GPIO_Port_TypeDef port, unsigned int pin)
+{
+    sim_gpio.P[port].DOUT |= 1 << pin;
+    sim_cs_update();
+}
+
+void GPIO_PinOutClear(GPIO_Port_TypeDef port, unsigned int pin)
+{
+    sim_gpio.P[port].DOUT &= ~(1 << pin);
+    sim_cs_update();
+}
+
+unsigned int GPIO_PinInGet(GPIO_Port_TypeDef port, unsigned int pin)
+{
+    return (sim_pin_in[port] >> pin) & 1;
+}
+
+void GPIO_ExtIntConfig(GPIO_Port_TypeDef port, unsigned int pin, unsigned int intNo,
+                       bool risingEdge, bool fallingEdge, bool enable)
+{
+    (void)pin;
+
+    sim_extint_port[intNo] = port;
+    sim_gpio.EXTIRISE = (sim_gpio.EXTIRISE & ~(1 << intNo)) | (risingEdge ? 1 << intNo : 0);
+    sim_gpio.EXTIFALL = (sim_gpio.EXTIFALL & ~(1 << intNo)) | (fallingEdge ? 1 << intNo : 0);
+    sim_gpio.IF &= ~(1 << intNo);
+    if(enable) {
+        GPIO_IntEnable(1 << intNo);
+    }
+    else {
+        GPIO_IntDisable(1 << intNo);
+    }
+}
+
+void GPIO_IntEnable(uint32_t flags)
+{
+    sim_gpio.IEN |= flags;
+    sim_gpio_check_irq();
+}
+
+void GPIO_IntDisable(uint32_t flags)
+{
+    sim_gpio.IEN &= ~flags;
+}
+
+void GPIO_IntClear(uint32_t flags)
+{
+    sim_gpio.IF &= ~flags;
+}
+
+void sim_gpio_drive(GPIO_Port_TypeDef port, unsigned int pin, unsigned int level)
+{
+    uint32_t old = (sim_pin_in[port] >> pin) & 1;
+
+    if(level) {
+        sim_pin_in[port] |= 1 << pin;
+    }
+    else {
+        sim_pin_in[port] &= ~(1 << pin);
+    }
+
+    if(sim_extint_port[pin] != port || old == (level ? 1U : 0U)) {
+        return;
+    }
+    if((level && (sim_gpio.EXTIRISE & (1 << pin))) ||
+       (!level && (sim_gpio.EXTIFALL & (1 << pin)))) {
+        sim_gpio.IF |= 1 << pin;
+        sim_gpio_check_irq();
+    }
+}
+
+void GPIOINT_Init(void)
+{
+    memset(sim_gpioint, 0, sizeof(sim_gpioint));
+}
+
+void GPIOINT_CallbackRegister(uint8_t pin, GPIOINT_IrqCallbackPtr_t callbackPtr)
+{
+    sim_gpioint[pin] = callbackPtr;
+}
+
+/* ----- DMA ----- */
+
+typedef struct {
+    bool allocated;
+    bool active;
+    uint32_t select;
+    DMA_CB_TypeDef *cb;
+    DMA_CfgDescr_TypeDef primary;
+    // Peripheral to memory transfer waiting for RXDATAV, in scatter-gather
+    // mode rxChain holds the descriptors still to load
+    uint8_t *rxDst;
+    uint32_t rxInc;
+    uint32_t rxRemaining;
+    DMA_DESCRIPTOR_TypeDef *rxChain;
+    uint32_t rxChainLeft;
+    bool rxDone;
+    // Memory to LEUART0 transfer, handed to the sink when it completes
+    const uint8_t *txSrc;
+    uint32_t txCount;
+} SIM_DmaChannel_t;
+
+static SIM_DmaChannel_t sim_dma[DMA_CHAN_COUNT];
+
+#define SIM_DMAREQ_SIGSEL(select)   ((select) & 0xFFFF)
+
+static void sim_dma_done(void *arg, uint32_t channel)
+{
+    DMA_CB_TypeDef *cb = sim_dma[channel].cb;
+
+    (void)arg;
+
+    sim_dma[channel].active = false;
+    if(cb && cb->cbFunc) {
+        cb->cbFunc(channel, true, cb->userPtr);
+    }
+}
+
+// Transfer count, increments and end pointers of one descriptor as the PL230
+// decodes them, src and dst turned back into start addresses
+static uint32_t sim_dma_decode(const DMA_DESCRIPTOR_TypeDef *d, uint8_t **src, uint8_t **dst,
+                               uint32_t *srcInc, uint32_t *dstInc, uint32_t *size)
+{
+    uint32_t n = ((d->CTRL & _DMA_CTRL_N_MINUS_1_MASK) >> _DMA_CTRL_N_MINUS_1_SHIFT) + 1;
+
+    *srcInc = (d->CTRL >> _DMA_CTRL_SRC_INC_SHIFT) & 0x3;
+    *dstInc = (d->CTRL >> _DMA_CTRL_DST_INC_SHIFT) & 0x3;
+    *size = (d->CTRL >> _DMA_CTRL_SRC_SIZE_SHIFT) & 0x3;
+    assert(*size == ((d->CTRL >> _DMA_CTRL_DST_SIZE_SHIFT) & 0x3));
+
+    *src = d->SRCEND;
+    *dst = d->DSTEND;
+    if(*srcInc != dmaDataIncNone) {
+        *src -= (n - 1) << *srcInc;
+    }
+    if(*dstInc != dmaDataIncNone) {
+        *dst -= (n - 1) << *dstInc;
+    }
+    return n;
+}
+
+// Next descriptor of an RX scatter-gather chain
+static void sim_dma_rx_load(SIM_DmaChannel_t *ch)
+{
+    uint8_t *src;
+    uint32_t srcInc;
+    uint32_t dstInc;
+    uint32_t size;
+
+    ch->rxRemaining = sim_dma_decode(ch->rxChain, &src, &ch->rxDst, &srcInc, &dstInc, &size);
+    assert(src == (uint8_t *)&sim_usart1.RXDATA && srcInc == dmaDataIncNone &&
+           size == dmaDataSize1);
+    ch->rxInc = dstInc == dmaDataIncNone ? 0 : 1;
+    ch->rxChain++;
+    ch->rxChainLeft--;
+    sim_stats.dmaDescriptors++;
+}
+
+// Byte received by USART1, picked up by a waiting RXDATAV channel
+static void sim_dma_rx(uint8_t data)
+{
+    SIM_DmaChannel_t *ch;
+    uint32_t i;
+
+    for(i = 0; i < DMA_CHAN_COUNT; i++) {
+        ch = &sim_dma[i];
+        if(ch->active && ch->rxRemaining && ch->select == DMAREQ_USART1_RXDATAV) {
+            *ch->rxDst = data;
+            ch->rxDst += ch->rxInc;
+            if(--ch->rxRemaining == 0) {
+                if(ch->rxChainLeft) {
+                    sim_dma_rx_load(ch);
+                }
+                else {
+                    ch->rxDone = true;
+                }
+            }
+            return;
+        }
+    }
+    sim_usart1.RXDATA = data;
+}
+
+/*******************************************************************************
+ * @function    sim_dma_write()
+ * @abstract    One DMA write, with the side effect the target register has
+ *
+ * @return      Bus time of the write in bytes clocked on SPI
+ ******************************************************************************/
+static uint32_t sim_dma_write(void *dst, uint32_t value, uint32_t size)
+{
+    uint32_t port;
+
+    if(dst == (void *)&sim_usart1.TXDATA) {
+        sim_dma_rx(sim_spi_byte(value & 0xFF));
+        return 1;
+    }
+    for(port = 0; port < 6; port++) {
+        if(dst == (void *)&sim_gpio.P[port].DOUTSET) {
+            sim_gpio.P[port].DOUT |= value;
+            sim_cs_update();
+            return 0;
+        }
+        if(dst == (void *)&sim_gpio.P[port].DOUTCLR) {
+            sim_gpio.P[port].DOUT &= ~value;
+            sim_cs_update();
+            return 0;
+        }
+    }
+    memcpy(dst, &value, size);
+    return 0;
+}
+
+static uint32_t sim_dma_read(const void *src, uint32_t size)
+{
+    uint32_t value = 0;
+
+    memcpy(&value, src, size);
+    return value;
+}
+
+// Run one descriptor worth of transfers, returns SPI bytes clocked
+static uint32_t sim_dma_run(uint8_t *src, uint8_t *dst, uint32_t n,
+                            uint32_t srcInc, uint32_t dstInc, uint32_t size)
+{
+    uint32_t bytes = 0;
+    uint32_t i;
+
+    for(i = 0; i < n; i++) {
+        bytes += sim_dma_write(dst, sim_dma_read(src, 1 << size), 1 << size);
+        if(srcInc != dmaDataIncNone) {
+            src += 1 << srcInc;
+        }
+        if(dstInc != dmaDataIncNone) {
+            dst += 1 << dstInc;
+        }
+    }
+    return bytes;
+}
+
+// Schedule the completion of a memory to peripheral transfer and of every
+// RX channel it has filled
+static void sim_dma_finish(unsigned int channel, uint32_t bytes)
+{
+    uint64_t duration = sim_spi_duration(bytes);
+    uint32_t ch;
+
+    if(bytes) {
+        sim_spi_claim(duration);
+    }
+    sim_schedule(duration, sim_dma_done, NULL, channel);
+    for(ch = 0; ch < DMA_CHAN_COUNT; ch++) {
+        if(sim_dma[ch].rxDone) {
+            sim_dma[ch].rxDone = false;
+            sim_schedule(duration, sim_dma_done, NULL, ch);
+        }
+    }
+}
+
+void DMA_CfgChannel(unsigned int channel, DMA_CfgChannel_TypeDef *cfg)
+{
+    sim_dma[channel].select = cfg->select;
+    sim_dma[channel].cb = cfg->cb;
+}
+
+void DMA_CfgDescr(unsigned int channel, bool primary, DMA_CfgDescr_TypeDef *cfg)
+{
+    (void)primary;
+
+    sim_dma[channel].primary = *cfg;
+}
+
+// Same encoding as emlib, so the chain is checked exactly as the PL230 reads it
+void DMA_CfgDescrScatterGather(DMA_DESCRIPTOR_TypeDef *descr, unsigned int indx,
+                               DMA_CfgDescrSGAlt_TypeDef *cfg)
+{
+    uint32_t cycleCtrl;
+
+    descr += indx;
+
+    if(cfg->srcInc == dmaDataIncNone) {
+        descr->SRCEND = cfg->src;
+    }
+    else {
+        descr->SRCEND = (uint8_t *)cfg->src + ((uint32_t)cfg->nMinus1 << cfg->srcInc);
+    }
+
+    if(cfg->dstInc == dmaDataIncNone) {
+        descr->DSTEND = cfg->dst;
+    }
+    else {
+        descr->DSTEND = (uint8_t *)cfg->dst + ((uint32_t)cfg->nMinus1 << cfg->dstInc);
+    }
+
+    cycleCtrl = cfg->peripheral ? DMA_CTRL_CYCLE_CTRL_PER_SCATTER_GATHER_ALT
+                                : DMA_CTRL_CYCLE_CTRL_MEM_SCATTER_GATHER_ALT;
+
+    descr->CTRL = ((uint32_t)cfg->dstInc << _DMA_CTRL_DST_INC_SHIFT) |
+                  ((uint32_t)cfg->size << _DMA_CTRL_DST_SIZE_SHIFT) |
+                  ((uint32_t)cfg->srcInc << _DMA_CTRL_SRC_INC_SHIFT) |
+                  ((uint32_t)cfg->size << _DMA_CTRL_SRC_SIZE_SHIFT) |
+                  ((uint32_t)cfg->arbRate << _DMA_CTRL_R_POWER_SHIFT) |
+                  ((uint32_t)cfg->nMinus1 << _DMA_CTRL_N_MINUS_1_SHIFT) |
+                  cycleCtrl;
+}
+
+/* ----- LEUART ----- */
+
+static uint64_t sim_leuart_free_at;
+static SIM_UartSink_t sim_sink;
+
+void LEUART_Init(LEUART_TypeDef *leuart, LEUART_Init_TypeDef const *init)
+{
+    leuart->CTRL = init->baudrate;
+    leuart->CMD = init->enable;
+}
+
+void LEUART_TxDmaInEM2Enable(LEUART_TypeDef *leuart, bool enable)
+{
+    (void)leuart;
+    (void)enable;
+}
+
+void LEUART_IntClear(LEUART_TypeDef *leuart, uint32_t flags)
+{
+    (void)leuart;
+    (void)flags;
+}
+
+void LEUART_IntEnable(LEUART_TypeDef *leuart, uint32_t flags)
+{
+    leuart->IEN |= flags;
+}
+
+uint8_t LEUART_Rx(LEUART_TypeDef *leuart)
+{
+    assert(leuart->STATUS & LEUART_STATUS_RXDATAV);
+    leuart->STATUS &= ~LEUART_STATUS_RXDATAV;
+    return (uint8_t)leuart->RXDATA;
+}
+
+static bool sim_leuart_irq;
+
+void NVIC_ClearPendingIRQ(IRQn_Type irq)
+{
+    (void)irq;
+}
+
+void NVIC_EnableIRQ(IRQn_Type irq)
+{
+    if(irq == LEUART0_IRQn) {
+        sim_leuart_irq = true;
+    }
+}
+
+/*******************************************************************************
+ * @function    sim_leuart_inject()
+ * @abstract    Bytes arriving on the LEUART RX line
+ * @discussion  The receiver runs from the LFXO, so unlike USART0 it also
+ *              takes bytes in EM2. Each goes to the RXDATAV interrupt, without
+ *              it enabled or with RX off bytes are lost.
+ ******************************************************************************/
+void sim_leuart_inject(const uint8_t *data, uint32_t count)
+{
+    uint32_t i;
+
+    if(!(sim_leuart0.CMD & leuartEnableRx) || !(sim_leuart0.ROUTE & LEUART_ROUTE_RXPEN)) {
+        return;
+    }
+    for(i = 0; i < count; i++) {
+        sim_leuart0.RXDATA = data[i];
+        sim_leuart0.STATUS |= LEUART_STATUS_RXDATAV;
+        if(sim_leuart_irq && LEUART0_IRQHandler && (sim_leuart0.IEN & LEUART_IEN_RXDATAV)) {
+            LEUART0_IRQHandler();
+        }
+    }
+}
+
+// The last byte of a TXBL transfer has left
+static void sim_leuart_done(void *arg, uint32_t channel)
+{
+    SIM_DmaChannel_t *ch = &sim_dma[channel];
+
+    sim_stats.leuartFrames++;
+    sim_stats.leuartBytes += ch->txCount;
+    if(sim_sink) {
+        sim_sink(ch->txSrc, ch->txCount);
+    }
+    sim_dma_done(arg, channel);
+}
+
+// One byte per TXBL request at the LEUART baud rate, buffers back to back
+static void sim_leuart_tx(unsigned int channel, const void *src, uint32_t count)
+{
+    SIM_DmaChannel_t *ch = &sim_dma[channel];
+    uint32_t baud = sim_leuart0.CTRL;
+    uint64_t start = sim_leuart_free_at > sim_now_us ? sim_leuart_free_at : sim_now_us;
+    uint64_t duration = ((uint64_t)count * 10 * 1000000 + baud - 1) / baud;
+
+    assert(baud && (sim_leuart0.CMD & leuartEnableTx));
+    ch->txSrc = src;
+    ch->txCount = count;
+    sim_stats.dmaDescriptors++;
+    sim_stats.leuartBusyUs += duration;
+    sim_leuart_free_at = start + duration;
+    sim_schedule(sim_leuart_free_at - sim_now_us, sim_leuart_done, NULL, channel);
+}
+
+void DMA_ActivateBasic(unsigned int channel, bool primary, bool useBurst,
+                       void *dst, const void *src, unsigned int nMinus1)
+{
+    SIM_DmaChannel_t *ch = &sim_dma[channel];
+    uint32_t bytes;
+
+    (void)primary;
+    (void)useBurst;
+
+    assert(ch->allocated && !ch->active);
+    ch->active = true;
+
+    if(ch->select == DMAREQ_LEUART0_TXBL) {
+        assert(dst == (void *)&sim_leuart0.TXDATA);
+        sim_leuart_tx(channel, src, nMinus1 + 1);
+        return;
+    }
+
+    if(SIM_DMAREQ_SIGSEL(ch->select) == 0) {
+        // RXDATAV, runs as bytes arrive
+        ch->rxDst = dst;
+        ch->rxInc = ch->primary.dstInc == dmaDataIncNone ? 0 : 1;
+        ch->rxRemaining = nMinus1 + 1;
+        ch->rxChainLeft = 0;
+        ch->rxDone = false;
+        return;
+    }
+
+    sim_stats.dmaDescriptors++;
+    bytes = sim_dma_run((uint8_t *)src, dst, nMinus1 + 1,
+                        ch->primary.srcInc, ch->primary.dstInc, ch->primary.size);
+    sim_dma_finish(channel, bytes);
+}
+
+void DMA_ActivateScatterGather(unsigned int channel, bool useBurst,
+                               DMA_DESCRIPTOR_TypeDef *altDescr, unsigned int count)
+{
+    SIM_DmaChannel_t *ch = &sim_dma[channel];
+    DMA_DESCRIPTOR_TypeDef *d;
+    uint32_t cycleCtrl;
+    uint32_t bytes = 0;
+    uint32_t n;
+    uint32_t srcInc;
+    uint32_t dstInc;
+    uint32_t size;
+    uint8_t *src;
+    uint8_t *dst;
+    uint32_t i;
+
+    (void)useBurst;
+
+    assert(ch->allocated && !ch->active && count);
+    ch->active = true;
+    sim_stats.dmaBursts++;
+
+    // emlib turns the last descriptor into a basic cycle to end the chain
+    cycleCtrl = altDescr[count - 1].CTRL & _DMA_CTRL_CYCLE_CTRL_MASK;
+    assert(cycleCtrl == DMA_CTRL_CYCLE_CTRL_PER_SCATTER_GATHER_ALT ||
+           cycleCtrl == DMA_CTRL_CYCLE_CTRL_BASIC);
+    altDescr[count - 1].CTRL = (altDescr[count - 1].CTRL & ~_DMA_CTRL_CYCLE_CTRL_MASK) |
+                               DMA_CTRL_CYCLE_CTRL_BASIC;
+
+    for(i = 0; i < count; i++) {
+        cycleCtrl = altDescr[i].CTRL & _DMA_CTRL_CYCLE_CTRL_MASK;
+        assert(i == count - 1 ? cycleCtrl == DMA_CTRL_CYCLE_CTRL_BASIC
+                              : cycleCtrl == DMA_CTRL_CYCLE_CTRL_PER_SCATTER_GATHER_ALT);
+    }
+
+    if(SIM_DMAREQ_SIGSEL(ch->select) == 0) {
+        // RXDATAV, every descriptor runs as its bytes arrive
+        ch->rxChain = altDescr;
+        ch->rxChainLeft = count;
+        ch->rxDone = false;
+        sim_dma_rx_load(ch);
+        return;
+    }
+
+    for(i = 0; i < count; i++) {
+        d = &altDescr[i];
+        n = sim_dma_decode(d, &src, &dst, &srcInc, &dstInc, &size);
+
+        sim_stats.dmaDescriptors++;
+        bytes += sim_dma_run(src, dst, n, srcInc, dstInc, size);
+    }
+
+    sim_dma_finish(channel, bytes);
+}
+
+bool DMA_ChannelEnabled(unsigned int channel)
+{
+    return sim_dma[channel].active;
+}
+
+Ecode_t DMADRV_Init(void)
+{
+    return ECODE_OK;
+}
+
+Ecode_t DMADRV_AllocateChannel(unsigned int *channelId, void *capabilities)
+{
+    unsigned int ch;
+
+    (void)capabilities;
+
+    for(ch = 0; ch < DMA_CHAN_COUNT; ch++) {
+        if(!sim_dma[ch].allocated) {
+            sim_dma[ch].allocated = true;
+            *channelId = ch;
+            return ECODE_OK;
+        }
+    }
+    return ECODE_EMDRV_DMADRV_CHANNELS_EXHAUSTED;
+}
+
+/* ----- SPIDRV ----- */
+
+static void sim_spi_exchange(const uint8_t *tx, uint8_t *rx, int count, uint32_t dummy)
+{
+    int i;
+    uint8_t in;
+
+    for(i = 0; i < count; i++) {
+        in = sim_spi_byte(tx ? tx[i] : dummy);
+        if(rx) {
+            rx[i] = in;
+        }
+    }
+}
+
+static void sim_spidrv_done(void *arg, uint32_t param)
+{
+    SPIDRV_Handle_t handle = arg;
+
+    (void)param;
+
+    handle->busy = false;
+    if(handle->userCallback) {
+        handle->userCallback(handle, ECODE_OK, handle->count);
+    }
+}
+
+static Ecode_t sim_spidrv_start(SPIDRV_Handle_t handle, const void *tx, void *rx, int count,
+                                SPIDRV_Callback_t callback)
+{
+    uint64_t duration = sim_spi_duration(count);
+
+    if(handle->busy) {
+        sim_stats.spiBusyErrors++;
+        return ECODE_EMDRV_SPIDRV_BUSY;
+    }
+    sim_spi_claim(duration);
+    sim_spi_exchange(tx, rx, count, handle->initData.dummyTxValue);
+
+    handle->busy = true;
+    handle->userCallback = callback;
+    handle->count = count;
+    sim_schedule(duration, sim_spidrv_done, handle, 0);
+    return ECODE_OK;
+}
+
+// Blocking calls spin until the bytes are out, time passes without events
+static Ecode_t sim_spidrv_blocking(SPIDRV_Handle_t handle, const void *tx, void *rx, int count)
+{
+    uint64_t duration = sim_spi_duration(count);
+
+    if(handle->busy) {
+        sim_stats.spiBusyErrors++;
+        return ECODE_EMDRV_SPIDRV_BUSY;
+    }
+    sim_spi_claim(duration);
+    sim_spi_exchange(tx, rx, count, handle->initData.dummyTxValue);
+    sim_now_us += duration;
+    return ECODE_OK;
+}
+
+Ecode_t SPIDRV_Init(SPIDRV_Handle_t handle, SPIDRV_Init_t *initData)
+{
+    memset(handle, 0, sizeof(*handle));
+    handle->initData = *initData;
+    sim_spi_bitrate = initData->bitRate;
+    return ECODE_OK;
+}
+
+Ecode_t SPIDRV_MTransmitB(SPIDRV_Handle_t handle, const void *buffer, int count)
+{
+    return sim_spidrv_blocking(handle, buffer, NULL, count);
+}
+
+Ecode_t SPIDRV_MReceiveB(SPIDRV_Handle_t handle, void *buffer, int count)
+{
+    return sim_spidrv_blocking(handle, NULL, buffer, count);
+}
+
+Ecode_t SPIDRV_MTransferB(SPIDRV_Handle_t handle, const void *txBuffer, void *rxBuffer, int count)
+{
+    return sim_spidrv_blocking(handle, txBuffer, rxBuffer, count);
+}
+
+Ecode_t SPIDRV_MTransmit(SPIDRV_Handle_t handle, const void *buffer, int count,
+                         SPIDRV_Callback_t callback)
+{
+    return sim_spidrv_start(handle, buffer, NULL, count, callback);
+}
+
+Ecode_t SPIDRV_MReceive(SPIDRV_Handle_t handle, void *buffer, int count,
+                        SPIDRV_Callback_t callback)
+{
+    return sim_spidrv_start(handle, NULL, buffer, count, callback);
+}
+
+Ecode_t SPIDRV_MTransfer(SPIDRV_Handle_t handle, const void *txBuffer, void *rxBuffer,
+                         int count, SPIDRV_Callback_t callback)
+{
+    return sim_spidrv_start(handle, txBuffer, rxBuffer, count, callback);
+}
+
+/* ----- UARTDRV ----- */
+
+static UARTDRV_Handle_t sim_uart;
+
+void sim_uart_sink(SIM_UartSink_t sink)
+{
+    sim_sink = sink;
+}
+
+static UARTDRV_Buffer_t *sim_fifo_push(UARTDRV_Buffer_FifoQueue_t *q)
+{
+    UARTDRV_Buffer_t *b;
+
+    if(q->used >= q->size) {
+        return NULL;
+    }
+    b = &q->fifo[q->tail];
+    q->tail = (q->tail + 1) % q->size;
+    q->used++;
+    return b;
+}
+
+static UARTDRV_Buffer_t *sim_fifo_pop(UARTDRV_Buffer_FifoQueue_t *q)
+{
+    UARTDRV_Buffer_t *b = &q->fifo[q->head];
+
+    q->head = (q->head + 1) % q->size;
+    q->used--;
+    return b;
+}
+
+// Bytes are taken from the buffer when they leave, as the TX DMA would
+static void sim_uart_tx_done(void *arg, uint32_t param)
+{
+    UARTDRV_Handle_t handle = arg;
+    UARTDRV_Buffer_t b = *sim_fifo_pop(handle->txQueue);
+
+    (void)param;
+
+    sim_stats.uartFrames++;
+    sim_stats.uartBytes += b.transferCount;
+    if(sim_sink) {
+        sim_sink(b.data, b.transferCount);
+    }
+    if(b.callback) {
+        b.callback(handle, ECODE_OK, b.data, b.transferCount);
+    }
+}
+
+static void sim_uart_rx_done(void *arg, uint32_t param)
+{
+    UARTDRV_Handle_t handle = arg;
+    UARTDRV_Buffer_t b = *sim_fifo_pop(handle->rxQueue);
+
+    (void)param;
+
+    if(b.callback) {
+        b.callback(handle, ECODE_OK, b.data, b.transferCount);
+    }
+}
+
+Ecode_t UARTDRV_InitUart(UARTDRV_Handle_t handle, const UARTDRV_InitUart_t *initData)
+{
+    memset(handle, 0, sizeof(*handle));
+    handle->baudRate = initData->baudRate;
+    handle->rxQueue = initData->rxQueue;
+    handle->txQueue = initData->txQueue;
+    sim_uart = handle;
+    return ECODE_OK;
+}
+
+Ecode_t UARTDRV_Transmit(UARTDRV_Handle_t handle, uint8_t *data, UARTDRV_Count_t count,
+                         UARTDRV_Callback_t callback)
+{
+    UARTDRV_Buffer_t *b;
+    uint64_t start;
+    uint64_t duration;
+
+    b = sim_fifo_push(handle->txQueue);
+    if(!b) {
+        sim_stats.uartQueueFull++;
+        return ECODE_EMDRV_UARTDRV_QUEUE_FULL;
+    }
+    b->data = data;
+    b->transferCount = count;
+    b->itemsRemaining = count;
+    b->callback = callback;
+    b->transferStatus = ECODE_OK;
+
+    // 8N1, 10 bit times per byte, buffers go out back to back
+    start = handle->txFreeAt > sim_now_us ? handle->txFreeAt : sim_now_us;
+    duration = ((uint64_t)count * 10 * 1000000 + handle->baudRate - 1) / handle->baudRate;
+    handle->txFreeAt = start + duration;
+    sim_stats.uartBusyUs += duration;
+
+    sim_schedule(handle->txFreeAt - sim_now_us, sim_uart_tx_done, handle, 0);
+    return ECODE_OK;
+}
+
+Ecode_t UARTDRV_Receive(UARTDRV_Handle_t handle, uint8_t *data, UARTDRV_Count_t count,
+                        UARTDRV_Callback_t callback)
+{
+    UARTDRV_Buffer_t *b = sim_fifo_push(handle->rxQueue);
+
+    if(!b) {
+        return ECODE_EMDRV_UARTDRV_QUEUE_FULL;
+    }
+    b->data = data;
+    b->transferCount = count;
+    b->itemsRemaining = count;
+    b->callback = callback;
+    b->transferStatus = ECODE_OK;
+    return ECODE_OK;
+}
+
+uint8_t UARTDRV_GetTransmitDepth(UARTDRV_Handle_t handle)
+{
+    return handle->txQueue->used;
+}
+
+/*******************************************************************************
+ * @function    sim_uart_inject()
+ * @abstract    Bytes arriving on the UART RX line
+ * @discussion  Filled into the queued receive buffers in order, a full buffer
+ *              completes from the event loop. Bytes without a buffer are lost,
+ *              as are bytes arriving in EM2 where USART0 has no clock.
+ ******************************************************************************/
+void sim_uart_inject(const uint8_t *data, uint32_t count)
+{
+    UARTDRV_Buffer_FifoQueue_t *q;
+    UARTDRV_Buffer_t *b;
+    uint32_t i;
+    uint32_t slot = 0;
+
+    if(!sim_uart) {
+        return;
+    }
+    if(sim_in_em2) {
+        sim_stats.uartRxLost += count;
+        return;
+    }
+    q = sim_uart->rxQueue;
+
+    for(i = 0; i < count; i++) {
+        // Skip buffers already full and waiting for their completion event
+        while(slot < q->used && !q->fifo[(q->head + slot) % q->size].itemsRemaining) {
+            slot++;
+        }
+        if(slot >= q->used) {
+            break;
+        }
+        b = &q->fifo[(q->head + slot) % q->size];
+        b->data[b->transferCount - b->itemsRemaining] = data[i];
+        if(--b->itemsRemaining == 0) {
+            sim_schedule(0, sim_uart_rx_done, sim_uart, 0);
+        }
+    }
+}
+
+/* ----- RTCDRV ----- */
+
+typedef struct {
+    bool allocated;
+    bool running;
+    RTCDRV_TimerType_t type;
+    uint32_t timeout;
+    RTCDRV_Callback_t callback;
+    void *user;
+} SIM_Timer_t;
+
+static SIM_Timer_t sim_timers[EMDRV_RTCDRV_NUM_TIMERS];
+
+static void sim_rtc_fire(void *arg, uint32_t id)
+{
+    SIM_Timer_t *t = arg;
+
+    if(t->type == rtcdrvTimerTypePeriodic) {
+        sim_schedule((uint64_t)t->timeout * 1000, sim_rtc_fire, t, id);
+    }
+    else {
+        t->running = false;
+    }
+    sim_stats.rtcFires++;
+    if(t->callback) {
+        t->callback(id, t->user);
+    }
+}
+
+Ecode_t RTCDRV_Init(void)
+{
+    return ECODE_OK;
+}
+
+Ecode_t RTCDRV_AllocateTimer(RTCDRV_TimerID_t *id)
+{
+    uint32_t i;
+
+    for(i = 0; i < EMDRV_RTCDRV_NUM_TIMERS; i++) {
+        if(!sim_timers[i].allocated) {
+            sim_timers[i].allocated = true;
+            *id = i;
+            return ECODE_OK;
+        }
+    }
+    return ECODE_EMDRV_RTCDRV_ALL_TIMERS_USED;
+}
+
+Ecode_t RTCDRV_StartTimer(RTCDRV_TimerID_t id, RTCDRV_TimerType_t type, uint32_t timeout,
+                          RTCDRV_Callback_t callback, void *user)
+{
+    SIM_Timer_t *t;
+
+    if(id >= EMDRV_RTCDRV_NUM_TIMERS || !sim_timers[id].allocated) {
+        return ECODE_EMDRV_RTCDRV_ILLEGAL_TIMER_ID;
+    }
+    t = &sim_timers[id];
+    sim_cancel(sim_rtc_fire, t);
+    t->running = true;
+    t->type = type;
+    t->timeout = timeout;
+    t->callback = callback;
+    t->user = user;
+    sim_schedule((uint64_t)timeout * 1000, sim_rtc_fire, t, id);
+    return ECODE_OK;
+}
+
+Ecode_t RTCDRV_StopTimer(RTCDRV_TimerID_t id)
+{
+    if(id >= EMDRV_RTCDRV_NUM_TIMERS || !sim_timers[id].allocated) {
+        return ECODE_EMDRV_RTCDRV_ILLEGAL_TIMER_ID;
+    }
+    sim_cancel(sim_rtc_fire, &sim_timers[id]);
+    sim_timers[id].running = false;
+    return ECODE_OK;
+}
+
+Ecode_t RTCDRV_IsRunning(RTCDRV_TimerID_t id, bool *isRunning)
+{
+    if(id >= EMDRV_RTCDRV_NUM_TIMERS || !sim_timers[id].allocated) {
+        return ECODE_EMDRV_RTCDRV_ILLEGAL_TIMER_ID;
+    }
+    *isRunning = sim_timers[id].running;
+    return ECODE_OK;
+}
+
+uint64_t RTCDRV_GetWallClockTicks64(void)
+{
+    return sim_now_us * 32768 / 1000000;
+}
+
+uint32_t RTCDRV_GetWallClockTicks32(void)
+{
+    return (uint32_t)RTCDRV_GetWallClockTicks64();
+}
+
+uint32_t RTCDRV_TicksToMsec(uint64_t ticks)
+{
+    return (uint32_t)(ticks * 1000 / 32768);
+}
+
+uint64_t RTCDRV_MsecsToTicks(uint32_t ms)
+{
+    return (uint64_t)ms * 32768 / 1000;
+}
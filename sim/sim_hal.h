@@ -0,0 +1,525 @@
+/*
+ * sim_hal.h
+ *
+ * Host stand-ins for the parts of emlib and emdrv used by src/
+ *
+ * Every SDK header the firmware includes (em_device.h, spidrv.h, ...) is a
+ * one line forward to this file when building with -Isim. Types and
+ * signatures follow Gecko SDK v2.3. Peripherals are plain structs, DMA
+ * descriptors are executed by sim_hal.c and every completion runs from the
+ * event loop, so callbacks see the same ordering as interrupts on the board.
+ */
+
+#ifndef SIM_HAL
+#define SIM_HAL
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <assert.h>
+#include <setjmp.h>
+
+/* ----- Event loop ----- */
+
+typedef void (*SIM_EventFn_t)(void *arg, uint32_t param);
+
+/* @var sim_now_us  Virtual time since reset */
+extern uint64_t sim_now_us;
+
+void sim_schedule(uint64_t delay_us, SIM_EventFn_t fn, void *arg, uint32_t param);
+void sim_cancel(SIM_EventFn_t fn, void *arg);
+bool sim_step(uint64_t limit_us);
+
+/*
+ * The firmware main loop never returns. Its sleep calls run the event loop
+ * instead and jump to sim_exit once sim_end_us is reached.
+ */
+extern uint64_t sim_end_us;
+extern jmp_buf sim_exit;
+
+void sim_sleep_end(void);
+
+/* ----- Core ----- */
+
+typedef uint32_t Ecode_t;
+#define ECODE_OK                            0
+#define ECODE_EMDRV_SPIDRV_BUSY             0x00002006
+#define ECODE_EMDRV_UARTDRV_QUEUE_FULL      0x00001009
+#define ECODE_EMDRV_UARTDRV_ILLEGAL_HANDLE  0x00001001
+#define ECODE_EMDRV_RTCDRV_ILLEGAL_TIMER_ID 0x00000002
+#define ECODE_EMDRV_RTCDRV_ALL_TIMERS_USED  0x00000001
+#define ECODE_EMDRV_DMADRV_CHANNELS_EXHAUSTED 0x00003005
+
+#define EFM_ASSERT(x)           assert(x)
+#define __DMB()                 __sync_synchronize()
+
+// Single threaded, interrupts are events that never preempt
+#define CORE_DECLARE_IRQ_STATE  int irqState = 0
+#define CORE_ENTER_ATOMIC()     (void)irqState
+#define CORE_EXIT_ATOMIC()      (void)irqState
+#define CORE_ENTER_CRITICAL()   (void)irqState
+#define CORE_EXIT_CRITICAL()    (void)irqState
+#define CORE_ATOMIC_SECTION(x)  { x }
+
+void CHIP_Init(void);
+
+/* ----- EMU ----- */
+
+void EMU_EnterEM1(void);
+void EMU_EnterEM2(bool restore);
+
+/* ----- MSC ----- */
+
+/*
+ * The flash is an array, sim_main.c erases it or loads an image saved by an
+ * earlier run, which models a reset. Writes only clear bits and erases set a
+ * whole page, as on the chip, so a word written twice without an erase
+ * shows up in the image.
+ */
+#define FLASH_PAGE_SIZE         2048
+#define FLASH_SIZE              0x00040000UL
+extern uint8_t sim_flash[FLASH_SIZE];
+#define FLASH_BASE              ((uintptr_t)sim_flash)
+
+typedef enum {
+    mscReturnOk = 0, mscReturnInvalidAddr = -1, mscReturnLocked = -2, mscReturnUnaligned = -4
+} MSC_Status_TypeDef;
+
+void MSC_Init(void);
+MSC_Status_TypeDef MSC_ErasePage(uint32_t *startAddress);
+MSC_Status_TypeDef MSC_WriteWord(uint32_t *address, void const *data, uint32_t numBytes);
+
+/* ----- Sleep driver ----- */
+
+typedef enum { sleepEM0 = 0, sleepEM1 = 1, sleepEM2 = 2, sleepEM3 = 3, sleepEM4 = 4 } SLEEP_EnergyMode_t;
+typedef void (*SLEEP_CbFuncPtr_t)(SLEEP_EnergyMode_t mode);
+
+// Block counts as in emdrv, blocking a mode blocks every deeper one
+void SLEEP_Init(SLEEP_CbFuncPtr_t sleepCb, SLEEP_CbFuncPtr_t wakeupCb);
+SLEEP_EnergyMode_t SLEEP_Sleep(void);
+void SLEEP_SleepBlockBegin(SLEEP_EnergyMode_t mode);
+void SLEEP_SleepBlockEnd(SLEEP_EnergyMode_t mode);
+SLEEP_EnergyMode_t SLEEP_LowestEnergyModeGet(void);
+
+/* ----- Peripherals ----- */
+
+typedef struct {
+    volatile uint32_t CTRL;
+    volatile uint32_t MODEL;
+    volatile uint32_t MODEH;
+    volatile uint32_t DOUT;
+    volatile uint32_t DOUTSET;
+    volatile uint32_t DOUTCLR;
+    volatile uint32_t DOUTTGL;
+    volatile uint32_t DIN;
+} GPIO_P_TypeDef;
+
+typedef struct {
+    GPIO_P_TypeDef P[6];
+    volatile uint32_t IEN;
+    volatile uint32_t IF;
+    volatile uint32_t EXTIRISE;
+    volatile uint32_t EXTIFALL;
+} GPIO_TypeDef;
+
+typedef struct {
+    volatile uint32_t CTRL;
+    volatile uint32_t CMD;
+    volatile uint32_t STATUS;
+    volatile uint32_t RXDATA;
+    volatile uint32_t TXDATA;
+} USART_TypeDef;
+
+typedef struct {
+    volatile uint32_t CTRL;
+    volatile uint32_t CMD;
+    volatile uint32_t STATUS;
+    volatile uint32_t RXDATA;
+    volatile uint32_t TXDATA;
+    volatile uint32_t IEN;
+    volatile uint32_t ROUTE;
+} LEUART_TypeDef;
+
+extern GPIO_TypeDef sim_gpio;
+extern USART_TypeDef sim_usart0;
+extern USART_TypeDef sim_usart1;
+extern LEUART_TypeDef sim_leuart0;
+
+#define GPIO                    (&sim_gpio)
+#define USART0                  (&sim_usart0)
+#define USART1                  (&sim_usart1)
+#define LEUART0                 (&sim_leuart0)
+
+#define USART_CMD_CLEARRX       0x00000800
+#define USART_CMD_CLEARTX       0x00000400
+#define _USART_ROUTE_LOCATION_LOC1  1
+#define _USART_ROUTE_LOCATION_LOC5  5
+
+// DMA request selects, SOURCESEL << 16 | SIGSEL as in efm32wg_dmareq.h
+#define DMAREQ_USART0_RXDATAV   ((0x0C << 16) + 0)
+#define DMAREQ_USART0_TXBL      ((0x0C << 16) + 1)
+#define DMAREQ_USART0_TXEMPTY   ((0x0C << 16) + 2)
+#define DMAREQ_USART1_RXDATAV   ((0x0D << 16) + 0)
+#define DMAREQ_USART1_TXBL      ((0x0D << 16) + 1)
+#define DMAREQ_USART1_TXEMPTY   ((0x0D << 16) + 2)
+#define DMAREQ_LEUART0_TXBL     ((0x10 << 16) + 1)
+
+/* ----- CMU ----- */
+
+typedef enum {
+    cmuClock_HF, cmuClock_CORELE, cmuClock_LFB, cmuClock_GPIO,
+    cmuClock_USART0, cmuClock_USART1, cmuClock_DMA, cmuClock_RTC, cmuClock_LEUART0
+} CMU_Clock_TypeDef;
+
+typedef enum { cmuSelect_LFXO, cmuSelect_LFRCO, cmuSelect_CORELEDIV2 } CMU_Select_TypeDef;
+
+void CMU_ClockEnable(CMU_Clock_TypeDef clock, bool enable);
+void CMU_ClockSelectSet(CMU_Clock_TypeDef clock, CMU_Select_TypeDef ref);
+
+/* ----- GPIO ----- */
+
+typedef enum { gpioPortA, gpioPortB, gpioPortC, gpioPortD, gpioPortE, gpioPortF } GPIO_Port_TypeDef;
+
+typedef enum {
+    gpioModeDisabled, gpioModeInput, gpioModeInputPull, gpioModePushPull
+} GPIO_Mode_TypeDef;
+
+void GPIO_PinModeSet(GPIO_Port_TypeDef port, unsigned int pin, GPIO_Mode_TypeDef mode, unsigned int out);
+void GPIO_PinOutSet(GPIO_Port_TypeDef port, unsigned int pin);
+void GPIO_PinOutClear(GPIO_Port_TypeDef port, unsigned int pin);
+unsigned int GPIO_PinInGet(GPIO_Port_TypeDef port, unsigned int pin);
+void GPIO_ExtIntConfig(GPIO_Port_TypeDef port, unsigned int pin, unsigned int intNo,
+                       bool risingEdge, bool fallingEdge, bool enable);
+void GPIO_IntEnable(uint32_t flags);
+void GPIO_IntDisable(uint32_t flags);
+void GPIO_IntClear(uint32_t flags);
+
+/* Drive an input pin from outside, as a peripheral on the board would */
+void sim_gpio_drive(GPIO_Port_TypeDef port, unsigned int pin, unsigned int level);
+
+/* ----- USART ----- */
+
+typedef enum { usartStopbits1 } USART_Stopbits_TypeDef;
+typedef enum { usartNoParity } USART_Parity_TypeDef;
+typedef enum { usartOVS16 } USART_OVS_TypeDef;
+
+/* ----- LEUART ----- */
+
+typedef enum { leuartDisable, leuartEnableRx, leuartEnableTx, leuartEnable } LEUART_Enable_TypeDef;
+typedef enum { leuartDatabits8 } LEUART_Databits_TypeDef;
+typedef enum { leuartNoParity } LEUART_Parity_TypeDef;
+typedef enum { leuartStopbits1 } LEUART_Stopbits_TypeDef;
+
+typedef struct {
+    LEUART_Enable_TypeDef enable;
+    uint32_t refFreq;
+    uint32_t baudrate;
+    LEUART_Databits_TypeDef databits;
+    LEUART_Parity_TypeDef parity;
+    LEUART_Stopbits_TypeDef stopbits;
+} LEUART_Init_TypeDef;
+
+#define LEUART_INIT_DEFAULT     { leuartEnable, 0, 9600, leuartDatabits8, leuartNoParity, leuartStopbits1 }
+#define LEUART_ROUTE_RXPEN          0x00000001
+#define LEUART_ROUTE_TXPEN          0x00000002
+#define LEUART_ROUTE_LOCATION_LOC2  0x00000200
+#define LEUART_STATUS_RXDATAV       0x00000020
+#define LEUART_IEN_RXDATAV          0x00000004
+#define LEUART_IFC_MASK             0x000007F9
+
+// The baud rate is kept in CTRL, the model has no clock divider
+void LEUART_Init(LEUART_TypeDef *leuart, LEUART_Init_TypeDef const *init);
+void LEUART_TxDmaInEM2Enable(LEUART_TypeDef *leuart, bool enable);
+void LEUART_IntClear(LEUART_TypeDef *leuart, uint32_t flags);
+void LEUART_IntEnable(LEUART_TypeDef *leuart, uint32_t flags);
+uint8_t LEUART_Rx(LEUART_TypeDef *leuart);
+
+// Provided by the firmware, weak like the default handlers of the startup code
+// so that the unit tests link without it
+void LEUART0_IRQHandler(void) __attribute__((weak));
+
+/* ----- NVIC ----- */
+
+typedef enum { LEUART0_IRQn = 24 } IRQn_Type;
+
+// Interrupts are taken when their event runs, only the enable is kept
+void NVIC_ClearPendingIRQ(IRQn_Type irq);
+void NVIC_EnableIRQ(IRQn_Type irq);
+
+/* ----- DMA ----- */
+
+typedef struct {
+    void * volatile SRCEND;
+    void * volatile DSTEND;
+    volatile uint32_t CTRL;
+    volatile uint32_t USER;
+} DMA_DESCRIPTOR_TypeDef;
+
+// PL230 channel_cfg layout, as used by the hardware descriptors
+#define _DMA_CTRL_DST_INC_SHIFT         30
+#define _DMA_CTRL_DST_SIZE_SHIFT        28
+#define _DMA_CTRL_SRC_INC_SHIFT         26
+#define _DMA_CTRL_SRC_SIZE_SHIFT        24
+#define _DMA_CTRL_R_POWER_SHIFT         14
+#define _DMA_CTRL_N_MINUS_1_SHIFT       4
+#define _DMA_CTRL_N_MINUS_1_MASK        0x3FF0
+#define _DMA_CTRL_CYCLE_CTRL_MASK       0x7
+#define DMA_CTRL_CYCLE_CTRL_BASIC       0x1
+#define DMA_CTRL_CYCLE_CTRL_MEM_SCATTER_GATHER      0x4
+#define DMA_CTRL_CYCLE_CTRL_MEM_SCATTER_GATHER_ALT  0x5
+#define DMA_CTRL_CYCLE_CTRL_PER_SCATTER_GATHER      0x6
+#define DMA_CTRL_CYCLE_CTRL_PER_SCATTER_GATHER_ALT  0x7
+
+#define DMA_CHAN_COUNT                  12
+
+typedef void (*DMA_FuncPtr_TypeDef)(unsigned int channel, bool primary, void *user);
+
+typedef struct {
+    DMA_FuncPtr_TypeDef cbFunc;
+    void *userPtr;
+    uint8_t primary;
+} DMA_CB_TypeDef;
+
+typedef struct {
+    bool highPri;
+    bool enableInt;
+    uint32_t select;
+    DMA_CB_TypeDef *cb;
+} DMA_CfgChannel_TypeDef;
+
+typedef enum { dmaDataInc1, dmaDataInc2, dmaDataInc4, dmaDataIncNone } DMA_DataInc_TypeDef;
+typedef enum { dmaDataSize1, dmaDataSize2, dmaDataSize4 } DMA_DataSize_TypeDef;
+typedef enum {
+    dmaArbitrate1, dmaArbitrate2, dmaArbitrate4, dmaArbitrate8, dmaArbitrate16
+} DMA_ArbiterConfig_TypeDef;
+
+typedef struct {
+    DMA_DataInc_TypeDef dstInc;
+    DMA_DataInc_TypeDef srcInc;
+    DMA_DataSize_TypeDef size;
+    DMA_ArbiterConfig_TypeDef arbRate;
+    uint8_t hprot;
+} DMA_CfgDescr_TypeDef;
+
+typedef struct {
+    void *dst;
+    void *src;
+    uint16_t nMinus1;
+    DMA_DataInc_TypeDef dstInc;
+    DMA_DataInc_TypeDef srcInc;
+    DMA_DataSize_TypeDef size;
+    DMA_ArbiterConfig_TypeDef arbRate;
+    uint8_t hprot;
+    bool peripheral;
+} DMA_CfgDescrSGAlt_TypeDef;
+
+void DMA_CfgChannel(unsigned int channel, DMA_CfgChannel_TypeDef *cfg);
+void DMA_CfgDescr(unsigned int channel, bool primary, DMA_CfgDescr_TypeDef *cfg);
+void DMA_CfgDescrScatterGather(DMA_DESCRIPTOR_TypeDef *descr, unsigned int indx,
+                               DMA_CfgDescrSGAlt_TypeDef *cfg);
+void DMA_ActivateBasic(unsigned int channel, bool primary, bool useBurst,
+                       void *dst, const void *src, unsigned int nMinus1);
+void DMA_ActivateScatterGather(unsigned int channel, bool useBurst,
+                               DMA_DESCRIPTOR_TypeDef *altDescr, unsigned int count);
+bool DMA_ChannelEnabled(unsigned int channel);
+
+Ecode_t DMADRV_Init(void);
+Ecode_t DMADRV_AllocateChannel(unsigned int *channelId, void *capabilities);
+
+/* ----- RTCDRV ----- */
+
+#define EMDRV_RTCDRV_NUM_TIMERS         4
+
+typedef uint32_t RTCDRV_TimerID_t;
+typedef void (*RTCDRV_Callback_t)(RTCDRV_TimerID_t id, void *user);
+typedef enum { rtcdrvTimerTypeOneshot, rtcdrvTimerTypePeriodic } RTCDRV_TimerType_t;
+
+Ecode_t RTCDRV_Init(void);
+Ecode_t RTCDRV_AllocateTimer(RTCDRV_TimerID_t *id);
+Ecode_t RTCDRV_StartTimer(RTCDRV_TimerID_t id, RTCDRV_TimerType_t type, uint32_t timeout,
+                          RTCDRV_Callback_t callback, void *user);
+Ecode_t RTCDRV_StopTimer(RTCDRV_TimerID_t id);
+Ecode_t RTCDRV_IsRunning(RTCDRV_TimerID_t id, bool *isRunning);
+uint32_t RTCDRV_GetWallClockTicks32(void);
+uint64_t RTCDRV_GetWallClockTicks64(void);
+uint32_t RTCDRV_TicksToMsec(uint64_t ticks);
+uint64_t RTCDRV_MsecsToTicks(uint32_t ms);
+
+/* ----- SPIDRV ----- */
+
+typedef enum { spidrvMaster, spidrvSlave } SPIDRV_Type_t;
+typedef enum { spidrvBitOrderLsbFirst, spidrvBitOrderMsbFirst } SPIDRV_BitOrder_t;
+typedef enum { spidrvClockMode0, spidrvClockMode1, spidrvClockMode2, spidrvClockMode3 } SPIDRV_ClockMode_t;
+typedef enum { spidrvCsControlAuto, spidrvCsControlApplication } SPIDRV_CsControl_t;
+typedef enum { spidrvSlaveStartImmediate, spidrvSlaveStartDelayed } SPIDRV_SlaveStart_t;
+
+typedef struct {
+    USART_TypeDef *port;
+    uint8_t portLocation;
+    uint32_t bitRate;
+    unsigned int frameLength;
+    uint32_t dummyTxValue;
+    SPIDRV_Type_t type;
+    SPIDRV_BitOrder_t bitOrder;
+    SPIDRV_ClockMode_t clockMode;
+    SPIDRV_CsControl_t csControl;
+    SPIDRV_SlaveStart_t slaveStartMode;
+} SPIDRV_Init_t;
+
+typedef struct SPIDRV_HandleData SPIDRV_HandleData_t;
+typedef SPIDRV_HandleData_t *SPIDRV_Handle_t;
+typedef void (*SPIDRV_Callback_t)(SPIDRV_Handle_t handle, Ecode_t transferStatus, int itemsTransferred);
+
+struct SPIDRV_HandleData {
+    SPIDRV_Init_t initData;
+    bool busy;
+    SPIDRV_Callback_t userCallback;
+    int count;
+};
+
+Ecode_t SPIDRV_Init(SPIDRV_Handle_t handle, SPIDRV_Init_t *initData);
+Ecode_t SPIDRV_MTransmitB(SPIDRV_Handle_t handle, const void *buffer, int count);
+Ecode_t SPIDRV_MReceiveB(SPIDRV_Handle_t handle, void *buffer, int count);
+Ecode_t SPIDRV_MTransferB(SPIDRV_Handle_t handle, const void *txBuffer, void *rxBuffer, int count);
+Ecode_t SPIDRV_MTransmit(SPIDRV_Handle_t handle, const void *buffer, int count,
+                         SPIDRV_Callback_t callback);
+Ecode_t SPIDRV_MReceive(SPIDRV_Handle_t handle, void *buffer, int count,
+                        SPIDRV_Callback_t callback);
+Ecode_t SPIDRV_MTransfer(SPIDRV_Handle_t handle, const void *txBuffer, void *rxBuffer,
+                         int count, SPIDRV_Callback_t callback);
+
+/* ----- UARTDRV ----- */
+
+#define EMDRV_UARTDRV_MAX_CONCURRENT_RX_BUFS    6
+#define EMDRV_UARTDRV_MAX_CONCURRENT_TX_BUFS    6
+
+typedef uint32_t UARTDRV_Count_t;
+typedef struct UARTDRV_HandleData UARTDRV_HandleData_t;
+typedef UARTDRV_HandleData_t *UARTDRV_Handle_t;
+typedef void (*UARTDRV_Callback_t)(UARTDRV_Handle_t handle, Ecode_t transferStatus,
+                                   uint8_t *data, UARTDRV_Count_t transferCount);
+
+typedef struct {
+    uint8_t *data;
+    UARTDRV_Count_t transferCount;
+    UARTDRV_Count_t itemsRemaining;
+    UARTDRV_Callback_t callback;
+    Ecode_t transferStatus;
+} UARTDRV_Buffer_t;
+
+typedef struct {
+    uint16_t head;
+    uint16_t tail;
+    uint16_t used;
+    const uint16_t size;
+    UARTDRV_Buffer_t fifo[];
+} UARTDRV_Buffer_FifoQueue_t;
+
+#define DEFINE_BUF_QUEUE(qSize, qName)  \
+    typedef struct {                    \
+        uint16_t head;                  \
+        uint16_t tail;                  \
+        volatile uint16_t used;         \
+        const uint16_t size;            \
+        UARTDRV_Buffer_t fifo[qSize];   \
+    } _##qName;                         \
+    static volatile _##qName qName = { 0, 0, 0, qSize }
+
+typedef enum { uartdrvFlowControlNone, uartdrvFlowControlSw, uartdrvFlowControlHw } UARTDRV_FlowControlType_t;
+
+typedef struct {
+    USART_TypeDef *port;
+    uint32_t baudRate;
+    uint8_t portLocation;
+    USART_Stopbits_TypeDef stopBits;
+    USART_Parity_TypeDef parity;
+    USART_OVS_TypeDef oversampling;
+    bool mvdis;
+    UARTDRV_FlowControlType_t fcType;
+    GPIO_Port_TypeDef ctsPort;
+    uint8_t ctsPin;
+    GPIO_Port_TypeDef rtsPort;
+    uint8_t rtsPin;
+    UARTDRV_Buffer_FifoQueue_t *rxQueue;
+    UARTDRV_Buffer_FifoQueue_t *txQueue;
+} UARTDRV_InitUart_t;
+
+struct UARTDRV_HandleData {
+    uint32_t baudRate;
+    UARTDRV_Buffer_FifoQueue_t *rxQueue;
+    UARTDRV_Buffer_FifoQueue_t *txQueue;
+    uint64_t txFreeAt;
+};
+
+Ecode_t UARTDRV_InitUart(UARTDRV_Handle_t handle, const UARTDRV_InitUart_t *initData);
+Ecode_t UARTDRV_Transmit(UARTDRV_Handle_t handle, uint8_t *data, UARTDRV_Count_t count,
+                         UARTDRV_Callback_t callback);
+Ecode_t UARTDRV_Receive(UARTDRV_Handle_t handle, uint8_t *data, UARTDRV_Count_t count,
+                        UARTDRV_Callback_t callback);
+uint8_t UARTDRV_GetTransmitDepth(UARTDRV_Handle_t handle);
+
+/* ----- GPIOINT ----- */
+
+typedef void (*GPIOINT_IrqCallbackPtr_t)(uint8_t pin);
+
+void GPIOINT_Init(void);
+void GPIOINT_CallbackRegister(uint8_t pin, GPIOINT_IrqCallbackPtr_t callbackPtr);
+
+/* ----- Board level hooks ----- */
+
+/*******************************************************************************
+ * @struct      SIM_Bus_t
+ * @abstract    SPI slave attached to the simulated USART1
+ * @discussion  select follows the CS pin, exchange clocks one byte while CS is
+ *              low and returns the byte shifted out by the slave. Several
+ *              slaves can share the bus on different CS pins.
+ ******************************************************************************/
+typedef struct {
+    void (*select)(void *dev, bool active);
+    uint8_t (*exchange)(void *dev, uint8_t tx);
+    void *dev;
+    GPIO_Port_TypeDef csPort;
+    unsigned int csPin;
+} SIM_Bus_t;
+
+void sim_bus_attach(const SIM_Bus_t *slave);
+
+/* UART output sink, called with every completed transmit buffer */
+typedef void (*SIM_UartSink_t)(const uint8_t *data, uint32_t count);
+
+void sim_uart_sink(SIM_UartSink_t sink);
+void sim_uart_inject(const uint8_t *data, uint32_t count);
+void sim_leuart_inject(const uint8_t *data, uint32_t count);
+
+/*******************************************************************************
+ * @struct      SIM_Stats_t
+ * @abstract    Counters collected by the stand-ins for the benchmark report
+ ******************************************************************************/
+typedef struct {
+    uint64_t spiBytes;
+    uint64_t spiFrames;
+    uint64_t spiBusyErrors;
+    uint64_t spiCsConflicts;
+    uint64_t dmaDescriptors;
+    uint64_t dmaBursts;
+    uint64_t gpioIrqs;
+    uint64_t rtcFires;
+    uint64_t uartFrames;
+    uint64_t uartBytes;
+    uint64_t uartQueueFull;
+    uint64_t uartBusyUs;
+    uint64_t uartRxLost;
+    uint64_t leuartFrames;
+    uint64_t leuartBytes;
+    uint64_t leuartBusyUs;
+    uint64_t sleeps;            // EM1 and EM2, each ends in a wakeup
+    uint64_t em2Sleeps;
+    uint64_t em1Us;
+    uint64_t em2Us;
+    uint64_t flashErases;
+    uint64_t flashWords;
+} SIM_Stats_t;
+
+extern SIM_Stats_t sim_stats;
+
+#endif /* SIM_HAL */
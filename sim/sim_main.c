@@ -0,0 +1,415 @@
+/*
+ * sim_main.c
+ *
+ * Runs the firmware of src/ on the host against simulated MAX35103 devices
+ *
+ * Build from the repository root:
+ *   gcc -std=gnu99 -O2 -Isim -Isrc -o max_sim sim/sim_main.c sim/sim_hal.c sim/max35103_sim.c -lm
+ *
+ * Add -DMAX_DEVICES=n to run n sensors on the bus, one model per entry of
+ * max_devices, all measuring the same profile.
+ *
+ * Usage:
+ *   max_sim [-t seconds] [-f constant|sine|step|ramp] [-v m/s] [-a m/s] [-p s]
+ *           [-n ps] [-s slip rate] [-m miss rate] [-T degC] [-d degC/s]
+ *           [-i INT loss rate] [-c] [-b] [-o file] [-r samples/s] [-u percent]
+ *           [-e] [-w wakeups/s] [-x script] [-F image]
+ *
+ *   -c  device flash already holds the firmware profile (warm boot)
+ *   -b  start in OUT_FORMAT_BIN
+ *   -x  send host commands from script, one per line: the time in seconds
+ *       and the record in hex, e.g. "0.5 0101F4" for HOST_CMD_PERIOD 500 ms.
+ *       Records are framed with FRAME_Encode() and arrive at the line rate
+ *       of the port out_port selects when the record starts, as from a host
+ *       on one cable.
+ *   -o  write everything the firmware sends on the UART or LEUART to file
+ *   -F  load the EFM32 flash from image if it exists and save it there at
+ *       the end, so a second run starts like the board after a reset
+ *   -r  exit with status 1 if fewer samples per second were sent or any
+ *       bus error was seen, for throughput regression runs
+ *   -u  exit with status 1 if any device spent less than percent of the
+ *       time converting. A result the firmware never collects stops that
+ *       device for good, with -i this checks the timeout recovers it.
+ *   -e  exit with status 1 unless every INT of event timing was read out
+ *       exactly once, only the last one may still be pending
+ *   -w  exit with status 1 if the EFM32 woke from EM1 or EM2 more often per
+ *       second
+ *
+ * Regression runs, each exits with status 1 when it fails:
+ *   max_sim -t 10 -r 300 -u 70      conversions keep pace with the chip
+ *   max_sim -t 10 -i 0.001 -u 60    a result without INT is picked up by the
+ *                                   timeout and the device goes on
+ *   max_sim -t 120 -x evt_tof -e -w 5
+ *   max_sim -t 120 -x evt_both -e -w 5
+ *                                   one readout per sequence of EVT_MODE_TOF
+ *                                   and EVT_MODE_BOTH, no periodic wakeups between,
+ *                                   the scripts hold "0 0401" and "0 0403"
+ *   max_sim -t 2 -x profiles -u 80  a full SPI queue delays a start or readout
+ *                                   instead of losing it, the script sends
+ *                                   HOST_CMD_PROFILE 32 times 5 ms apart,
+ *                                   every register flipped each time
+ *
+ * main.c is compiled as part of this file with main() renamed, so every
+ * firmware symbol is visible to the report. Only virtual time passes during
+ * the run, the host CPU time per sample measures the firmware paths.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+// Pointers, and so DMA descriptors, are wider on the host
+#define MAX_RAM_BUDGET 12288
+#define main firmware_main
+#include "main.c"
+#undef main
+
+#include "max35103_sim.h"
+
+static MAX_Sim_t sim_max[MAX_DEVICES];
+static MAX_SimStats_t sim_max_stats;
+static FILE *sim_out;
+
+/* ----- Host commands of a -x script ----- */
+#define SIM_CMD_MAX             32
+#define SIM_CMD_BYTE_US         87      // 10 bits at 115200 baud
+#define SIM_CMD_LEUART_BYTE_US  1042    // 10 bits at 9600 baud
+
+typedef struct {
+    uint8_t frame[FRAME_LENGTH(HOST_CMD_MAX_LENGTH)];
+    uint32_t length;
+    bool leuart;
+} SIM_Cmd_t;
+
+static SIM_Cmd_t sim_cmds[SIM_CMD_MAX];
+static uint32_t sim_cmd_count;
+
+// Next byte of a command frame on the RX line
+static void sim_cmd_byte(void *arg, uint32_t param)
+{
+    SIM_Cmd_t *c = arg;
+
+    if(!param) {
+        c->leuart = out_port == OUT_PORT_LEUART;
+    }
+    if(c->leuart) {
+        sim_leuart_inject(&c->frame[param], 1);
+    }
+    else {
+        sim_uart_inject(&c->frame[param], 1);
+    }
+    if(++param < c->length) {
+        sim_schedule(c->leuart ? SIM_CMD_LEUART_BYTE_US : SIM_CMD_BYTE_US, sim_cmd_byte, c, param);
+    }
+}
+
+static bool sim_load_script(const char *name)
+{
+    uint8_t record[HOST_CMD_MAX_LENGTH + FRAME_CRC_LENGTH];
+    char line[256];
+    char hex[256];
+    double at;
+    unsigned int byte;
+    uint32_t n;
+    FILE *f = fopen(name, "r");
+
+    if(!f) {
+        perror(name);
+        return false;
+    }
+    while(fgets(line, sizeof(line), f) && sim_cmd_count < SIM_CMD_MAX) {
+        if(sscanf(line, "%lf %255s", &at, hex) != 2) {
+            continue;
+        }
+        for(n = 0; n < HOST_CMD_MAX_LENGTH && sscanf(&hex[2 * n], "%2x", &byte) == 1; n++) {
+            record[n] = byte;
+        }
+        sim_cmds[sim_cmd_count].length = FRAME_Encode(record, n, sim_cmds[sim_cmd_count].frame);
+        sim_schedule((uint64_t)(at * 1e6), sim_cmd_byte, &sim_cmds[sim_cmd_count], 0);
+        sim_cmd_count++;
+    }
+    fclose(f);
+    return true;
+}
+
+static void sim_write(const uint8_t *data, uint32_t count)
+{
+    fwrite(data, 1, count, sim_out);
+}
+
+static double sim_cpu_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static SIM_FlowShape_t sim_shape(const char *name)
+{
+    if(!strcmp(name, "sine")) {
+        return SIM_FLOW_SINE;
+    }
+    if(!strcmp(name, "step")) {
+        return SIM_FLOW_STEP;
+    }
+    if(!strcmp(name, "ramp")) {
+        return SIM_FLOW_RAMP;
+    }
+    return SIM_FLOW_CONSTANT;
+}
+
+// Sum of the model counters over all devices
+static void sim_sum_stats(void)
+{
+    MAX_SimStats_t *t = &sim_max_stats;
+    uint32_t i;
+
+    memset(t, 0, sizeof(*t));
+    for(i = 0; i < MAX_DEVICES; i++) {
+        t->tofMeasurements += sim_max[i].stats.tofMeasurements;
+        t->tempMeasurements += sim_max[i].stats.tempMeasurements;
+        t->timeouts += sim_max[i].stats.timeouts;
+        t->sequences += sim_max[i].stats.sequences;
+        t->configWrites += sim_max[i].stats.configWrites;
+        t->flashWrites += sim_max[i].stats.flashWrites;
+        t->statusReads += sim_max[i].stats.statusReads;
+        t->overruns += sim_max[i].stats.overruns;
+        t->busyCommands += sim_max[i].stats.busyCommands;
+        t->intLost += sim_max[i].stats.intLost;
+        t->evtInts += sim_max[i].stats.evtInts;
+        t->evtStatusReads += sim_max[i].stats.evtStatusReads;
+    }
+}
+
+// Whether each event timing INT of device m was read once, the last may be pending
+static bool sim_evt_read_once(const MAX_Sim_t *m)
+{
+    return m->stats.evtStatusReads + (m->reg[READ_INT_STAT_REG] ? 1 : 0) == m->stats.evtInts;
+}
+
+// Percent of the run device m spent in TOF and temperature conversions
+static double sim_chip_duty(const MAX_Sim_t *m, double seconds)
+{
+    return 100.0 * (m->stats.tofMeasurements * MAX_SIM_TOF_US +
+                    m->stats.tempMeasurements * MAX_SIM_TEMP_US) / (seconds * 1e6);
+}
+
+static void sim_report(double seconds, double cpu)
+{
+    double samples = (double)(sim_stats.uartFrames + sim_stats.leuartFrames);
+    uint64_t ticks[ENERGY_MODES];
+    uint32_t taken;
+    uint32_t i;
+
+    sim_sum_stats();
+    printf("devices               %u (%u converting at once)\n",
+           (unsigned)MAX_DEVICES, (unsigned)max_active);
+
+    printf("virtual time          %.3f s\n", seconds);
+    printf("TOF conversions       %llu (%.1f/s)\n",
+           (unsigned long long)sim_max_stats.tofMeasurements,
+           sim_max_stats.tofMeasurements / seconds);
+    printf("TEMP conversions      %llu\n", (unsigned long long)sim_max_stats.tempMeasurements);
+    printf("event sequences       %llu\n", (unsigned long long)sim_max_stats.sequences);
+    printf("event INTs            %llu (%llu status reads)\n",
+           (unsigned long long)sim_max_stats.evtInts,
+           (unsigned long long)sim_max_stats.evtStatusReads);
+    printf("timeouts (device)     %llu\n", (unsigned long long)sim_max_stats.timeouts);
+    printf("UART frames           %llu (%.1f/s)\n",
+           (unsigned long long)sim_stats.uartFrames, samples / seconds);
+    printf("UART bytes            %llu (%.1f%% line busy)\n",
+           (unsigned long long)sim_stats.uartBytes,
+           100.0 * sim_stats.uartBusyUs / (seconds * 1e6));
+    printf("UART queue full       %llu\n", (unsigned long long)sim_stats.uartQueueFull);
+    printf("LEUART frames         %llu (%llu bytes, %.1f%% line busy)\n",
+           (unsigned long long)sim_stats.leuartFrames,
+           (unsigned long long)sim_stats.leuartBytes,
+           100.0 * sim_stats.leuartBusyUs / (seconds * 1e6));
+    printf("sleeps                %llu (%.2f/s)\n", (unsigned long long)sim_stats.sleeps,
+           sim_stats.sleeps / seconds);
+    printf("EM2 sleeps            %llu\n", (unsigned long long)sim_stats.em2Sleeps);
+    printf("time in EM1/EM2       %.1f%% / %.1f%%\n",
+           100.0 * sim_stats.em1Us / (seconds * 1e6), 100.0 * sim_stats.em2Us / (seconds * 1e6));
+    taken = ENERGY_Snapshot(ticks);
+    printf("energy accounting     EM0 %.1f%% EM1 %.1f%% EM2 %.1f%%, %lu nJ per sample\n",
+           100.0 * ticks[sleepEM0] / ENERGY_TICK_HZ / seconds,
+           100.0 * ticks[sleepEM1] / ENERGY_TICK_HZ / seconds,
+           100.0 * ticks[sleepEM2] / ENERGY_TICK_HZ / seconds,
+           (unsigned long)ENERGY_PerSample(ticks, taken));
+    printf("samples dropped       %lu\n", (unsigned long)sample_queue.dropped);
+    printf("TX frames refused     %lu\n", (unsigned long)uart_tx_ring.dropped);
+    printf("host commands dropped %lu\n", (unsigned long)host_cmd.dropped);
+    printf("SPI queue full        %lu\n", (unsigned long)spi_queue.dropped);
+    printf("UART RX bytes in EM2  %llu lost\n", (unsigned long long)sim_stats.uartRxLost);
+    printf("SPI bytes             %llu (%.1f per frame)\n",
+           (unsigned long long)sim_stats.spiBytes,
+           samples ? sim_stats.spiBytes / samples : 0.0);
+    printf("SPI CS frames         %llu\n", (unsigned long long)sim_stats.spiFrames);
+    printf("DMA bursts            %llu (%llu descriptors)\n",
+           (unsigned long long)sim_stats.dmaBursts,
+           (unsigned long long)sim_stats.dmaDescriptors);
+    printf("GPIO interrupts       %llu\n", (unsigned long long)sim_stats.gpioIrqs);
+    printf("RTC timer fires       %llu\n", (unsigned long long)sim_stats.rtcFires);
+    printf("config writes         %llu\n", (unsigned long long)sim_max_stats.configWrites);
+    printf("flash writes          %llu\n", (unsigned long long)sim_max_stats.flashWrites);
+    printf("EFM32 flash           %llu page erases, %llu words written\n",
+           (unsigned long long)sim_stats.flashErases, (unsigned long long)sim_stats.flashWords);
+    printf("status reads          %llu\n", (unsigned long long)sim_max_stats.statusReads);
+    printf("INT overruns          %llu\n", (unsigned long long)sim_max_stats.overruns);
+    printf("INT edges lost        %llu\n", (unsigned long long)sim_max_stats.intLost);
+    printf("commands while busy   %llu\n", (unsigned long long)sim_max_stats.busyCommands);
+    for(i = 0; i < MAX_DEVICES; i++) {
+        printf("device %u TOF          %llu (%.1f%% converting)\n", (unsigned)i,
+               (unsigned long long)sim_max[i].stats.tofMeasurements,
+               sim_chip_duty(&sim_max[i], seconds));
+    }
+    printf("SPI busy errors       %llu\n", (unsigned long long)sim_stats.spiBusyErrors);
+    printf("SPI CS conflicts      %llu\n", (unsigned long long)sim_stats.spiCsConflicts);
+    printf("host CPU              %.3f s (%.2f us per frame)\n",
+           cpu, samples ? cpu * 1e6 / samples : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+    SIM_Profile_t profile = {
+        SIM_FLOW_CONSTANT,  // shape
+        1.0,                // velocity
+        0.5,                // amplitude
+        10.0,               // period
+        50.0,               // noisePs
+        0.0,                // slipRate
+        0.0,                // missRate
+        20.0,               // tempC
+        0.0,                // tempSlope
+        0.0                 // intLossRate
+    };
+    double seconds = 10.0;
+    double minRate = 0;
+    double minDuty = 0;
+    double maxWakeups = 0;
+    bool evtCheck = false;
+    bool warm = false;
+    const char *image = NULL;
+    FILE *f;
+    uint64_t end;
+    double cpu;
+    double rate;
+    uint32_t i;
+    uint32_t j;
+    int opt;
+
+    sim_out = NULL;
+
+    while((opt = getopt(argc, argv, "t:f:v:a:p:n:s:m:T:d:i:cbo:r:u:ew:x:F:")) != -1) {
+        switch(opt) {
+        case 't': seconds = atof(optarg); break;
+        case 'f': profile.shape = sim_shape(optarg); break;
+        case 'v': profile.velocity = atof(optarg); break;
+        case 'a': profile.amplitude = atof(optarg); break;
+        case 'p': profile.period = atof(optarg); break;
+        case 'n': profile.noisePs = atof(optarg); break;
+        case 's': profile.slipRate = atof(optarg); break;
+        case 'm': profile.missRate = atof(optarg); break;
+        case 'T': profile.tempC = atof(optarg); break;
+        case 'd': profile.tempSlope = atof(optarg); break;
+        case 'i': profile.intLossRate = atof(optarg); break;
+        case 'c': warm = true; break;
+        case 'b': out_format = OUT_FORMAT_BIN; break;
+        case 'o':
+            sim_out = fopen(optarg, "wb");
+            if(!sim_out) {
+                perror(optarg);
+                return 2;
+            }
+            break;
+        case 'r': minRate = atof(optarg); break;
+        case 'u': minDuty = atof(optarg); break;
+        case 'e': evtCheck = true; break;
+        case 'w': maxWakeups = atof(optarg); break;
+        case 'F': image = optarg; break;
+        case 'x':
+            if(!sim_load_script(optarg)) {
+                return 2;
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t s] [-f shape] [-v m/s] [-a m/s] [-p s] [-n ps] "
+                            "[-s rate] [-m rate] [-T degC] [-d degC/s] [-i rate] [-c] [-b] [-o file] "
+                            "[-r rate] [-u percent] [-e] [-w rate] [-x script] [-F image]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    for(j = 0; j < MAX_DEVICES; j++) {
+        max_sim_init(&sim_max[j], &profile, max_devices[j].csPort, max_devices[j].csPin,
+                     max_devices[j].intPort, max_devices[j].intPin);
+        if(warm) {
+            for(i = 0; i < MAX_CFG_REGS; i++) {
+                sim_max[j].flash[max_config_read_opcodes[i]] = max_profile.word[i];
+            }
+        }
+    }
+    if(sim_out) {
+        sim_uart_sink(sim_write);
+    }
+
+    memset(sim_flash, 0xFF, sizeof(sim_flash));
+    f = image ? fopen(image, "rb") : NULL;
+    if(f) {
+        if(fread(sim_flash, 1, sizeof(sim_flash), f) != sizeof(sim_flash)) {
+            fprintf(stderr, "%s: short flash image\n", image);
+            return 2;
+        }
+        fclose(f);
+    }
+
+    cpu = sim_cpu_seconds();
+
+    end = (uint64_t)(seconds * 1e6);
+    sim_end_us = end;
+    if(!setjmp(sim_exit)) {
+        firmware_main();
+    }
+    sim_sleep_end();
+
+    cpu = sim_cpu_seconds() - cpu;
+    sim_report(seconds, cpu);
+
+    if(sim_out) {
+        fclose(sim_out);
+    }
+    f = image ? fopen(image, "wb") : NULL;
+    if(f) {
+        fwrite(sim_flash, 1, sizeof(sim_flash), f);
+        fclose(f);
+    }
+
+    rate = (sim_stats.uartFrames + sim_stats.leuartFrames) / seconds;
+    if(minRate && (rate < minRate || sim_stats.spiBusyErrors || sim_stats.spiCsConflicts)) {
+        printf("FAIL: %.1f frames/s, expected at least %.1f\n", rate, minRate);
+        return 1;
+    }
+    for(j = 0; j < MAX_DEVICES; j++) {
+        if(sim_chip_duty(&sim_max[j], seconds) < minDuty) {
+            printf("FAIL: device %lu %.1f%% converting, expected at least %.1f%%\n",
+                   (unsigned long)j, sim_chip_duty(&sim_max[j], seconds), minDuty);
+            return 1;
+        }
+        if(evtCheck && !sim_evt_read_once(&sim_max[j])) {
+            printf("FAIL: device %lu %llu event INTs, %llu status reads\n", (unsigned long)j,
+                   (unsigned long long)sim_max[j].stats.evtInts,
+                   (unsigned long long)sim_max[j].stats.evtStatusReads);
+            return 1;
+        }
+    }
+    if(maxWakeups && sim_stats.sleeps / seconds > maxWakeups) {
+        printf("FAIL: %.2f wakeups/s, expected at most %.2f\n",
+               sim_stats.sleeps / seconds, maxWakeups);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * test_filter.c
+ *
+ * Checks the sliding median of filter.h against sorting the window
+ *
+ * Build and run from the repository root:
+ *   gcc -std=gnu99 -O2 -Isim -Isrc -o test_filter sim/test_filter.c && ./test_filter
+ *
+ * Every window from 1 to FILTER_WINDOW_MAX is fed values with many repeats,
+ * runs and the int32 extremes. While the window fills and once it slides,
+ * each output must equal the median of a sorted copy of the last values,
+ * the mean of the middle two rounded down for an even count.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filter.h"
+
+static uint32_t test_failures;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if(!(cond)) {                                                            \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                    \
+            test_failures++;                                                     \
+        }                                                                        \
+    } while(0)
+
+#define TEST_VALUES             4000
+
+static int32_t test_history[TEST_VALUES];
+static uint32_t test_rng = 0x2545F491;
+
+static uint32_t test_random(void)
+{
+    test_rng ^= test_rng << 13;
+    test_rng ^= test_rng >> 17;
+    test_rng ^= test_rng << 5;
+    return test_rng;
+}
+
+// Mostly wide values, some from a narrow range and repeats so ties are common
+static int32_t test_value(uint32_t i)
+{
+    uint32_t r = test_random();
+
+    switch(r % 16) {
+    case 0:
+        return INT32_MIN;
+    case 1:
+        return INT32_MAX;
+    case 2:
+    case 3:
+    case 4:
+        return i ? test_history[i - 1] : 0;
+    case 5:
+    case 6:
+    case 7:
+        return (int32_t)(test_random() % 8) - 4;
+    default:
+        return (int32_t)test_random();
+    }
+}
+
+static int test_compare(const void *a, const void *b)
+{
+    int32_t x = *(const int32_t *)a;
+    int32_t y = *(const int32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Median of the last n values up to history[i], by sorting them
+static int32_t test_brute_median(uint32_t i, uint32_t n)
+{
+    int32_t w[FILTER_WINDOW_MAX];
+    uint32_t k;
+
+    for(k = 0; k < n; k++) {
+        w[k] = test_history[i - k];
+    }
+    qsort(w, n, sizeof(w[0]), test_compare);
+    if(n & 1) {
+        return w[n / 2];
+    }
+    return (int32_t)(((int64_t)w[n / 2 - 1] + w[n / 2]) >> 1);
+}
+
+static void test_median(uint8_t window)
+{
+    static FILTER_t f;
+    uint32_t mismatches = 0;
+    uint32_t n;
+    uint32_t i;
+
+    memset(&f, 0xA5, sizeof(f));
+    CHECK(FILTER_Configure(&f, FILTER_MEDIAN, window));
+
+    for(i = 0; i < TEST_VALUES; i++) {
+        test_history[i] = test_value(i);
+        n = i + 1 < window ? i + 1 : window;
+        if(FILTER_Add(&f, test_history[i]) != test_brute_median(i, n)) {
+            mismatches++;
+        }
+        // The heaps split the window, lo holds the median on top
+        if(f.lo.size + f.hi.size != n || f.lo.size < f.hi.size || f.lo.size > f.hi.size + 1) {
+            mismatches++;
+        }
+    }
+    if(mismatches) {
+        printf("window %u: %lu mismatches\n", (unsigned)window, (unsigned long)mismatches);
+    }
+    CHECK(!mismatches);
+}
+
+// Configuring again starts the window over
+static void test_restart(void)
+{
+    static FILTER_t f;
+
+    CHECK(FILTER_Configure(&f, FILTER_MEDIAN, 3));
+    FILTER_Add(&f, 100);
+    FILTER_Add(&f, 200);
+    FILTER_Add(&f, 300);
+    CHECK(FILTER_Configure(&f, FILTER_MEDIAN, 3));
+    CHECK(FILTER_Add(&f, -7) == -7);
+    CHECK(FILTER_Add(&f, -9) == -8);
+    CHECK(FILTER_Add(&f, 5) == -7);
+    CHECK(FILTER_Add(&f, 6) == 5);
+}
+
+static void test_configure(void)
+{
+    static FILTER_t f;
+
+    CHECK(FILTER_Configure(&f, FILTER_MEDIAN, 5));
+    CHECK(!FILTER_Configure(&f, FILTER_MEDIAN, 0));
+    CHECK(!FILTER_Configure(&f, FILTER_MEDIAN, FILTER_WINDOW_MAX + 1));
+    CHECK(f.mode == FILTER_MEDIAN && f.param == 5);
+}
+
+int main(void)
+{
+    uint8_t window;
+
+    for(window = 1; window <= FILTER_WINDOW_MAX; window++) {
+        test_median(window);
+    }
+    test_restart();
+    test_configure();
+
+    if(test_failures) {
+        printf("%lu checks failed\n", (unsigned long)test_failures);
+        return EXIT_FAILURE;
+    }
+    printf("filter ok\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,238 @@
+/*
+ * test_frame.c
+ *
+ * Checks the CRC and COBS framing of frame.h
+ *
+ * Build and run from the repository root:
+ *   gcc -std=gnu99 -O2 -Isim -Isrc -o test_frame sim/test_frame.c && ./test_frame
+ *
+ * The CRC has to give the CRC-16/CCITT-FALSE check value and agree with the
+ * bitwise definition. Frames are compared with a byte by byte COBS encoder
+ * written after Cheshire and Baker, for zero runs, blocks of 253 to 255
+ * bytes around the 0xFF code and random payloads, then decoded in a separate
+ * buffer and in place.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frame.h"
+
+static uint32_t test_failures;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if(!(cond)) {                                                            \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                    \
+            test_failures++;                                                     \
+        }                                                                        \
+    } while(0)
+
+#define TEST_PAYLOAD_MAX        1024
+
+static uint32_t test_rng = 0x2545F491;
+
+static uint32_t test_random(void)
+{
+    test_rng ^= test_rng << 13;
+    test_rng ^= test_rng >> 17;
+    test_rng ^= test_rng << 5;
+    return test_rng;
+}
+
+// CRC-16/CCITT-FALSE one bit at a time
+static uint16_t test_crc_bitwise(const uint8_t *data, uint32_t length)
+{
+    uint16_t crc = 0xFFFF;
+    uint32_t i;
+    uint32_t b;
+
+    for(i = 0; i < length; i++) {
+        crc ^= data[i] << 8;
+        for(b = 0; b < 8; b++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+// COBS of data with the delimiter appended, a block is closed by every 0x00
+// and after 254 data bytes
+static uint32_t test_cobs(const uint8_t *data, uint32_t length, uint8_t *out)
+{
+    uint32_t code = 0;
+    uint32_t n = 1;
+    uint32_t i;
+
+    for(i = 0; i < length; i++) {
+        if(data[i]) {
+            out[n++] = data[i];
+        }
+        if(!data[i] || n - code == 0xFF) {
+            out[code] = n - code;
+            code = n++;
+        }
+    }
+    out[code] = n - code;
+    out[n++] = 0;
+    return n;
+}
+
+static void test_crc(void)
+{
+    static uint8_t data[TEST_PAYLOAD_MAX];
+    uint32_t length;
+    uint32_t i;
+
+    CHECK(FRAME_Crc16((const uint8_t *)"123456789", 9) == 0x29B1);
+    CHECK(FRAME_Crc16(data, 0) == 0xFFFF);
+
+    for(length = 1; length < 64; length++) {
+        for(i = 0; i < length; i++) {
+            data[i] = test_random();
+        }
+        CHECK(FRAME_Crc16(data, length) == test_crc_bitwise(data, length));
+    }
+}
+
+// Frame payload[0:length] and compare with the reference, then decode it
+static void test_round_trip(const uint8_t *payload, uint32_t length)
+{
+    static uint8_t record[TEST_PAYLOAD_MAX + FRAME_CRC_LENGTH];
+    static uint8_t frame[FRAME_LENGTH(TEST_PAYLOAD_MAX)];
+    static uint8_t expect[FRAME_LENGTH(TEST_PAYLOAD_MAX)];
+    static uint8_t out[FRAME_LENGTH(TEST_PAYLOAD_MAX)];
+    uint16_t crc = test_crc_bitwise(payload, length);
+    uint32_t size;
+    uint32_t i;
+    bool ok;
+
+    memcpy(record, payload, length);
+    size = FRAME_Encode(record, length, frame);
+
+    // The CRC went into the spare bytes, MSB first
+    ok = record[length] == crc >> 8 && record[length + 1] == (crc & 0xFF);
+    ok = ok && size == test_cobs(record, length + FRAME_CRC_LENGTH, expect) &&
+         !memcmp(frame, expect, size) && size <= FRAME_LENGTH(length);
+    ok = ok && frame[size - 1] == FRAME_DELIMITER;
+    for(i = 0; ok && i < size - 1; i++) {
+        ok = frame[i] != FRAME_DELIMITER;
+    }
+
+    ok = ok && FRAME_Decode(frame, size - 1, out) == length && !memcmp(out, payload, length);
+    ok = ok && FRAME_Decode(frame, size - 1, frame) == length && !memcmp(frame, payload, length);
+    if(!ok) {
+        printf("length %lu: frame differs\n", (unsigned long)length);
+    }
+    CHECK(ok);
+}
+
+static void test_zero_runs(void)
+{
+    static uint8_t payload[TEST_PAYLOAD_MAX];
+    uint32_t length;
+    uint32_t i;
+
+    memset(payload, 0, sizeof(payload));
+    for(length = 1; length < 600; length++) {
+        test_round_trip(payload, length);
+    }
+
+    // Zeros between and around non-zero bytes
+    for(i = 0; i < 32; i++) {
+        payload[i] = i % 3 == 1 ? 0x5A : 0;
+    }
+    test_round_trip(payload, 32);
+}
+
+// Zero free runs of 253 to 255 bytes, alone and with a 0x00 either side
+static void test_long_blocks(void)
+{
+    static uint8_t payload[TEST_PAYLOAD_MAX];
+    uint32_t run;
+    uint32_t length;
+
+    for(run = 250; run <= 260; run++) {
+        memset(payload, 0x11, run);
+        test_round_trip(payload, run);
+
+        payload[0] = 0;
+        test_round_trip(payload, run);
+
+        memset(payload, 0x11, run);
+        payload[run] = 0;
+        test_round_trip(payload, run + 1);
+    }
+
+    // Several full blocks in a row
+    for(length = 2 * 254 - 4; length <= 2 * 254 + 4; length++) {
+        memset(payload, 0xEE, length);
+        test_round_trip(payload, length);
+    }
+}
+
+static void test_random_payloads(void)
+{
+    static uint8_t payload[TEST_PAYLOAD_MAX];
+    uint32_t trial;
+    uint32_t length;
+    uint32_t i;
+
+    for(trial = 0; trial < 2000; trial++) {
+        length = 1 + test_random() % TEST_PAYLOAD_MAX;
+        for(i = 0; i < length; i++) {
+            // Sparse zeros most of the time, dense now and then
+            payload[i] = test_random() % (trial & 1 ? 300 : 4) ? test_random() | 1 : 0;
+        }
+        test_round_trip(payload, length);
+    }
+}
+
+// Broken frames are refused, never overrun out
+static void test_malformed(void)
+{
+    uint8_t record[8 + FRAME_CRC_LENGTH] = { 1, 0, 2, 3, 0, 0, 4, 5 };
+    uint8_t frame[FRAME_LENGTH(8)];
+    uint8_t out[FRAME_LENGTH(8)];
+    uint32_t size = FRAME_Encode(record, 8, frame) - 1;
+    uint32_t i;
+
+    CHECK(FRAME_Decode(frame, size, out) == 8);
+
+    // A code pointing past the end
+    i = frame[0];
+    frame[0] = size + 1;
+    CHECK(FRAME_Decode(frame, size, out) == 0);
+    frame[0] = i;
+
+    // Any byte changed, code or data, moves or alters the data under the CRC
+    for(i = 0; i < size; i++) {
+        frame[i] ^= 0x40;
+        CHECK(FRAME_Decode(frame, size, out) == 0);
+        frame[i] ^= 0x40;
+    }
+
+    // A delimiter inside, and a frame of nothing but the CRC
+    frame[2] = FRAME_DELIMITER;
+    CHECK(FRAME_Decode(frame, size, out) == 0);
+    CHECK(FRAME_Decode(frame, 0, out) == 0);
+    size = FRAME_Encode(record, 0, frame) - 1;
+    CHECK(FRAME_Decode(frame, size, out) == 0);
+}
+
+int main(void)
+{
+    test_crc();
+    test_zero_runs();
+    test_long_blocks();
+    test_random_payloads();
+    test_malformed();
+
+    if(test_failures) {
+        printf("%lu checks failed\n", (unsigned long)test_failures);
+        return EXIT_FAILURE;
+    }
+    printf("frame ok\n");
+    return EXIT_SUCCESS;
+}
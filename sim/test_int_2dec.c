@@ -0,0 +1,134 @@
+/*
+ * test_int_2dec.c
+ *
+ * Checks uint32_2dec() and the ASCII TOF field against an exact reference
+ *
+ * Build and run from the repository root:
+ *   gcc -std=gnu99 -O2 -Isim -Isrc -o test_int_2dec sim/test_int_2dec.c sim/sim_hal.c && ./test_int_2dec
+ *
+ * main.c is compiled in with main() renamed, as in sim_main.c, so the real
+ * processTOF_ASCII() formats into a local buffer. The reference rounds
+ * |TOF_DIFF| * 250000 / 2^16 to the nearest ps in 64 bits and prints it with
+ * snprintf(), for every boundary register value and 2M random ones.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Pointers, and so DMA descriptors, are wider on the host
+#define MAX_RAM_BUDGET 12288
+#define main firmware_main
+#include "main.c"
+#undef main
+
+static uint32_t test_failures;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if(!(cond)) {                                                            \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                    \
+            test_failures++;                                                     \
+        }                                                                        \
+    } while(0)
+
+#define TEST_FIELD              23
+#define TEST_FIELD_LENGTH       12
+#define TEST_RANDOM             2000000
+
+static uint32_t test_rng = 0x2545F491;
+
+static uint32_t test_random(void)
+{
+    test_rng ^= test_rng << 13;
+    test_rng ^= test_rng >> 17;
+    test_rng ^= test_rng << 5;
+    return test_rng;
+}
+
+static void test_dec(void)
+{
+    uint8_t s[12];
+
+    CHECK(uint32_2dec(0, s, 4, ' ') == 1 && !memcmp(s, "   0", 4));
+    CHECK(uint32_2dec(7, s, 3, '0') == 1 && !memcmp(s, "007", 3));
+    CHECK(uint32_2dec(1000, s, 4, ' ') == 4 && !memcmp(s, "1000", 4));
+    CHECK(uint32_2dec(UINT32_MAX, s, 12, ' ') == 10 && !memcmp(s, "  4294967295", 12));
+    // Digits that do not fit are cut off, the low ones stay
+    CHECK(uint32_2dec(123456, s, 3, ' ') == 3 && !memcmp(s, "456", 3));
+}
+
+// Format one register value both ways, false if they differ
+static bool test_tof(int32_t tof)
+{
+    static uint8_t line[UART_TX_BUF_LENGTH];
+    char expect[TEST_FIELD_LENGTH + 1];
+    int32_t slots[MAX_SLOTS];
+    uint64_t mag = tof < 0 ? -(int64_t)tof : tof;
+    int64_t ps = (int64_t)((mag * 250000 + 32768) >> 16);
+
+    memset(line, '#', sizeof(line));
+    uart_tx_buffer = line;
+    slots[MAX_SLOT_TOF_DIFF] = tof;
+    processTOF_ASCII(slots);
+
+    snprintf(expect, sizeof(expect), "%12lld", (long long)(tof < 0 ? -ps : ps));
+    if(memcmp(&line[TEST_FIELD], expect, TEST_FIELD_LENGTH) ||
+       line[TEST_FIELD - 1] != '#' || line[TEST_FIELD + TEST_FIELD_LENGTH] != '#') {
+        printf("TOF_DIFF %ld: \"%.12s\", expected \"%s\"\n", (long)tof,
+               (const char *)&line[TEST_FIELD], expect);
+        return false;
+    }
+    return true;
+}
+
+static void test_boundaries(void)
+{
+    static const int32_t whole[] = { 0, 1, 3, 4, 39, 40, 399, 400, 32767, 32768 };
+    uint32_t mismatches = 0;
+    uint32_t i;
+    int32_t frac;
+    int32_t t;
+
+    mismatches += !test_tof(INT32_MIN);
+    mismatches += !test_tof(INT32_MIN + 1);
+    mismatches += !test_tof(INT32_MAX);
+
+    // Around every ps and ns carry of the fraction, both signs
+    for(i = 0; i < sizeof(whole) / sizeof(whole[0]); i++) {
+        for(frac = 0; frac < 0x10000; frac++) {
+            t = (int32_t)((uint32_t)whole[i] << 16 | frac);
+            if(t < 0) {
+                continue;
+            }
+            mismatches += !test_tof(t);
+            mismatches += !test_tof(-t);
+        }
+    }
+    CHECK(!mismatches);
+}
+
+static void test_random_values(void)
+{
+    uint32_t mismatches = 0;
+    uint32_t i;
+
+    for(i = 0; i < TEST_RANDOM && mismatches < 10; i++) {
+        mismatches += !test_tof((int32_t)test_random());
+    }
+    CHECK(!mismatches);
+}
+
+int main(void)
+{
+    test_dec();
+    test_boundaries();
+    test_random_values();
+
+    if(test_failures) {
+        printf("%lu checks failed\n", (unsigned long)test_failures);
+        return EXIT_FAILURE;
+    }
+    printf("int_2dec ok\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,174 @@
+/*
+ * test_max_burst.c
+ *
+ * Checks the descriptor chains MAX_Burst_Build() prepares
+ *
+ * Build and run from the repository root:
+ *   gcc -std=gnu99 -O2 -Isim -Isrc -o test_max_burst sim/test_max_burst.c sim/sim_hal.c && ./test_max_burst
+ *
+ * Every register of a burst has to be CS low, the opcode frame and CS high on
+ * the TX chain and the dropped byte followed by the data word on the RX chain,
+ * in list order. The chains are decoded from the PL230 descriptors the way the
+ * DMA controller walks them. Storage sized exactly to the list has to hold
+ * the chains and frames, the descriptors past it stay untouched. Pointed at
+ * another chip select and receive buffer, the chains must match that device.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "max_burst.h"
+
+// Lengths of the TOF and FULL register lists of meas_regs in main.c
+#define TEST_REGS_TOF           7
+#define TEST_REGS_FULL          37
+#define TEST_REGS_MAX           40
+
+#define TEST_CS_PORT            gpioPortD
+#define TEST_CS_PIN             5
+#define TEST_CS_PORT_2          gpioPortC
+#define TEST_CS_PIN_2           9
+
+static uint32_t test_failures;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if(!(cond)) {                                                            \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                    \
+            test_failures++;                                                     \
+        }                                                                        \
+    } while(0)
+
+/*******************************************************************************
+ * @struct      TEST_Transfer_t
+ * @abstract    What one alternate descriptor moves, start addresses recovered
+ *              from the end pointers
+ ******************************************************************************/
+typedef struct {
+    const uint8_t *src;
+    const uint8_t *dst;
+    uint32_t count;
+    uint32_t size;
+    bool srcInc;
+    bool dstInc;
+    uint32_t cycle;
+} TEST_Transfer_t;
+
+static TEST_Transfer_t test_decode(const DMA_DESCRIPTOR_TypeDef *d)
+{
+    TEST_Transfer_t x;
+    uint32_t srcInc = (d->CTRL >> _DMA_CTRL_SRC_INC_SHIFT) & 3;
+    uint32_t dstInc = (d->CTRL >> _DMA_CTRL_DST_INC_SHIFT) & 3;
+
+    x.count = ((d->CTRL & _DMA_CTRL_N_MINUS_1_MASK) >> _DMA_CTRL_N_MINUS_1_SHIFT) + 1;
+    x.size = 1 << ((d->CTRL >> _DMA_CTRL_SRC_SIZE_SHIFT) & 3);
+    x.srcInc = srcInc != dmaDataIncNone;
+    x.dstInc = dstInc != dmaDataIncNone;
+    x.src = (const uint8_t *)d->SRCEND - (x.srcInc ? (x.count - 1) << srcInc : 0);
+    x.dst = (const uint8_t *)d->DSTEND - (x.dstInc ? (x.count - 1) << dstInc : 0);
+    x.cycle = d->CTRL & _DMA_CTRL_CYCLE_CTRL_MASK;
+    return x;
+}
+
+// Single word written to a GPIO register, the chip select mask
+static void test_cs(const MAX_Burst_t *burst, const DMA_DESCRIPTOR_TypeDef *d,
+                    volatile uint32_t *reg)
+{
+    TEST_Transfer_t x = test_decode(d);
+
+    CHECK(x.src == (const uint8_t *)&burst->csMask);
+    CHECK(x.dst == (const uint8_t *)reg);
+    CHECK(x.count == 1 && x.size == 4 && !x.srcInc && !x.dstInc);
+    CHECK(x.cycle == DMA_CTRL_CYCLE_CTRL_PER_SCATTER_GATHER_ALT);
+}
+
+// Both chains of a built burst, aimed at rx and the CS pin given
+static void test_chains(const MAX_Burst_t *burst, const uint8_t *opcodes, const MAX_Word_t *rx,
+                        GPIO_Port_TypeDef csPort, unsigned int csPin)
+{
+    TEST_Transfer_t x;
+    uint32_t i;
+
+    CHECK(burst->rx == rx);
+    CHECK(burst->csMask == 1u << csPin);
+
+    for(i = 0; i < burst->count; i++) {
+        test_cs(burst, &burst->txDescr[i * MAX_BURST_DESCR_PER_REG], &GPIO->P[csPort].DOUTCLR);
+
+        x = test_decode(&burst->txDescr[i * MAX_BURST_DESCR_PER_REG + 1]);
+        CHECK(x.src == burst->txFrame[i]);
+        CHECK(x.dst == (const uint8_t *)&USART1->TXDATA);
+        CHECK(x.count == MAX_BURST_FRAME_LENGTH && x.size == 1 && x.srcInc && !x.dstInc);
+        CHECK(x.cycle == DMA_CTRL_CYCLE_CTRL_PER_SCATTER_GATHER_ALT);
+        CHECK(burst->txFrame[i][0] == opcodes[i]);
+        CHECK(burst->txFrame[i][1] == 0 && burst->txFrame[i][2] == 0);
+
+        test_cs(burst, &burst->txDescr[i * MAX_BURST_DESCR_PER_REG + 2], &GPIO->P[csPort].DOUTSET);
+
+        x = test_decode(&burst->rxDescr[i * MAX_BURST_RX_DESCR_PER_REG]);
+        CHECK(x.src == (const uint8_t *)&USART1->RXDATA);
+        CHECK(x.dst == &max_burst_engine.sink);
+        CHECK(x.count == 1 && x.size == 1 && !x.srcInc && !x.dstInc);
+        CHECK(x.cycle == DMA_CTRL_CYCLE_CTRL_PER_SCATTER_GATHER_ALT);
+
+        x = test_decode(&burst->rxDescr[i * MAX_BURST_RX_DESCR_PER_REG + 1]);
+        CHECK(x.src == (const uint8_t *)&USART1->RXDATA);
+        CHECK(x.dst == (const uint8_t *)&rx[i]);
+        CHECK(x.count == sizeof(MAX_Word_t) && x.size == 1 && !x.srcInc && x.dstInc);
+        CHECK(x.cycle == DMA_CTRL_CYCLE_CTRL_PER_SCATTER_GATHER_ALT);
+    }
+}
+
+static void test_burst(uint32_t count)
+{
+    static DMA_DESCRIPTOR_TypeDef storage[MAX_BURST_STORAGE_LENGTH(TEST_REGS_MAX) + 1];
+    static DMA_DESCRIPTOR_TypeDef untouched[MAX_BURST_STORAGE_LENGTH(TEST_REGS_MAX) + 1];
+    static MAX_Burst_t burst;
+    uint32_t length = MAX_BURST_STORAGE_LENGTH(count);
+    MAX_Word_t rx[TEST_REGS_MAX];
+    MAX_Word_t rx2[TEST_REGS_MAX];
+    uint8_t opcodes[TEST_REGS_MAX];
+    uint32_t i;
+
+    for(i = 0; i < count; i++) {
+        opcodes[i] = 0xB0 + i;
+    }
+    memset(&burst, 0xA5, sizeof(burst));
+    memset(storage, 0xA5, sizeof(storage));
+    memset(untouched, 0xA5, sizeof(untouched));
+    MAX_Burst_Build(&burst, storage, length, opcodes, count, rx, TEST_CS_PORT, TEST_CS_PIN);
+
+    CHECK(burst.txDescr == storage);
+    CHECK(burst.rxDescr == &burst.txDescr[count * MAX_BURST_DESCR_PER_REG]);
+    CHECK((const uint8_t *)burst.txFrame == (const uint8_t *)&burst.rxDescr[count * MAX_BURST_RX_DESCR_PER_REG]);
+    CHECK((const uint8_t *)&burst.txFrame[count] <= (const uint8_t *)&storage[length]);
+    CHECK(burst.count == count);
+    test_chains(&burst, opcodes, rx, TEST_CS_PORT, TEST_CS_PIN);
+
+    // Another device, only CS, then only rx, then back
+    MAX_Burst_Target(&burst, rx, TEST_CS_PORT_2, TEST_CS_PIN_2);
+    test_chains(&burst, opcodes, rx, TEST_CS_PORT_2, TEST_CS_PIN_2);
+    MAX_Burst_Target(&burst, rx2, TEST_CS_PORT_2, TEST_CS_PIN_2);
+    test_chains(&burst, opcodes, rx2, TEST_CS_PORT_2, TEST_CS_PIN_2);
+    MAX_Burst_Target(&burst, rx, TEST_CS_PORT, TEST_CS_PIN);
+    test_chains(&burst, opcodes, rx, TEST_CS_PORT, TEST_CS_PIN);
+
+    CHECK(!memcmp(&storage[length], &untouched[length], sizeof(storage) - length * sizeof(storage[0])));
+}
+
+int main(void)
+{
+    MAX_Burst_Init(USART1, DMAREQ_USART1_TXEMPTY, DMAREQ_USART1_RXDATAV);
+
+    test_burst(TEST_REGS_TOF);
+    test_burst(TEST_REGS_FULL);
+    test_burst(1);
+    test_burst(TEST_REGS_MAX);
+
+    if(test_failures) {
+        printf("%lu checks failed\n", (unsigned long)test_failures);
+        return EXIT_FAILURE;
+    }
+    printf("max_burst ok\n");
+    return EXIT_SUCCESS;
+}
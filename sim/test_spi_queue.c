@@ -0,0 +1,367 @@
+/*
+ * test_spi_queue.c
+ *
+ * Checks the ordering and completion rules of the SPI transaction queue
+ *
+ * Build and run from the repository root:
+ *   gcc -std=gnu99 -O2 -Isim -Isrc -o test_spi_queue sim/test_spi_queue.c && ./test_spi_queue
+ *
+ * SPIDRV, the burst DMA and GPIO are faked here instead of linking sim_hal.c,
+ * so every transfer stays on the bus until the test completes it. The queue
+ * must start transactions in submit order, release a slot before its done()
+ * runs, refuse and count the one past SPIQ_DEPTH - 1, call back whoever found
+ * it full once a slot is free and run bursts in line with plain commands.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "spi_queue.h"
+
+static uint32_t test_failures;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if(!(cond)) {                                                            \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                    \
+            test_failures++;                                                     \
+        }                                                                        \
+    } while(0)
+
+#define TEST_CS_PORT            gpioPortD
+#define TEST_CS_PIN             3
+#define TEST_LOG_MAX            64
+
+/* ----- Fakes ----- */
+
+GPIO_TypeDef sim_gpio;
+USART_TypeDef sim_usart1;
+
+/*******************************************************************************
+ * @var test_bus
+ * @abstract What the fakes saw
+ * @discussion started lists the first tx byte of every transfer put on the
+ *             bus, 0 for a burst. done lists the user values of the callbacks.
+ *             spiDone or burst is the transfer on the bus, the test completes
+ *             it with test_finish().
+ ******************************************************************************/
+struct {
+    uint8_t started[TEST_LOG_MAX];
+    uint32_t startCount;
+    uintptr_t done[TEST_LOG_MAX];
+    uint32_t doneCount;
+    SPIDRV_Callback_t spiDone;
+    bool burst;
+    bool csLowAtStart;
+    int em2Blocks;
+} test_bus;
+
+void GPIO_PinOutSet(GPIO_Port_TypeDef port, unsigned int pin)
+{
+    sim_gpio.P[port].DOUT |= 1 << pin;
+}
+
+void GPIO_PinOutClear(GPIO_Port_TypeDef port, unsigned int pin)
+{
+    sim_gpio.P[port].DOUT &= ~(1 << pin);
+}
+
+static bool test_cs_low(void)
+{
+    return !(sim_gpio.P[TEST_CS_PORT].DOUT & (1 << TEST_CS_PIN));
+}
+
+void SLEEP_SleepBlockBegin(SLEEP_EnergyMode_t mode)
+{
+    if(mode == sleepEM2) {
+        test_bus.em2Blocks++;
+    }
+}
+
+void SLEEP_SleepBlockEnd(SLEEP_EnergyMode_t mode)
+{
+    if(mode == sleepEM2) {
+        test_bus.em2Blocks--;
+    }
+}
+
+static Ecode_t test_spi_start(const void *tx, SPIDRV_Callback_t callback)
+{
+    CHECK(!test_bus.spiDone && !test_bus.burst);
+    test_bus.started[test_bus.startCount++] = *(const uint8_t *)tx;
+    test_bus.csLowAtStart = test_cs_low();
+    test_bus.spiDone = callback;
+    return ECODE_OK;
+}
+
+Ecode_t SPIDRV_MTransmit(SPIDRV_Handle_t handle, const void *buffer, int count,
+                         SPIDRV_Callback_t callback)
+{
+    (void)handle;
+    (void)count;
+    return test_spi_start(buffer, callback);
+}
+
+Ecode_t SPIDRV_MTransfer(SPIDRV_Handle_t handle, const void *txBuffer, void *rxBuffer,
+                         int count, SPIDRV_Callback_t callback)
+{
+    (void)handle;
+    (void)rxBuffer;
+    (void)count;
+    return test_spi_start(txBuffer, callback);
+}
+
+Ecode_t DMADRV_AllocateChannel(unsigned int *channelId, void *capabilities)
+{
+    static unsigned int next;
+
+    (void)capabilities;
+    *channelId = next++;
+    return ECODE_OK;
+}
+
+void DMA_CfgChannel(unsigned int channel, DMA_CfgChannel_TypeDef *cfg)
+{
+    (void)channel;
+    (void)cfg;
+}
+
+void DMA_CfgDescrScatterGather(DMA_DESCRIPTOR_TypeDef *descr, unsigned int indx,
+                               DMA_CfgDescrSGAlt_TypeDef *cfg)
+{
+    (void)descr;
+    (void)indx;
+    (void)cfg;
+}
+
+// Both burst channels are started together, the TX one second
+void DMA_ActivateScatterGather(unsigned int channel, bool useBurst,
+                               DMA_DESCRIPTOR_TypeDef *altDescr, unsigned int count)
+{
+    (void)useBurst;
+    (void)altDescr;
+    (void)count;
+
+    if(channel == max_burst_engine.txChannel) {
+        CHECK(!test_bus.spiDone && !test_bus.burst);
+        test_bus.started[test_bus.startCount++] = 0;
+        test_bus.burst = true;
+    }
+}
+
+/* ----- Helpers ----- */
+
+// Complete the transfer on the bus like its interrupt would
+static void test_finish(void)
+{
+    SPIDRV_Callback_t done = test_bus.spiDone;
+
+    if(test_bus.burst) {
+        test_bus.burst = false;
+        MAX_Burst_DMADone(max_burst_engine.rxChannel, false, NULL);
+        MAX_Burst_DMADone(max_burst_engine.txChannel, false, NULL);
+        return;
+    }
+    CHECK(done != NULL);
+    if(done) {
+        test_bus.spiDone = NULL;
+        done(spi_queue.handle, ECODE_OK, SPIQ_TX_LENGTH);
+    }
+}
+
+static void test_drain(void)
+{
+    uint32_t guard = 0;
+
+    while(!SPIQ_Idle() && guard++ < TEST_LOG_MAX) {
+        test_finish();
+    }
+    CHECK(SPIQ_Idle());
+}
+
+static void test_reset(void)
+{
+    memset(&test_bus, 0, sizeof(test_bus));
+    sim_gpio.P[TEST_CS_PORT].DOUT = 1 << TEST_CS_PIN;
+    SPIQ_Init(NULL);
+}
+
+static uint8_t test_follow;
+
+// Records the call, checks the slot is already released
+static void test_done(void *user)
+{
+    uintptr_t id = (uintptr_t)user;
+    SPIQ_Transaction_t t;
+
+    test_bus.done[test_bus.doneCount++] = id;
+    CHECK(spi_queue.queue[(spi_queue.head - 1) & (SPIQ_DEPTH - 1)].user == user);
+    CHECK(!test_cs_low() || test_bus.burst);
+
+    // The first callback queues a follow-up, it has to go behind the rest
+    if(test_follow) {
+        memset(&t, 0, sizeof(t));
+        t.tx[0] = test_follow;
+        t.count = 1;
+        t.csPort = TEST_CS_PORT;
+        t.csPin = TEST_CS_PIN;
+        t.done = test_done;
+        t.user = (void *)(uintptr_t)test_follow;
+        test_follow = 0;
+        CHECK(SPIQ_Submit(&t));
+    }
+}
+
+static bool test_submit(uint8_t opcode, MAX_Burst_t *burst)
+{
+    SPIQ_Transaction_t t;
+
+    memset(&t, 0, sizeof(t));
+    t.tx[0] = opcode;
+    t.count = SPIQ_TX_LENGTH;
+    t.burst = burst;
+    t.csPort = TEST_CS_PORT;
+    t.csPin = TEST_CS_PIN;
+    t.done = test_done;
+    t.user = (void *)(uintptr_t)opcode;
+    return SPIQ_Submit(&t);
+}
+
+/* ----- Tests ----- */
+
+static void test_fifo(void)
+{
+    uint8_t i;
+
+    test_reset();
+    CHECK(SPIQ_Idle());
+    CHECK(test_submit(0x10, NULL));
+    CHECK(test_bus.startCount == 1 && test_bus.started[0] == 0x10);
+    CHECK(test_bus.csLowAtStart);
+    CHECK(test_bus.em2Blocks == 1);
+    CHECK(test_submit(0x11, NULL));
+    CHECK(test_submit(0x12, NULL));
+    CHECK(test_bus.startCount == 1);
+
+    test_follow = 0x13;
+    test_drain();
+    CHECK(test_bus.startCount == 4 && test_bus.doneCount == 4);
+    for(i = 0; i < 4; i++) {
+        CHECK(test_bus.started[i] == 0x10 + i);
+        CHECK(test_bus.done[i] == 0x10u + i);
+    }
+    CHECK(!test_cs_low());
+    CHECK(test_bus.em2Blocks == 0);
+}
+
+static void test_full(void)
+{
+    uint8_t i;
+
+    test_reset();
+    for(i = 0; i < SPIQ_DEPTH - 1; i++) {
+        CHECK(test_submit(0x20 + i, NULL));
+    }
+    CHECK(!test_submit(0x2F, NULL));
+    CHECK(test_bus.startCount == 1);
+    CHECK(spi_queue.dropped == 1);
+
+    // One completion frees exactly one slot
+    test_finish();
+    CHECK(test_submit(0x20 + SPIQ_DEPTH - 1, NULL));
+    CHECK(!test_submit(0x2F, NULL));
+    CHECK(spi_queue.dropped == 2);
+
+    test_drain();
+    CHECK(test_bus.startCount == SPIQ_DEPTH && test_bus.doneCount == SPIQ_DEPTH);
+    for(i = 0; i < SPIQ_DEPTH; i++) {
+        CHECK(test_bus.started[i] == 0x20 + i);
+    }
+    CHECK(test_bus.em2Blocks == 0);
+}
+
+static uint32_t test_space_calls;
+
+// Retries what was refused, the slot must be free by now
+static void test_space(void *user)
+{
+    test_space_calls++;
+    CHECK(user == &test_space_calls);
+    CHECK(test_submit(0x4F, NULL));
+}
+
+static void test_on_space(void)
+{
+    uint8_t i;
+
+    test_reset();
+    for(i = 0; i < SPIQ_DEPTH - 1; i++) {
+        CHECK(test_submit(0x40 + i, NULL));
+    }
+    CHECK(!test_submit(0x4F, NULL));
+    SPIQ_OnSpace(test_space, &test_space_calls);
+    CHECK(test_space_calls == 0);
+
+    // Runs once, after the done() of the completion that freed the slot
+    test_finish();
+    CHECK(test_space_calls == 1 && test_bus.doneCount == 1);
+    test_finish();
+    CHECK(test_space_calls == 1);
+
+    test_drain();
+    CHECK(test_bus.startCount == SPIQ_DEPTH && test_bus.started[SPIQ_DEPTH - 1] == 0x4F);
+    CHECK(spi_queue.dropped == 1);
+
+    // Drained in the meantime, called right away
+    SPIQ_OnSpace(test_space, &test_space_calls);
+    CHECK(test_space_calls == 2 && test_bus.startCount == SPIQ_DEPTH + 1);
+    test_drain();
+    CHECK(test_bus.em2Blocks == 0);
+}
+
+static void test_burst_between(void)
+{
+    static DMA_DESCRIPTOR_TypeDef storage[MAX_BURST_STORAGE_LENGTH(1)];
+    static MAX_Burst_t burst;
+    MAX_Word_t rx[1];
+    uint8_t opcode = 0x90;
+
+    MAX_Burst_Build(&burst, storage, MAX_BURST_STORAGE_LENGTH(1), &opcode, 1, rx,
+                    TEST_CS_PORT, TEST_CS_PIN);
+
+    test_reset();
+    CHECK(test_submit(0x30, NULL));
+    CHECK(test_submit(0x31, &burst));
+    CHECK(test_submit(0x32, NULL));
+
+    test_finish();
+    CHECK(test_bus.burst && test_bus.startCount == 2 && test_bus.started[1] == 0);
+    // The burst drives CS from its descriptors, the queue leaves it alone
+    CHECK(!test_cs_low());
+    CHECK(test_bus.doneCount == 1);
+
+    test_finish();
+    CHECK(!MAX_Burst_Busy());
+    CHECK(test_bus.doneCount == 2 && test_bus.done[1] == 0x31);
+    CHECK(test_bus.startCount == 3 && test_bus.started[2] == 0x32 && test_bus.csLowAtStart);
+
+    test_drain();
+    CHECK(test_bus.doneCount == 3 && test_bus.done[2] == 0x32);
+    CHECK(test_bus.em2Blocks == 0);
+}
+
+int main(void)
+{
+    MAX_Burst_Init(USART1, DMAREQ_USART1_TXEMPTY, DMAREQ_USART1_RXDATAV);
+
+    test_fifo();
+    test_full();
+    test_on_space();
+    test_burst_between();
+
+    if(test_failures) {
+        printf("%lu checks failed\n", (unsigned long)test_failures);
+        return EXIT_FAILURE;
+    }
+    printf("spi_queue ok\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,182 @@
+/*
+ * test_total.c
+ *
+ * Checks the flash checkpoints of total.h across torn records and page turns
+ *
+ * Build and run from the repository root:
+ *   gcc -std=gnu99 -O2 -Isim -Isrc -o test_total sim/test_total.c sim/sim_hal.c && ./test_total
+ *
+ * The checkpoint pages live in the flash model of sim_hal.c. A reset during
+ * TOTAL_Save() is played by erasing word 0 and the data words not yet
+ * written again after the record went in, the flash never goes from 0 to 1
+ * otherwise. Every reload must restore the newest complete record.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "total.h"
+
+static uint32_t test_failures;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if(!(cond)) {                                                            \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                    \
+            test_failures++;                                                     \
+        }                                                                        \
+    } while(0)
+
+#define TEST_METERS             2
+
+static TOTAL_Acc_t test_acc[TEST_METERS];
+
+// Records per page for TEST_METERS, as TOTAL_Load() sizes them
+static uint32_t test_per_page(void)
+{
+    return FLASH_PAGE_SIZE / (4 * (2 + 4 * TEST_METERS));
+}
+
+// Distinct totals for save number k, both halves of each word in use
+static void test_fill(uint32_t k)
+{
+    uint32_t i;
+
+    for(i = 0; i < TEST_METERS; i++) {
+        test_acc[i].forward = (uint64_t)(k + 1) << 32 | (k * 1000 + i);
+        test_acc[i].reverse = (uint64_t)(k + 7) << 33 | (k * 3 + i);
+    }
+}
+
+// Load into fresh totalizers and compare with save number k
+static bool test_reload(uint32_t k)
+{
+    TOTAL_Acc_t acc[TEST_METERS];
+    bool found;
+    bool match = true;
+    uint32_t i;
+
+    memset(acc, 0x5A, sizeof(acc));
+    found = TOTAL_Load(acc, TEST_METERS);
+    test_fill(k);
+    for(i = 0; i < TEST_METERS; i++) {
+        match = match && acc[i].forward == test_acc[i].forward &&
+                acc[i].reverse == test_acc[i].reverse && !acc[i].running;
+    }
+    return found && match;
+}
+
+// Undo the last words of a record as if the reset came before them
+static void test_tear(uint32_t slot, uint32_t dataWords)
+{
+    uint32_t *p = TOTAL_Slot(slot);
+
+    memset(&p[1 + dataWords], 0xFF, total_store.size - 4 * (1 + dataWords));
+    p[0] = TOTAL_ERASED;
+}
+
+static void test_erase_all(void)
+{
+    memset((void *)TOTAL_BASE, 0xFF, TOTAL_PAGES * FLASH_PAGE_SIZE);
+}
+
+static void test_empty(void)
+{
+    TOTAL_Acc_t acc[TEST_METERS];
+
+    test_erase_all();
+    memset(acc, 0x5A, sizeof(acc));
+    CHECK(!TOTAL_Load(acc, TEST_METERS));
+    CHECK(acc[0].forward == 0 && acc[1].reverse == 0);
+    CHECK(total_store.slot == 0 && total_store.seq == 0);
+}
+
+static void test_torn(void)
+{
+    uint32_t torn;
+
+    test_erase_all();
+    TOTAL_Load(test_acc, TEST_METERS);
+    test_fill(1);
+    CHECK(TOTAL_Save(test_acc, TEST_METERS));
+    test_fill(2);
+    CHECK(TOTAL_Save(test_acc, TEST_METERS));
+    CHECK(test_reload(2));
+
+    // Reset after the seq and half the data words, before word 0
+    torn = total_store.slot;
+    test_fill(3);
+    CHECK(TOTAL_Save(test_acc, TEST_METERS));
+    test_tear(torn, 1 + 2 * TEST_METERS);
+    CHECK(test_reload(2));
+    CHECK(total_store.slot == torn);
+    CHECK(!TOTAL_Erased(TOTAL_Slot(torn)));
+
+    // The next save leaves the programmed slot alone
+    test_fill(4);
+    CHECK(TOTAL_Save(test_acc, TEST_METERS));
+    CHECK(TOTAL_Slot(torn)[0] == TOTAL_ERASED);
+    CHECK(TOTAL_Slot(torn + 1)[0] >> 16 == TOTAL_MAGIC);
+    CHECK(test_reload(4));
+    CHECK(total_store.slot == torn + 2);
+}
+
+static void test_rollover(void)
+{
+    uint32_t perPage = test_per_page();
+    uint64_t erases;
+    uint32_t slot;
+    uint32_t k;
+
+    test_erase_all();
+    TOTAL_Load(test_acc, TEST_METERS);
+    CHECK(total_store.slots == TOTAL_PAGES * perPage);
+
+    // Twice around both pages, each opened page is erased exactly once
+    erases = sim_stats.flashErases;
+    for(k = 1; k <= 2 * total_store.slots + 1; k++) {
+        slot = total_store.slot;
+        test_fill(k);
+        CHECK(TOTAL_Save(test_acc, TEST_METERS));
+        CHECK(slot == (k - 1) % total_store.slots);
+        CHECK(sim_stats.flashErases - erases == (k - 1) / perPage + 1);
+        // The other page still holds the previous records right after a turn
+        if(k > perPage && slot % perPage == 0) {
+            CHECK(TOTAL_Slot((slot + total_store.slots - 1) % total_store.slots)[1] == k - 1);
+        }
+        CHECK(test_reload(k));
+        CHECK(total_store.slot == k % total_store.slots);
+    }
+
+    // A record torn first on a page: the page is opened again, the newest
+    // complete record on the other page stands until then
+    while(total_store.slot % perPage) {
+        test_fill(++k);
+        CHECK(TOTAL_Save(test_acc, TEST_METERS));
+    }
+    slot = total_store.slot;
+    test_fill(k + 1);
+    CHECK(TOTAL_Save(test_acc, TEST_METERS));
+    test_tear(slot, 1);
+    CHECK(test_reload(k));
+    erases = sim_stats.flashErases;
+    test_fill(k + 2);
+    CHECK(TOTAL_Save(test_acc, TEST_METERS));
+    CHECK(sim_stats.flashErases == erases + 1);
+    CHECK(TOTAL_Slot(slot)[0] >> 16 == TOTAL_MAGIC);
+    CHECK(test_reload(k + 2));
+}
+
+int main(void)
+{
+    test_empty();
+    test_torn();
+    test_rollover();
+
+    if(test_failures) {
+        printf("%lu checks failed\n", (unsigned long)test_failures);
+        return EXIT_FAILURE;
+    }
+    printf("total ok\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,150 @@
+/*
+ * energy.h
+ *
+ * Time spent in each energy mode and the energy per sample it adds up to
+ */
+
+#ifndef ENERGY
+#define ENERGY
+
+#include <stdint.h>
+#include "em_device.h"
+#include "em_core.h"
+#include "sleep.h"
+#include "rtcdriver.h"
+
+/* @var ENERGY_MODES  EM0 to EM2, the sleep driver is kept out of EM3 */
+#define ENERGY_MODES            3
+
+/*******************************************************************************
+ * @var ENERGY_*_UA
+ * @abstract Supply current per energy mode, used for the energy estimate
+ * @discussion Typical figures of the EFM32WG datasheet for the 14 MHz HFRCO,
+ *             EM2 with the RTC and LEUART0 running from the LFXO. The MAX35103
+ *             devices are not included. Override them with measurements of
+ *             the actual board.
+ ******************************************************************************/
+#ifndef ENERGY_EM0_UA
+#define ENERGY_EM0_UA           3300
+#endif
+#ifndef ENERGY_EM1_UA
+#define ENERGY_EM1_UA           1200
+#endif
+#ifndef ENERGY_EM2_UA
+#define ENERGY_EM2_UA           2
+#endif
+/* @var ENERGY_SUPPLY_MV  Supply voltage */
+#ifndef ENERGY_SUPPLY_MV
+#define ENERGY_SUPPLY_MV        3300
+#endif
+
+/* @var ENERGY_TICK_HZ  RTCDRV wall clock rate */
+#define ENERGY_TICK_HZ          32768
+
+/*******************************************************************************
+ * @var energy
+ * @abstract RTC ticks spent in each energy mode since ENERGY_Init()
+ * @discussion The sleep driver calls ENERGY_Sleep() right before and
+ *             ENERGY_Wakeup() right after the core sleeps, both with
+ *             interrupts masked. Each adds the ticks since the last call to
+ *             the mode the core was in, so ticks[0] also holds the time spent
+ *             in interrupt handlers. A sleep shorter than a tick counts as 0
+ *             or 1 tick depending on where the RTC stood, which averages out.
+ ******************************************************************************/
+struct {
+    uint64_t ticks[ENERGY_MODES];
+    uint32_t last;
+    volatile uint32_t samples;
+} energy;
+
+void ENERGY_Sleep(SLEEP_EnergyMode_t mode)
+{
+    uint32_t now = RTCDRV_GetWallClockTicks32();
+
+    (void)mode;
+
+    energy.ticks[sleepEM0] += now - energy.last;
+    energy.last = now;
+}
+
+void ENERGY_Wakeup(SLEEP_EnergyMode_t mode)
+{
+    uint32_t now = RTCDRV_GetWallClockTicks32();
+
+    if(mode < ENERGY_MODES) {
+        energy.ticks[mode] += now - energy.last;
+    }
+    energy.last = now;
+}
+
+/*******************************************************************************
+ * @function    ENERGY_Init()
+ * @abstract    Start counting and hand the callbacks to the sleep driver
+ * @discussion  Must run after RTCDRV_Init(). Blocks EM3 for good, it stops the
+ *              LFXO that the RTCDRV timers and LEUART0 run from.
+ *
+ * @return      void
+ ******************************************************************************/
+void ENERGY_Init()
+{
+    uint32_t i;
+
+    for(i = 0; i < ENERGY_MODES; i++) {
+        energy.ticks[i] = 0;
+    }
+    energy.samples = 0;
+    energy.last = RTCDRV_GetWallClockTicks32();
+
+    SLEEP_Init(ENERGY_Sleep, ENERGY_Wakeup);
+    SLEEP_SleepBlockBegin(sleepEM3);
+}
+
+/*******************************************************************************
+ * @function    ENERGY_Snapshot()
+ * @abstract    Copy the counters, the time since the last sleep counted as EM0
+ *
+ * @param       ticks   ENERGY_MODES entries
+ *
+ * @return      Samples taken
+ ******************************************************************************/
+uint32_t ENERGY_Snapshot(uint64_t *ticks)
+{
+    uint32_t samples;
+    uint32_t i;
+    CORE_DECLARE_IRQ_STATE;
+
+    CORE_ENTER_ATOMIC();
+    ENERGY_Sleep(sleepEM0);
+    for(i = 0; i < ENERGY_MODES; i++) {
+        ticks[i] = energy.ticks[i];
+    }
+    samples = energy.samples;
+    CORE_EXIT_ATOMIC();
+
+    return samples;
+}
+
+/*******************************************************************************
+ * @function    ENERGY_PerSample()
+ * @abstract    Energy drawn per sample from the mode times and ENERGY_*_UA
+ *
+ * @param       ticks   ENERGY_MODES entries from ENERGY_Snapshot()
+ * @param       samples Samples taken in that time
+ *
+ * @return      nJ per sample, 0 before the first sample
+ ******************************************************************************/
+uint32_t ENERGY_PerSample(const uint64_t *ticks, uint32_t samples)
+{
+    // uA * ticks, one tick being 1 / ENERGY_TICK_HZ s
+    uint64_t charge = ticks[sleepEM0] * ENERGY_EM0_UA +
+                      ticks[sleepEM1] * ENERGY_EM1_UA +
+                      ticks[sleepEM2] * ENERGY_EM2_UA;
+
+    if(!samples) {
+        return 0;
+    }
+    // mV * uA * s = nJ
+    return (uint32_t)(charge * ENERGY_SUPPLY_MV / ENERGY_TICK_HZ / samples);
+}
+
+#endif /* ENERGY */
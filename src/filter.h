@@ -0,0 +1,277 @@
+/*
+ * filter.h
+ *
+ * Moving average, exponential smoothing and sliding median of a sample stream
+ */
+
+#ifndef FILTER
+#define FILTER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*******************************************************************************
+ * @var FILTER_*
+ * @abstract Filter modes and their parameter
+ * @discussion FILTER_NONE    Values pass unchanged
+ *             FILTER_MEAN    Mean of the last param values, O(1) per value
+ *             FILTER_EMA     y += (x - y) / 2^param, O(1) per value
+ *             FILTER_MEDIAN  Median of the last param values, the mean of
+ *                            the middle two for an even count, O(log param)
+ *                            per value
+ *             Until the window is full the mean and median run over the
+ *             values so far, the EMA starts at the first value.
+ ******************************************************************************/
+#define FILTER_NONE             0
+#define FILTER_MEAN             1
+#define FILTER_EMA              2
+#define FILTER_MEDIAN           3
+
+#ifndef FILTER_WINDOW_MAX
+#define FILTER_WINDOW_MAX       32
+#endif
+#define FILTER_EMA_SHIFT_MAX    8
+/* @var FILTER_EMA_FRAC  Fraction bits the EMA state carries */
+#define FILTER_EMA_FRAC         16
+
+// FILTER_t.where of a slot in hi, its heap index below
+#define FILTER_IN_HI            0x80
+
+#if FILTER_WINDOW_MAX > 127
+#error "FILTER_t.where holds heap indexes below FILTER_IN_HI"
+#endif
+
+/*******************************************************************************
+ * @struct      FILTER_Heap_t
+ * @abstract    Binary heap of ring slots, ordered by their values
+ ******************************************************************************/
+typedef struct {
+    uint8_t slot[FILTER_WINDOW_MAX / 2 + 1];
+    uint8_t size;
+    bool max;
+} FILTER_Heap_t;
+
+/*******************************************************************************
+ * @struct      FILTER_t
+ * @abstract    Filter of one stream, fixed size, no allocation
+ * @discussion  data is the window as a ring, next the slot the next value
+ *              replaces. FILTER_MEAN keeps the window sum in acc, FILTER_EMA
+ *              its state scaled by 2^FILTER_EMA_FRAC. FILTER_MEDIAN splits the
+ *              slots of the window between lo, a max heap of the lower half
+ *              holding the median on top, and hi, a min heap of the upper
+ *              half. where tracks the heap position of every slot, so the
+ *              value leaving the window is overwritten in place by the new
+ *              one and only that entry has to be sifted.
+ ******************************************************************************/
+typedef struct {
+    uint8_t mode;
+    uint8_t param;
+    uint8_t count;
+    uint8_t next;
+    int32_t data[FILTER_WINDOW_MAX];
+    int64_t acc;
+    uint8_t where[FILTER_WINDOW_MAX];
+    FILTER_Heap_t lo;
+    FILTER_Heap_t hi;
+} FILTER_t;
+
+/*******************************************************************************
+ * @function    FILTER_Configure()
+ * @abstract    Select the mode and start over
+ *
+ * @param       f       Filter
+ * @param       mode    FILTER_*
+ * @param       param   Window of FILTER_MEAN and FILTER_MEDIAN, 1 to
+ *                      FILTER_WINDOW_MAX, shift of FILTER_EMA, 1 to
+ *                      FILTER_EMA_SHIFT_MAX, ignored by FILTER_NONE
+ *
+ * @return      false if mode or param are out of range, nothing changes
+ ******************************************************************************/
+bool FILTER_Configure(FILTER_t *f, uint8_t mode, uint8_t param)
+{
+    switch(mode) {
+    case FILTER_NONE:
+        param = 0;
+        break;
+    case FILTER_MEAN:
+    case FILTER_MEDIAN:
+        if(!param || param > FILTER_WINDOW_MAX) {
+            return false;
+        }
+        break;
+    case FILTER_EMA:
+        if(!param || param > FILTER_EMA_SHIFT_MAX) {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    f->mode = mode;
+    f->param = param;
+    f->count = 0;
+    f->next = 0;
+    f->acc = 0;
+    f->lo.size = 0;
+    f->lo.max = true;
+    f->hi.size = 0;
+    f->hi.max = false;
+    return true;
+}
+
+/* ----- Sliding median ----- */
+
+// Whether slot a belongs above slot b in heap h
+bool FILTER_Above(const FILTER_t *f, const FILTER_Heap_t *h, uint8_t a, uint8_t b)
+{
+    return h->max ? f->data[a] > f->data[b] : f->data[a] < f->data[b];
+}
+
+void FILTER_Place(FILTER_t *f, FILTER_Heap_t *h, uint32_t i, uint8_t slot)
+{
+    h->slot[i] = slot;
+    f->where[slot] = (h == &f->hi ? FILTER_IN_HI : 0) | i;
+}
+
+// Moves h->slot[i] up to its place, returns where it ended
+uint32_t FILTER_SiftUp(FILTER_t *f, FILTER_Heap_t *h, uint32_t i)
+{
+    uint8_t slot = h->slot[i];
+
+    while(i && FILTER_Above(f, h, slot, h->slot[(i - 1) / 2])) {
+        FILTER_Place(f, h, i, h->slot[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    FILTER_Place(f, h, i, slot);
+    return i;
+}
+
+void FILTER_SiftDown(FILTER_t *f, FILTER_Heap_t *h, uint32_t i)
+{
+    uint8_t slot = h->slot[i];
+    uint32_t child;
+
+    while((child = 2 * i + 1) < h->size) {
+        if(child + 1 < h->size && FILTER_Above(f, h, h->slot[child + 1], h->slot[child])) {
+            child++;
+        }
+        if(!FILTER_Above(f, h, h->slot[child], slot)) {
+            break;
+        }
+        FILTER_Place(f, h, i, h->slot[child]);
+        i = child;
+    }
+    FILTER_Place(f, h, i, slot);
+}
+
+void FILTER_Push(FILTER_t *f, FILTER_Heap_t *h, uint8_t slot)
+{
+    h->slot[h->size] = slot;
+    FILTER_SiftUp(f, h, h->size++);
+}
+
+uint8_t FILTER_Pop(FILTER_t *f, FILTER_Heap_t *h)
+{
+    uint8_t top = h->slot[0];
+
+    if(--h->size) {
+        h->slot[0] = h->slot[h->size];
+        FILTER_SiftDown(f, h, 0);
+    }
+    return top;
+}
+
+/*******************************************************************************
+ * @function    FILTER_MedianAdd()
+ * @abstract    Take the value just written to data[slot] into the heaps
+ * @discussion  While the window fills, the slot is new: it goes through lo
+ *              into hi and hi gives one back if it got larger than lo. Once
+ *              full, the slot is already in a heap with its old value and is
+ *              sifted from where it is. Only it can then be on the wrong side,
+ *              if so the tops of lo and hi swap.
+ *
+ * @return      void
+ ******************************************************************************/
+void FILTER_MedianAdd(FILTER_t *f, uint8_t slot)
+{
+    FILTER_Heap_t *h;
+    uint8_t top;
+
+    if(f->count < f->param) {
+        FILTER_Push(f, &f->lo, slot);
+        FILTER_Push(f, &f->hi, FILTER_Pop(f, &f->lo));
+        if(f->hi.size > f->lo.size) {
+            FILTER_Push(f, &f->lo, FILTER_Pop(f, &f->hi));
+        }
+        return;
+    }
+
+    h = f->where[slot] & FILTER_IN_HI ? &f->hi : &f->lo;
+    FILTER_SiftDown(f, h, FILTER_SiftUp(f, h, f->where[slot] & ~FILTER_IN_HI));
+
+    if(f->hi.size && f->data[f->lo.slot[0]] > f->data[f->hi.slot[0]]) {
+        top = f->lo.slot[0];
+        FILTER_Place(f, &f->lo, 0, f->hi.slot[0]);
+        FILTER_Place(f, &f->hi, 0, top);
+        FILTER_SiftDown(f, &f->lo, 0);
+        FILTER_SiftDown(f, &f->hi, 0);
+    }
+}
+
+/*******************************************************************************
+ * @function    FILTER_Add()
+ * @abstract    Filter one value
+ *
+ * @param       f       Filter
+ * @param       x       Value
+ *
+ * @return      Filtered value, rounded
+ ******************************************************************************/
+int32_t FILTER_Add(FILTER_t *f, int32_t x)
+{
+    uint8_t slot = f->next;
+    int64_t half;
+
+    switch(f->mode) {
+    case FILTER_MEAN:
+        if(f->count < f->param) {
+            f->count++;
+        }
+        else {
+            f->acc -= f->data[slot];
+        }
+        f->data[slot] = x;
+        f->acc += x;
+        f->next = slot + 1 < f->param ? slot + 1 : 0;
+        half = f->acc < 0 ? -(f->count / 2) : f->count / 2;
+        return (int32_t)((f->acc + half) / f->count);
+
+    case FILTER_EMA:
+        if(!f->count) {
+            f->count = 1;
+            f->acc = (int64_t)x << FILTER_EMA_FRAC;
+        }
+        else {
+            f->acc += (((int64_t)x << FILTER_EMA_FRAC) - f->acc) / (1 << f->param);
+        }
+        return (int32_t)((f->acc + (1 << (FILTER_EMA_FRAC - 1))) >> FILTER_EMA_FRAC);
+
+    case FILTER_MEDIAN:
+        f->data[slot] = x;
+        FILTER_MedianAdd(f, slot);
+        if(f->count < f->param) {
+            f->count++;
+        }
+        f->next = slot + 1 < f->param ? slot + 1 : 0;
+        if(f->count & 1) {
+            return f->data[f->lo.slot[0]];
+        }
+        return (int32_t)(((int64_t)f->data[f->lo.slot[0]] + f->data[f->hi.slot[0]]) >> 1);
+
+    default:
+        return x;
+    }
+}
+
+#endif /* FILTER */
@@ -0,0 +1,219 @@
+/*
+ * flow.h
+ *
+ * Fixed point velocity and volumetric flow from the transit times of one path
+ */
+
+#ifndef FLOW
+#define FLOW
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sound.h"
+
+/* @var FLOW_INVALID  Velocity and flow of a sample the engine could not use */
+#define FLOW_INVALID            INT32_MIN
+
+/* @var FLOW_*_MAX  Geometry limits that keep every product within 64 bits */
+#define FLOW_PATH_MAX           2000000     // um
+#define FLOW_ANGLE_MAX          8000        // 0.01 degrees
+#define FLOW_DIAMETER_MAX       4000000     // um
+
+/*******************************************************************************
+ * @var FLOW_EXPANSION_PPM/FLOW_TEMP_REF
+ * @abstract Thermal expansion of the meter body, stainless steel by default
+ * @discussion Path and bore are those at FLOW_TEMP_REF, m degrees C. At any
+ *             other temperature the path grows by FLOW_EXPANSION_PPM per
+ *             degree and the bore section twice that.
+ ******************************************************************************/
+#ifndef FLOW_EXPANSION_PPM
+#define FLOW_EXPANSION_PPM      17
+#endif
+#ifndef FLOW_TEMP_REF
+#define FLOW_TEMP_REF           20000
+#endif
+
+// One 0.01 degree in radians, Q30
+#define FLOW_CDEG_Q30           187404
+#define FLOW_ONE_Q30            (1LL << 30)
+
+/*******************************************************************************
+ * @struct      FLOW_Geometry_t
+ * @abstract    Meter geometry as configured by the host
+ * @discussion  pathUm      Acoustic path between the transducers, um
+ *              angle       Path angle to the pipe axis in 0.01 degrees, 0 for
+ *                          an axial meter
+ *              diameterUm  Pipe bore, um
+ *              offset      Part of AVG_UP and AVG_DN that is not transit time:
+ *                          the mean selected hit wave in transducer periods
+ *                          plus transducer and cable delays, Q16.16 in 250 ns
+ *                          periods like the registers
+ ******************************************************************************/
+typedef struct {
+    uint32_t pathUm;
+    uint16_t angle;
+    uint32_t diameterUm;
+    int32_t offset;
+} FLOW_Geometry_t;
+
+/*******************************************************************************
+ * @var flow_engine
+ * @abstract Geometry in use and the constants FLOW_Configure() derives from it
+ * @discussion kv      pathUm / (2 cos angle), um
+ *             kc      2 pathUm cos angle, um
+ *             areaQ8  Bore cross section, mm^2 in Q24.8
+ ******************************************************************************/
+struct {
+    FLOW_Geometry_t geometry;
+    uint32_t kv;
+    uint32_t kc;
+    uint32_t areaQ8;
+} flow_engine;
+
+/*******************************************************************************
+ * @function    FLOW_Cos()
+ * @abstract    Cosine of an angle in 0.01 degrees, Q30
+ * @discussion  Taylor series up to x^10 in Horner form, off by less than 1e-6
+ *              up to 90 degrees. Only runs when the geometry changes.
+ *
+ * @param       angle   0 to 9000
+ *
+ * @return      cos(angle) * 2^30
+ ******************************************************************************/
+int64_t FLOW_Cos(uint32_t angle)
+{
+    static const uint8_t div[5] = { 90, 56, 30, 12, 2 };
+    int64_t x = (int64_t)angle * FLOW_CDEG_Q30;
+    int64_t x2 = (x * x) >> 30;
+    int64_t c = FLOW_ONE_Q30;
+    uint32_t i;
+
+    for(i = 0; i < 5; i++) {
+        c = FLOW_ONE_Q30 - ((x2 * c) >> 30) / div[i];
+    }
+    return c;
+}
+
+/*******************************************************************************
+ * @function    FLOW_Configure()
+ * @abstract    Take a new geometry
+ *
+ * @param       g       Geometry, copied
+ *
+ * @return      false if it is out of the FLOW_*_MAX limits, nothing changes
+ ******************************************************************************/
+bool FLOW_Configure(const FLOW_Geometry_t *g)
+{
+    uint64_t d2 = (uint64_t)g->diameterUm * g->diameterUm;
+    int64_t cosine;
+
+    if(!g->pathUm || g->pathUm > FLOW_PATH_MAX || g->angle > FLOW_ANGLE_MAX ||
+       !g->diameterUm || g->diameterUm > FLOW_DIAMETER_MAX) {
+        return false;
+    }
+    cosine = FLOW_Cos(g->angle);
+    if(g->pathUm * cosine < FLOW_ONE_Q30) {
+        return false;
+    }
+
+    flow_engine.geometry = *g;
+    // path * 2^30 / (2 cos)
+    flow_engine.kv = (((uint64_t)g->pathUm << 30) / cosine + 1) / 2;
+    // 2 path cos / 2^30
+    flow_engine.kc = (g->pathUm * cosine + (1 << 28)) >> 29;
+    // pi / 4 * d^2 in mm^2 * 256, 2.01062e-4 = pi / 4 * 256 / 1e6
+    flow_engine.areaQ8 = (d2 * 201062 + 500000000) / 1000000000;
+    return true;
+}
+
+/*******************************************************************************
+ * @function    FLOW_Compute()
+ * @abstract    Velocity along the pipe and volumetric flow of one measurement
+ * @discussion  With transit times tu upstream and td downstream over a path L
+ *              at angle a to the axis, v = L / (2 cos a) * (tu - td) / (tu td),
+ *              independent of the speed of sound. The times are Q16.16 in
+ *              250 ns periods, one LSB being 1 / (4e6 * 2^16) s, which gives
+ *              v [um/s] = kv * diff / (tu td) * 4e6 * 2^16. It is evaluated as
+ *              c = (diff * 2^32 / tu) * kv * 2^8 / td and v = c * 4e6 / 2^24, with
+ *              |diff| < tu keeping the first quotient within 32 bits.
+ *              With the water temperature known, v = c^2 (tu - td) / (2 L cos a)
+ *              instead, c from SOUND_Speed(). That only needs the difference,
+ *              which the MAX35103 measures far better than the absolute times
+ *              and their offset, and corrects the path and bore for the
+ *              expansion of the meter body. In um/s, with c in mm/s,
+ *              v = c^2 * diff / (kc * 2^18), evaluated as (c^2 * 2^8 / kc) * diff
+ *              / 2^26. Flow is v times the bore section. Integer multiplies and
+ *              64 bit divides only, no floating point.
+ *
+ * @param       diff        TOF_DIFF, Q16.16
+ * @param       up          AVG_UP, Q16.16
+ * @param       dn          AVG_DN, Q16.16
+ * @param       temp        Water temperature in m degrees C, SOUND_NO_TEMP if
+ *                          unknown
+ * @param       velocity    Set to um/s, positive downstream
+ * @param       flow        Set to uL/s
+ *
+ * @return      false if the times are implausible, both are FLOW_INVALID
+ ******************************************************************************/
+bool FLOW_Compute(int32_t diff, uint32_t up, uint32_t dn, int32_t temp,
+                  int32_t *velocity, int32_t *flow)
+{
+    int64_t tu = (int64_t)up - flow_engine.geometry.offset;
+    int64_t td = (int64_t)dn - flow_engine.geometry.offset;
+    int64_t expansion = 0;
+    uint64_t speed;
+    int64_t c;
+    int64_t v;
+    int64_t q;
+
+    *velocity = FLOW_INVALID;
+    *flow = FLOW_INVALID;
+
+    if(temp != SOUND_NO_TEMP) {
+        speed = SOUND_Speed(temp);
+        // < 2^41 * 2^8
+        c = (int64_t)((speed * speed << 8) / flow_engine.kc);
+        if(diff && c > INT64_MAX / (diff < 0 ? -(int64_t)diff : diff)) {
+            return false;
+        }
+        v = c * diff / (1 << 26);
+        if(v > INT32_MAX || v < -INT32_MAX) {
+            return false;
+        }
+        // 17 ppm / degree * m degrees = 1e-9
+        expansion = (int64_t)FLOW_EXPANSION_PPM * (temp - FLOW_TEMP_REF);
+        v = v * (1000000000 - expansion) / 1000000000;
+    }
+    else {
+        if(tu <= 0 || td <= 0 || diff >= tu || -(int64_t)diff >= tu) {
+            return false;
+        }
+        c = (int64_t)diff * (1LL << 32) / tu;
+        c = c * flow_engine.kv * 256 / td;
+        if(c > (1LL << 48) || c < -(1LL << 48)) {
+            return false;
+        }
+        // 4e6 / 2^24 = 15625 / 2^16
+        v = c * 15625 / 65536;
+    }
+    if(v > INT32_MAX || v < -INT32_MAX) {
+        return false;
+    }
+    // um/s * mm^2 = 1e-3 uL/s
+    q = v * flow_engine.areaQ8 / (256 * 1000);
+    if(q > INT32_MAX || q < -INT32_MAX) {
+        return false;
+    }
+    if(expansion) {
+        q = q * (1000000000 + 2 * expansion) / 1000000000;
+        if(q > INT32_MAX || q < -INT32_MAX) {
+            return false;
+        }
+    }
+
+    *velocity = (int32_t)v;
+    *flow = (int32_t)q;
+    return true;
+}
+
+#endif /* FLOW */
@@ -0,0 +1,133 @@
+/*
+ * frame.h
+ *
+ * COBS framing with CRC16 for binary records on the UART
+ */
+
+#ifndef FRAME
+#define FRAME
+
+#include <stdint.h>
+
+/* @var FRAME_DELIMITER  Ends every frame, never appears inside one */
+#define FRAME_DELIMITER         0x00
+/* @var FRAME_CRC_LENGTH  CRC16 appended to the payload, MSB first */
+#define FRAME_CRC_LENGTH        2
+/* @var FRAME_LENGTH  Encoded size of a payload of n bytes, delimiter included */
+#define FRAME_LENGTH(n)         ((n) + FRAME_CRC_LENGTH + ((n) + FRAME_CRC_LENGTH) / 254 + 2)
+
+/*******************************************************************************
+ * @function    FRAME_Crc16()
+ * @abstract    CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF)
+ * @discussion  Four bits at a time from a 16 entry table, a compromise between
+ *              the bitwise loop and a 512 byte table.
+ *
+ * @param       data    Bytes to check
+ * @param       length  Number of bytes
+ *
+ * @return      CRC of data
+ ******************************************************************************/
+uint16_t FRAME_Crc16(const uint8_t *data, uint32_t length)
+{
+    static const uint16_t table[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+        0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+    };
+    uint16_t crc = 0xFFFF;
+    uint32_t i;
+
+    for(i = 0; i < length; i++) {
+        crc = (crc << 4) ^ table[(crc >> 12) ^ (data[i] >> 4)];
+        crc = (crc << 4) ^ table[(crc >> 12) ^ (data[i] & 0x0F)];
+    }
+    return crc;
+}
+
+/*******************************************************************************
+ * @function    FRAME_Encode()
+ * @abstract    Append the CRC to a payload, COBS encode it and end the frame
+ * @discussion  Consistent Overhead Byte Stuffing replaces every 0x00 by the
+ *              distance to the next one, so FRAME_DELIMITER only ever ends a
+ *              frame and a receiver resynchronizes on the next one after any
+ *              loss. payload must have FRAME_CRC_LENGTH spare bytes at its end,
+ *              the CRC is written there before encoding.
+ *
+ * @param       payload Record, followed by FRAME_CRC_LENGTH spare bytes
+ * @param       length  Record length without the CRC
+ * @param       out     FRAME_LENGTH(length) bytes
+ *
+ * @return      Frame length, delimiter included
+ ******************************************************************************/
+uint32_t FRAME_Encode(uint8_t *payload, uint32_t length, uint8_t *out)
+{
+    uint16_t crc = FRAME_Crc16(payload, length);
+    uint32_t code = 0;
+    uint32_t n = 1;
+    uint32_t i;
+
+    payload[length++] = crc >> 8;
+    payload[length++] = crc & 0xFF;
+
+    for(i = 0; i < length; i++) {
+        if(payload[i] == FRAME_DELIMITER) {
+            out[code] = n - code;
+            code = n++;
+            continue;
+        }
+        out[n++] = payload[i];
+        if(n - code == 0xFF) {
+            out[code] = 0xFF;
+            code = n++;
+        }
+    }
+    out[code] = n - code;
+    out[n++] = FRAME_DELIMITER;
+
+    return n;
+}
+
+/*******************************************************************************
+ * @function    FRAME_Decode()
+ * @abstract    Undo FRAME_Encode() and check the CRC
+ * @discussion  out never gets ahead of frame, so a frame may be decoded in
+ *              place.
+ *
+ * @param       frame   Encoded bytes up to, not including, the delimiter
+ * @param       length  Number of encoded bytes
+ * @param       out     length bytes
+ *
+ * @return      Record length without the CRC, 0 if the frame is malformed,
+ *              empty or fails the CRC
+ ******************************************************************************/
+uint32_t FRAME_Decode(const uint8_t *frame, uint32_t length, uint8_t *out)
+{
+    uint32_t n = 0;
+    uint32_t i = 0;
+    uint32_t code;
+    uint32_t j;
+
+    while(i < length) {
+        code = frame[i++];
+        if(code == FRAME_DELIMITER || i + code - 1 > length) {
+            return 0;
+        }
+        for(j = 1; j < code; j++) {
+            out[n++] = frame[i++];
+        }
+        // Every block but a full one and the last ends in a replaced 0x00
+        if(code != 0xFF && i < length) {
+            out[n++] = FRAME_DELIMITER;
+        }
+    }
+
+    if(n <= FRAME_CRC_LENGTH) {
+        return 0;
+    }
+    n -= FRAME_CRC_LENGTH;
+    if(FRAME_Crc16(out, n) != ((out[n] << 8) | out[n + 1])) {
+        return 0;
+    }
+    return n;
+}
+
+#endif /* FRAME */
@@ -0,0 +1,128 @@
+/*
+ * hampel.h
+ *
+ * Robust TOF difference from the individual hits, Hampel outlier rejection
+ */
+
+#ifndef HAMPEL
+#define HAMPEL
+
+#include <stdint.h>
+
+/* @var HAMPEL_HITS_MAX  Hit registers per direction */
+#define HAMPEL_HITS_MAX         6
+
+/* @var HAMPEL_MAD_SIGMA  Standard deviation per MAD of normal noise, 1.4826 in Q16 */
+#define HAMPEL_MAD_SIGMA        97163
+
+/*******************************************************************************
+ * @var HAMPEL_FLOOR
+ * @abstract Least deviation from the median ever rejected, Q16.16 in 250 ns
+ *           periods, about 1 ns
+ * @discussion With a few hits the MAD is often 0 or a single LSB, the floor
+ *             keeps the timing noise of good hits from being taken for
+ *             outliers. A hit on the wrong wave is off by a whole transducer
+ *             period, several hundred ns.
+ ******************************************************************************/
+#ifndef HAMPEL_FLOOR
+#define HAMPEL_FLOOR            (1 << 8)
+#endif
+
+// Sorts the n values of v in place, n is at most HAMPEL_HITS_MAX
+void HAMPEL_Sort(int32_t *v, uint32_t n)
+{
+    uint32_t i;
+    uint32_t j;
+    int32_t x;
+
+    for(i = 1; i < n; i++) {
+        x = v[i];
+        for(j = i; j && v[j - 1] > x; j--) {
+            v[j] = v[j - 1];
+        }
+        v[j] = x;
+    }
+}
+
+// Median of n sorted values, the mean of the middle two for an even n
+int32_t HAMPEL_Median(const int32_t *v, uint32_t n)
+{
+    if(n & 1) {
+        return v[n / 2];
+    }
+    return (int32_t)(((int64_t)v[n / 2 - 1] + v[n / 2]) >> 1);
+}
+
+/*******************************************************************************
+ * @function    HAMPEL_Diff()
+ * @abstract    TOF difference of one measurement without its outlier hits
+ * @discussion  Each hit n gives its own difference HITn_UP - HITn_DN, the
+ *              wave selection and launch are the same in both directions. A
+ *              bubble or particle in the path turns single hits into a wrong
+ *              or late wave, which moves the average TOF_DIFF of the chip by
+ *              a fraction of a period. Here a difference further than k times
+ *              the MAD scaled to a standard deviation from the median of all
+ *              of them, and further than HAMPEL_FLOOR, is dropped and the
+ *              rest averaged. Fewer than half the hits can be outliers, with
+ *              3 of 6 off the median lies between the groups and all are
+ *              kept. Hits that read 0 did not arrive and are skipped. Two
+ *              sorts of at most HAMPEL_HITS_MAX values per measurement.
+ *
+ * @param       up      HIT1_UP..HITn_UP, Q16.16
+ * @param       dn      HIT1_DN..HITn_DN, Q16.16
+ * @param       hits    n, 1 to HAMPEL_HITS_MAX
+ * @param       k       Threshold in 0.1 standard deviations, 0 keeps every
+ *                      hit
+ * @param       diff    Set to the mean difference of the hits kept, Q16.16
+ *
+ * @return      Hits kept, 0 if none arrived and diff is unchanged
+ ******************************************************************************/
+uint32_t HAMPEL_Diff(const int32_t *up, const int32_t *dn, uint32_t hits, uint32_t k,
+                     int32_t *diff)
+{
+    int32_t d[HAMPEL_HITS_MAX];
+    int32_t dev[HAMPEL_HITS_MAX];
+    int32_t median;
+    int64_t limit;
+    int64_t sum = 0;
+    uint32_t n = 0;
+    uint32_t kept = 0;
+    uint32_t i;
+
+    for(i = 0; i < hits && i < HAMPEL_HITS_MAX; i++) {
+        if(up[i] && dn[i]) {
+            d[n++] = up[i] - dn[i];
+        }
+    }
+    if(!n) {
+        return 0;
+    }
+
+    HAMPEL_Sort(d, n);
+    median = HAMPEL_Median(d, n);
+    for(i = 0; i < n; i++) {
+        dev[i] = d[i] > median ? d[i] - median : median - d[i];
+    }
+    HAMPEL_Sort(dev, n);
+    // < 2^31 * 2^17 * 255 within 64 bits
+    limit = k ? (int64_t)HAMPEL_Median(dev, n) * HAMPEL_MAD_SIGMA * k / (10 << 16) : INT64_MAX;
+    if(limit < HAMPEL_FLOOR) {
+        limit = HAMPEL_FLOOR;
+    }
+
+    for(i = 0; i < n; i++) {
+        if((d[i] > median ? (int64_t)d[i] - median : (int64_t)median - d[i]) <= limit) {
+            sum += d[i];
+            kept++;
+        }
+    }
+    // Only a k below 0.7 can leave nothing, the median stands in then
+    if(!kept) {
+        *diff = median;
+        return 1;
+    }
+    *diff = (int32_t)((sum + (sum < 0 ? -(int64_t)(kept / 2) : kept / 2)) / (int64_t)kept);
+    return kept;
+}
+
+#endif /* HAMPEL */
@@ -0,0 +1,180 @@
+/*
+ * host_cmd.h
+ *
+ * Receiver for COBS framed commands from the host on USART0 or LEUART0
+ */
+
+#ifndef HOST_CMD
+#define HOST_CMD
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "em_device.h"
+#include "max_config.h"
+#include "frame.h"
+
+/*******************************************************************************
+ * @var HOST_CMD_*
+ * @abstract Commands, first byte of a record framed as by FRAME_Encode()
+ * @discussion Arguments follow big endian:
+ *             HOST_CMD_PERIOD   uint16 ms between measurements of a device,
+ *                               0 measures back to back
+ *             HOST_CMD_FORMAT   uint8 OUT_FORMAT_*
+ *             HOST_CMD_ACQ      uint8 ACQ_MODE_*
+ *             HOST_CMD_EVENT    uint8 EVT_MODE_*
+ *             HOST_CMD_REG      uint8 MAX_CFG_* index, uint16 value,
+ *                               uint8 commit to the configuration flash
+ *             HOST_CMD_PROFILE  uint16 per register in MAX_CFG_* order,
+ *                               uint8 commit to the configuration flash
+ *             HOST_CMD_BATCH    uint8 samples per frame (1 to BATCH_MAX),
+ *                               uint16 ms a sample may wait, 0 no limit
+ *             HOST_CMD_PORT     uint8 OUT_PORT_*
+ *             HOST_CMD_ENERGY   no arguments
+ *             HOST_CMD_STATS    uint16 ms per statistics interval, 0 off,
+ *                               uint8 keep sending every sample
+ *             HOST_CMD_GEOMETRY uint32 path um, uint16 path angle to the pipe
+ *                               axis in 0.01 degrees, uint32 bore um, int32
+ *                               offset Q16.16 in 250 ns periods, see
+ *                               FLOW_Geometry_t
+ *             HOST_CMD_TOTAL    uint8 device, uint8 HOST_TOTAL_*
+ *             HOST_CMD_FILTER   uint8 FILTER_*, uint8 window or EMA shift,
+ *                               every device, see filter.h
+ *             HOST_CMD_HAMPEL   uint8 outlier threshold of ACQ_MODE_HITS in
+ *                               0.1 standard deviations, 0 keeps every hit
+ *             Every command is answered by a HOST_CMD_REPLY record, which
+ *             can not be mistaken for a sample since no device has that
+ *             index: HOST_CMD_REPLY, opcode, HOST_STATUS_*. The reply to
+ *             HOST_CMD_ENERGY goes on with uint32 ms spent in EM0, EM1 and
+ *             EM2, samples taken and nJ per sample, see energy.h. The reply
+ *             to HOST_CMD_TOTAL goes on with uint64 forward, uint64 reverse
+ *             and int64 net volume of the device in nL, see total.h.
+ *             HOST_CMD_REG and HOST_CMD_PROFILE answer HOST_STATUS_BUSY when
+ *             only part of the writes could be queued. The profile is kept,
+ *             sending the command again writes what is still missing.
+ ******************************************************************************/
+#define HOST_CMD_PERIOD         0x01
+#define HOST_CMD_FORMAT         0x02
+#define HOST_CMD_ACQ            0x03
+#define HOST_CMD_EVENT          0x04
+#define HOST_CMD_REG            0x05
+#define HOST_CMD_PROFILE        0x06
+#define HOST_CMD_BATCH          0x07
+#define HOST_CMD_PORT           0x08
+#define HOST_CMD_ENERGY         0x09
+#define HOST_CMD_STATS          0x0A
+#define HOST_CMD_GEOMETRY       0x0B
+#define HOST_CMD_TOTAL          0x0C
+#define HOST_CMD_FILTER         0x0D
+#define HOST_CMD_HAMPEL         0x0E
+#define HOST_CMD_REPLY          0xFF
+
+#define HOST_STATUS_OK          0
+#define HOST_STATUS_BAD_FRAME   1   // malformed or failed CRC, opcode is 0
+#define HOST_STATUS_UNKNOWN     2
+#define HOST_STATUS_BAD_ARG     3
+#define HOST_STATUS_FLASH       4   // the flash refused a write
+#define HOST_STATUS_BUSY        5   // SPI queue full, send the command again
+
+#define HOST_TOTAL_READ         0
+#define HOST_TOTAL_SAVE         1   // also checkpoint every device to flash
+#define HOST_TOTAL_CLEAR        2   // clear the device, then checkpoint
+
+/* @var HOST_CMD_MAX_LENGTH  Longest record, HOST_CMD_PROFILE */
+#define HOST_CMD_MAX_LENGTH     (1 + 2 * MAX_CFG_REGS + 1)
+/* @var HOST_GEOMETRY_LENGTH  Record of HOST_CMD_GEOMETRY */
+#define HOST_GEOMETRY_LENGTH    15
+/* @var HOST_REPLY_LENGTH  Record answering a command */
+#define HOST_REPLY_LENGTH       3
+/* @var HOST_ENERGY_LENGTH  Data following the reply to HOST_CMD_ENERGY */
+#define HOST_ENERGY_LENGTH      20
+/* @var HOST_TOTAL_LENGTH  Data following the reply to HOST_CMD_TOTAL */
+#define HOST_TOTAL_LENGTH       24
+/* @var HOST_REPLY_MAX_LENGTH  Longest reply record */
+#define HOST_REPLY_MAX_LENGTH   (HOST_REPLY_LENGTH + HOST_TOTAL_LENGTH)
+
+/*******************************************************************************
+ * @var host_cmd
+ * @abstract Command frames between the UART receive callback and the main loop
+ * @discussion rx are the single byte receive buffers, one is always queued
+ *             with UARTDRV while the other is handled. Bytes collect in frame
+ *             up to the delimiter, the frame is then copied to cmd for the
+ *             main loop, which decodes and runs it in place. A frame that
+ *             arrives before the main loop is done with cmd, or does not fit,
+ *             is counted in dropped.
+ ******************************************************************************/
+struct {
+    uint8_t rx[2];
+    uint8_t frame[FRAME_LENGTH(HOST_CMD_MAX_LENGTH)];
+    uint8_t length;
+    bool overflow;
+    uint8_t cmd[FRAME_LENGTH(HOST_CMD_MAX_LENGTH)];
+    uint8_t cmdLength;
+    volatile bool ready;
+    volatile uint32_t dropped;
+} host_cmd;
+
+/*******************************************************************************
+ * @function    HOST_CMD_Byte()
+ * @abstract    Receiver: one byte from the UART
+ * @discussion  Only called from the receive callbacks of USART0 and LEUART0,
+ *              whose interrupts do not preempt each other. Constant time apart
+ *              from the copy of a completed frame.
+ *
+ * @return      void
+ ******************************************************************************/
+void HOST_CMD_Byte(uint8_t byte)
+{
+    if(byte != FRAME_DELIMITER) {
+        if(host_cmd.length < sizeof(host_cmd.frame)) {
+            host_cmd.frame[host_cmd.length++] = byte;
+        }
+        else {
+            host_cmd.overflow = true;
+        }
+        return;
+    }
+
+    // A lone delimiter only resynchronizes
+    if(host_cmd.length) {
+        if(host_cmd.overflow || host_cmd.ready) {
+            host_cmd.dropped++;
+        }
+        else {
+            memcpy(host_cmd.cmd, host_cmd.frame, host_cmd.length);
+            host_cmd.cmdLength = host_cmd.length;
+            __DMB();
+            host_cmd.ready = true;
+        }
+    }
+    host_cmd.length = 0;
+    host_cmd.overflow = false;
+}
+
+/*******************************************************************************
+ * @function    HOST_CMD_Decode()
+ * @abstract    Main loop: decode the waiting command in place
+ *
+ * @param       record  Set to the decoded record
+ *
+ * @return      Record length, 0 if the frame is bad
+ ******************************************************************************/
+uint32_t HOST_CMD_Decode(uint8_t **record)
+{
+    *record = host_cmd.cmd;
+    return FRAME_Decode(host_cmd.cmd, host_cmd.cmdLength, host_cmd.cmd);
+}
+
+/* Main loop: big endian 32 bit argument of a decoded record */
+uint32_t HOST_CMD_Word(const uint8_t *arg)
+{
+    return ((uint32_t)arg[0] << 24) | ((uint32_t)arg[1] << 16) | (arg[2] << 8) | arg[3];
+}
+
+/* Main loop: done with the command, the receiver may hand over the next one */
+void HOST_CMD_Release()
+{
+    host_cmd.ready = false;
+}
+
+#endif /* HOST_CMD */
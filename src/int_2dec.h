@@ -0,0 +1,26 @@
+#ifndef INT_2DEC
+#define INT_2DEC
+
+#include <stdint.h>
+
+//uint32 to decimal, right aligned in width characters, the rest filled with pad
+//returns the number of digits written, digits that do not fit are cut off
+//no division routine is called, / 10 and % 10 compile to a multiply
+uint32_t uint32_2dec(uint32_t value, uint8_t *s, uint32_t width, uint8_t pad){
+	uint32_t i = width;
+	uint32_t digits;
+
+	do {
+		s[--i] = '0' + value % 10;
+		value /= 10;
+	} while(value && i);
+
+	digits = width - i;
+	while(i) {
+		s[--i] = pad;
+	}
+
+	return digits;
+}
+
+#endif /* INT_2DEC */
@@ -0,0 +1,198 @@
+/*
+ * leuart_tx.h
+ *
+ * Transmit queue on LEUART0 fed by DMA and byte receive, both keep working in
+ * EM2
+ */
+
+#ifndef LEUART_TX
+#define LEUART_TX
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "em_device.h"
+#include "em_cmu.h"
+#include "em_core.h"
+#include "em_gpio.h"
+#include "em_leuart.h"
+#include "em_dma.h"
+#include "dmadrv.h"
+
+/* @var LEUART_TX_DEPTH  Buffers that can wait for the line, power of 2 */
+#define LEUART_TX_DEPTH         8
+/* @var LEUART_TX_MAX  Longest buffer, one basic DMA cycle */
+#define LEUART_TX_MAX           1024
+
+/* @var LEUART_TX_BAUDRATE  Highest standard rate the 32768 Hz LFXO supports */
+#define LEUART_TX_BAUDRATE      9600
+
+// TX and RX pins, LEUART0 location 2
+#define LEUART_TX_LOCATION      LEUART_ROUTE_LOCATION_LOC2
+#define LEUART_TX_PORT          gpioPortE
+#define LEUART_TX_PIN           14
+#define LEUART_RX_PORT          gpioPortE
+#define LEUART_RX_PIN           15
+
+/* @var LEUART_TX_Callback_t  Called from the DMA interrupt once a buffer is sent */
+typedef void (*LEUART_TX_Callback_t)(uint8_t *data, uint32_t count);
+/* @var LEUART_RX_Callback_t  Called from the LEUART0 interrupt for every byte received */
+typedef void (*LEUART_RX_Callback_t)(uint8_t byte);
+
+typedef struct {
+    uint8_t *data;
+    uint16_t count;
+} LEUART_TX_Buffer_t;
+
+/*******************************************************************************
+ * @var leuart_tx
+ * @abstract Buffers waiting for or being sent by the LEUART DMA channel
+ * @discussion The DMA is requested by TXBL of LEUART0. With TXDMAWU set the
+ *             LEUART wakes the DMA from EM2 for every byte, so a buffer
+ *             drains while the core sleeps with the HF clock off. queue[head]
+ *             is on the line, buffers are sent and completed in order.
+ *             The receiver runs from the LFXO as well, RXDATAV wakes the core
+ *             from EM2 for every byte, which goes to received.
+ ******************************************************************************/
+struct {
+    LEUART_TX_Buffer_t queue[LEUART_TX_DEPTH];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+    unsigned int channel;
+    DMA_CB_TypeDef cb;
+    LEUART_TX_Callback_t done;
+    LEUART_RX_Callback_t received;
+} leuart_tx;
+
+// Start the DMA on the buffer at head
+void LEUART_TX_StartNext()
+{
+    LEUART_TX_Buffer_t *b = &leuart_tx.queue[leuart_tx.head & (LEUART_TX_DEPTH - 1)];
+
+    DMA_ActivateBasic(leuart_tx.channel, true, false, (void *)&LEUART0->TXDATA,
+                      b->data, b->count - 1);
+}
+
+// DMA completion, runs from the DMA interrupt
+void LEUART_TX_DMADone(unsigned int channel, bool primary, void *user)
+{
+    LEUART_TX_Buffer_t b = leuart_tx.queue[leuart_tx.head & (LEUART_TX_DEPTH - 1)];
+
+    (void)channel;
+    (void)primary;
+    (void)user;
+
+    leuart_tx.head++;
+    if(leuart_tx.head != leuart_tx.tail) {
+        LEUART_TX_StartNext();
+    }
+    if(leuart_tx.done) {
+        leuart_tx.done(b.data, b.count);
+    }
+}
+
+/*******************************************************************************
+ * @function    LEUART_TX_Init()
+ * @abstract    Clock LEUART0 from the LFXO, reserve its DMA channel and
+ *              start receiving
+ * @discussion  Must run after DMADRV is initialized, SPIDRV_Init() does that.
+ *
+ * @param       done        Completion callback for every buffer
+ * @param       received    Callback for every byte received
+ *
+ * @return      void
+ ******************************************************************************/
+void LEUART_TX_Init(LEUART_TX_Callback_t done, LEUART_RX_Callback_t received)
+{
+    LEUART_Init_TypeDef init = LEUART_INIT_DEFAULT;
+    DMA_CfgChannel_TypeDef chnlCfg;
+    DMA_CfgDescr_TypeDef descrCfg;
+
+    leuart_tx.head = leuart_tx.tail = 0;
+    leuart_tx.done = done;
+    leuart_tx.received = received;
+
+    CMU_ClockSelectSet(cmuClock_LFB, cmuSelect_LFXO);
+    CMU_ClockEnable(cmuClock_CORELE, true);
+    CMU_ClockEnable(cmuClock_LEUART0, true);
+
+    init.enable = leuartEnable;
+    init.baudrate = LEUART_TX_BAUDRATE;
+    LEUART_Init(LEUART0, &init);
+
+    GPIO_PinModeSet(LEUART_TX_PORT, LEUART_TX_PIN, gpioModePushPull, 1);
+    // Idle high while no host is connected
+    GPIO_PinModeSet(LEUART_RX_PORT, LEUART_RX_PIN, gpioModeInputPull, 1);
+    LEUART0->ROUTE = LEUART_ROUTE_TXPEN | LEUART_ROUTE_RXPEN | LEUART_TX_LOCATION;
+
+    DMADRV_AllocateChannel(&leuart_tx.channel, NULL);
+
+    leuart_tx.cb.cbFunc = LEUART_TX_DMADone;
+    leuart_tx.cb.userPtr = NULL;
+
+    chnlCfg.highPri = false;
+    chnlCfg.enableInt = true;
+    chnlCfg.select = DMAREQ_LEUART0_TXBL;
+    chnlCfg.cb = &leuart_tx.cb;
+    DMA_CfgChannel(leuart_tx.channel, &chnlCfg);
+
+    descrCfg.dstInc = dmaDataIncNone;
+    descrCfg.srcInc = dmaDataInc1;
+    descrCfg.size = dmaDataSize1;
+    descrCfg.arbRate = dmaArbitrate1;
+    descrCfg.hprot = 0;
+    DMA_CfgDescr(leuart_tx.channel, true, &descrCfg);
+
+    LEUART_TxDmaInEM2Enable(LEUART0, true);
+
+    LEUART_IntClear(LEUART0, LEUART_IFC_MASK);
+    LEUART_IntEnable(LEUART0, LEUART_IEN_RXDATAV);
+    NVIC_ClearPendingIRQ(LEUART0_IRQn);
+    NVIC_EnableIRQ(LEUART0_IRQn);
+}
+
+// Byte received, RXDATAV is the only interrupt enabled and reading clears it
+void LEUART0_IRQHandler(void)
+{
+    uint8_t byte = LEUART_Rx(LEUART0);
+
+    if(leuart_tx.received) {
+        leuart_tx.received(byte);
+    }
+}
+
+/*******************************************************************************
+ * @function    LEUART_TX_Transmit()
+ * @abstract    Queue a buffer, it must stay untouched until its callback
+ *
+ * @param       data    Bytes to send
+ * @param       count   1 to LEUART_TX_MAX
+ *
+ * @return      false if the queue is full
+ ******************************************************************************/
+bool LEUART_TX_Transmit(uint8_t *data, uint32_t count)
+{
+    LEUART_TX_Buffer_t *b;
+    bool start;
+    CORE_DECLARE_IRQ_STATE;
+
+    EFM_ASSERT(count && count <= LEUART_TX_MAX);
+
+    CORE_ENTER_ATOMIC();
+    if((uint8_t)(leuart_tx.tail - leuart_tx.head) >= LEUART_TX_DEPTH) {
+        CORE_EXIT_ATOMIC();
+        return false;
+    }
+    b = &leuart_tx.queue[leuart_tx.tail & (LEUART_TX_DEPTH - 1)];
+    b->data = data;
+    b->count = count;
+    start = leuart_tx.head == leuart_tx.tail;
+    leuart_tx.tail++;
+    if(start) {
+        LEUART_TX_StartNext();
+    }
+    CORE_EXIT_ATOMIC();
+
+    return true;
+}
+
+#endif /* LEUART_TX */
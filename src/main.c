@@ -1,31 +1,113 @@
-#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include "em_device.h"
 #include "em_chip.h"
 #include "em_cmu.h"
 #include "em_gpio.h"
 #include "em_usart.h"
+#include "em_emu.h"
 #include "rtcdriver.h"
 #include "spidrv.h"
 #include "uartdrv.h"
 #include "gpiointerrupt.h"
 
 #include "max_macros.h"
+#include "max_burst.h"
+#include "spi_queue.h"
+#include "max_config.h"
+#include "max_regs.h"
+#include "sample_queue.h"
 #include "int_2hex.h"
+#include "int_2dec.h"
+#include "frame.h"
+#include "host_cmd.h"
+#include "leuart_tx.h"
+#include "energy.h"
+#include "stats.h"
+#include "flow.h"
+#include "total.h"
+#include "filter.h"
+#include "hampel.h"
 #include <time.h>
 
-/* @var SAVE_HEX_DATA/SAVE_ASCII_DATA  Specifies format in which MAX data is transmitted */
+/* @var SAVE_HEX_DATA/SAVE_ASCII_DATA  Specifies format in which MAX data is transmitted after reset */
 #define SAVE_ASCII_DATA
 
+/*******************************************************************************
+ * @var acq_mode
+ * @abstract Selects which registers are read for every measurement
+ * @discussion ACQ_MODE_TOF   TOF difference and RTC, formatted as above
+ *             ACQ_MODE_FULL  Additionally every hit, average and wave ratio of
+ *                            both directions, sent as a binary record
+ *             ACQ_MODE_FLOW  TOF difference and the hit averages of both
+ *                            directions, sent as velocity and flow rate in
+ *                            flow_record
+ *             ACQ_MODE_HITS  Reads like ACQ_MODE_FULL, the TOF difference is
+ *                            recomputed from the hits without their outliers,
+ *                            see hampel_k, and formatted like ACQ_MODE_TOF
+ *             Samples of event timing always read the TOF list.
+ ******************************************************************************/
+#define ACQ_MODE_TOF        0
+#define ACQ_MODE_FULL       1
+#define ACQ_MODE_FLOW       2
+#define ACQ_MODE_HITS       3
+#define ACQ_MODES           4
+#define ACQ_MODE_DEFAULT    ACQ_MODE_TOF
+
+volatile uint8_t acq_mode = ACQ_MODE_DEFAULT;
+
+/*******************************************************************************
+ * @var out_format
+ * @abstract Encoding of TOF samples on the UART, can change at any time
+ * @discussion OUT_FORMAT_ASCII  uart_tx_buffer
+ *             OUT_FORMAT_BIN    bin_record, COBS framed with CRC16
+ *             OUT_FORMAT_HEX    uart_tx_hex_buffer
+ *             Samples of ACQ_MODE_FULL are always sent as full_record, those
+ *             of ACQ_MODE_FLOW as flow_record.
+ ******************************************************************************/
+#define OUT_FORMAT_ASCII    0
+#define OUT_FORMAT_BIN      1
+#define OUT_FORMAT_HEX      2
+#ifndef OUT_FORMAT_DEFAULT
+#ifdef SAVE_HEX_DATA
+#define OUT_FORMAT_DEFAULT  OUT_FORMAT_HEX
+#else
+#define OUT_FORMAT_DEFAULT  OUT_FORMAT_ASCII
+#endif
+#endif
+
+volatile uint8_t out_format = OUT_FORMAT_DEFAULT;
+
+/*******************************************************************************
+ * @var out_port
+ * @abstract Serial port the UART output goes out on
+ * @discussion OUT_PORT_UART    USART0 through UARTDRV at 115200 baud, needs
+ *                              the HF clock until a frame has left
+ *             OUT_PORT_LEUART  LEUART0 through leuart_tx at 9600 baud from the
+ *                              LFXO, its DMA keeps sending in EM2
+ *             OUT_PORT_UART blocks EM2, with OUT_PORT_LEUART the main loop
+ *             sleeps in EM2 whenever no SPI transfer is running. Host commands
+ *             are taken from both ports. USART0 only receives while the core
+ *             is in EM1, so with OUT_PORT_LEUART the host sends them to
+ *             LEUART0 RX, which receives in EM2 as well.
+ *             At 9600 baud a batch of binary samples is the way to keep up.
+ ******************************************************************************/
+#define OUT_PORT_UART       0
+#define OUT_PORT_LEUART     1
+#ifndef OUT_PORT_DEFAULT
+#define OUT_PORT_DEFAULT    OUT_PORT_UART
+#endif
+
+volatile uint8_t out_port = OUT_PORT_DEFAULT;
+
 /* ----- SPI Declarations ----- */
 
 /* @var SPI_TX_CONFIG_BUF_LENGTH  Configuration requires 3 bytes transferred */
 #define SPI_TX_CONFIG_BUF_LENGTH 3
 /* @var SPI_TX_BUF_LENGTH  OP code commands only transfer 1 byte and receive 2 bytes */
 #define SPI_TX_BUF_LENGTH 1
-/* @var SPI_RX_BUF_LENGTH  Arbitrary, 3 bytes per data register read */
-// Needs 3 bytes per register despite 2 bytes of actual data because otherwise data gets overwritten
-#define SPI_RX_BUF_LENGTH 21
+/* @var SPI_RX_BUF_LENGTH  One data word per register read, full readout list */
+#define SPI_RX_BUF_LENGTH MEAS_REGS_FULL
 
 SPIDRV_HandleData_t spi_handleData;
 SPIDRV_Handle_t spi_handle = &spi_handleData;
@@ -34,33 +116,283 @@ uint8_t spi_tx_config_buffer[SPI_TX_CONFIG_BUF_LENGTH];
 uint8_t spi_tx_buffer[SPI_TX_BUF_LENGTH];
 
 /*******************************************************************************
- * @var spi_rx_buffer
+ * @var MAX_Device_t.rx
  * @abstract Stores information received from the MAX board
- * @discussion The measurements and values from the MAX board are stored in the
- *             address locations:
- *             spi_rx_buffer[0:2]   Interrupt Status Register
- *             spi_rx_buffer[3:5]   TOF Int
- *             spi_rx_buffer[6:8]   TOF Frac
- *             spi_rx_buffer[9:11]  RTC Month_Year
- *             spi_rx_buffer[12:14] RTC Day_Date
- *             spi_rx_buffer[15:17] RTC Min_Hours
- *             spi_rx_buffer[18:20] RTC Seconds
+ * @discussion One word per register of the acquisition list the last burst
+ *             was built from, in list order. The byte clocked in with each
+ *             opcode is dropped by the burst. Every list starts with the
+ *             Interrupt Status Register, so rx[0] always holds it.
  ******************************************************************************/
 #define SPI_ISR_LOC          0
-#define SPI_TOF_INT_LOC      3
-#define SPI_TOF_FRAC_LOC     6
-#define SPI_RTC_MM_YY_LOC    9
-#define SPI_RTC_DD_DATE_LOC  12
-#define SPI_RTC_MM_HH_LOC    15
-#define SPI_RTC_SS_LOC       18
 
-uint8_t spi_rx_buffer[SPI_RX_BUF_LENGTH];
+#define MEAS_REGS_TOF        7
+#define MEAS_REGS_FULL       37
+#define MEAS_REGS_FLOW       11
+
+#define MAX_INT_STAT(buf)  MAX_WORD((buf)[SPI_ISR_LOC])
+
+/*******************************************************************************
+ * @var meas_regs
+ * @abstract Registers read by one measurement burst
+ * @discussion ACQ_MODE_TOF reads the first MEAS_REGS_TOF entries, ACQ_MODE_FULL
+ *             and ACQ_MODE_HITS all of them.
+ ******************************************************************************/
+const MAX_RegDescr_t meas_regs[MEAS_REGS_FULL] = {
+    MAX_DESCR_INT_STAT,
+    MAX_DESCR_TOF_DIFF,
+    MAX_DESCR_RTC,
+    MAX_DESCR_HITS_UP,
+    MAX_DESCR_HITS_DN
+};
+
+/*******************************************************************************
+ * @var flow_regs
+ * @abstract Registers read by one measurement burst in ACQ_MODE_FLOW
+ * @discussion The TOF list followed by AVG_UP and AVG_DN, the transit times
+ *             FLOW_Compute() needs next to their difference.
+ ******************************************************************************/
+const MAX_RegDescr_t flow_regs[MEAS_REGS_FLOW] = {
+    MAX_DESCR_INT_STAT,
+    MAX_DESCR_TOF_DIFF,
+    MAX_DESCR_RTC,
+    MAX_DESCR_AVG
+};
+
+/*******************************************************************************
+ * @var temp_regs
+ * @abstract Registers read after a TEMPERATURE measurement
+ * @discussion Read into their own buffer (MAX_Device_t.tempRx) so a pending
+ *             flow sample is untouched
+ ******************************************************************************/
+#define TEMP_REGS            9
+
+const MAX_RegDescr_t temp_regs[TEMP_REGS] = {
+    MAX_DESCR_INT_STAT,
+    MAX_DESCR_TEMP
+};
+
+/*******************************************************************************
+ * @var temp_ratio
+ * @abstract Number of TOF_DIFF measurements per TEMPERATURE measurement
+ * @discussion 0 disables the temperature channel. Counted per device,
+ *             MAX_Device_t.measPending tells the INT handler which result
+ *             burst belongs to the running measurement.
+ ******************************************************************************/
+#define TEMP_RATIO_DEFAULT   16
+
+#define MEAS_TOF             0
+#define MEAS_TEMP            1
+
+volatile uint16_t temp_ratio = TEMP_RATIO_DEFAULT;
+
+/*******************************************************************************
+ * @var evt_mode
+ * @abstract Hands measurement timing to the MAX35103 event timing engine
+ * @discussion EVT_MODE_OFF   Firmware issues every TOF_DIFF/TEMPERATURE
+ *             EVT_MODE_TOF   EVTMG1, TOF_DIFF sequences
+ *             EVT_MODE_TEMP  EVTMG2, temperature sequences
+ *             EVT_MODE_BOTH  EVTMG3, TOF_DIFF and temperature sequences
+ *             The Gecko only wakes once per sequence to drain the averages.
+ ******************************************************************************/
+#define EVT_MODE_OFF         0
+#define EVT_MODE_TOF         1
+#define EVT_MODE_TEMP        2
+#define EVT_MODE_BOTH        3
+#ifndef EVT_MODE_DEFAULT
+#define EVT_MODE_DEFAULT     EVT_MODE_OFF
+#endif
+
+const uint8_t evt_commands[4] = { HALT, EVTMG1, EVTMG2, EVTMG3 };
+
+volatile uint8_t evt_mode = EVT_MODE_DEFAULT;
+
+/* @var EVT_TIMEOUT_MS  Restart event timing if no sequence completes in time */
+#define EVT_TIMEOUT_MS       20000
+
+/*******************************************************************************
+ * @var evt_regs
+ * @abstract Registers drained once per event timing sequence
+ * @discussion The sequence averages land in the same slots as a single
+ *             measurement, so the regular formatting applies.
+ ******************************************************************************/
+#define EVT_REGS             15
+
+const MAX_RegDescr_t evt_regs[EVT_REGS] = {
+    MAX_DESCR_INT_STAT,
+    MAX_DESCR_TOF_DIFF_AVG,
+    MAX_DESCR_RTC,
+    MAX_DESCR_TEMP_AVG
+};
+
+/*******************************************************************************
+ * @var max_devices
+ * @abstract One entry per MAX35103 on the USART1 bus
+ * @discussion Every front end has its own chip select, driven by the
+ *             application so the burst engine can toggle it from its DMA
+ *             descriptor chain, and its own INT line. INT pin numbers must all
+ *             differ since they share the 16 external interrupt lines. Buffers,
+ *             decoded slots and the configuration shadow are per device, the
+ *             bursts are shared, see max_bursts:
+ *             rx           Result burst receive buffer, see above
+ *             tempRx       Temperature burst receive buffer
+ *             slots        Decoded register values, indexed by MAX_SLOT_*.
+ *                          Slots not in the list of a burst keep their value,
+ *                          so T1..T4 always hold the last temperature results.
+ *             tempFresh    T1..T4 changed since the last sample was queued
+ *             shadow       What is actually in the device configuration
+ *             flashDue     Written with commit set, TX_CONFIG_FLASH still
+ *                          to be queued
+ *             state        MAX_DEV_*, started is the wall clock tick it was
+ *                          entered, for the supervision timer
+ *             acqPending   acq_mode the queued result burst was built for
+ *             readoutDue   Result burst still to be queued, the SPI queue was
+ *                          full
+ ******************************************************************************/
+#ifndef MAX_DEVICES
+#define MAX_DEVICES          1
+#endif
+
+#if MAX_DEVICES > 4
+#error "Pins are only assigned for up to 4 MAX35103"
+#endif
+
+#define MAX_DEV_IDLE         0   // waiting for the scheduler
+#define MAX_DEV_CONVERTING   1   // measurement or event sequence running
+#define MAX_DEV_READOUT      2   // INT seen, result burst queued
+
+typedef struct {
+    GPIO_Port_TypeDef csPort;
+    uint8_t csPin;
+    GPIO_Port_TypeDef intPort;
+    uint8_t intPin;
+
+    MAX_Word_t rx[SPI_RX_BUF_LENGTH];
+    MAX_Word_t tempRx[TEMP_REGS];
+
+    int32_t slots[MAX_SLOTS];
+    MAX_Config_t shadow;
+    bool flashDue;
+
+    uint16_t flowCount;
+    volatile uint8_t measPending;
+    volatile uint8_t acqPending;
+    volatile uint8_t state;
+    volatile bool recover;
+    volatile bool tempFresh;
+    volatile bool readoutDue;
+    volatile uint32_t started;
+} MAX_Device_t;
+
+MAX_Device_t max_devices[MAX_DEVICES] = {
+    { gpioPortD, 3, gpioPortD, 4 },     // USART1 location 1 CS pin
+#if MAX_DEVICES > 1
+    { gpioPortD, 5, gpioPortD, 6 },
+#endif
+#if MAX_DEVICES > 2
+    { gpioPortD, 7, gpioPortC, 8 },
+#endif
+#if MAX_DEVICES > 3
+    { gpioPortC, 9, gpioPortC, 10 },
+#endif
+};
+
+#define MAX_INT_MASK(dev)       (1 << (dev)->intPin)
+#define MAX_INDEX(dev)          ((dev) - max_devices)
+
+/*******************************************************************************
+ * @var max_bursts
+ * @abstract Prepared register bursts, one per list for all devices
+ * @discussion Only one burst is on the bus at a time, so the devices share
+ *             them. The SPI queue points a burst at the chip select and
+ *             receive buffer of the device it reads right before it starts,
+ *             see MAX_Burst_Target(). Storage is sized to each list, 6.6 KB in
+ *             all whatever MAX_DEVICES is.
+ ******************************************************************************/
+struct {
+    MAX_Burst_t meas[ACQ_MODE_HITS];    // ACQ_MODE_HITS reads with the FULL one
+    MAX_Burst_t temp;
+    MAX_Burst_t evt;
+    DMA_DESCRIPTOR_TypeDef tofStore[MAX_BURST_STORAGE_LENGTH(MEAS_REGS_TOF)];
+    DMA_DESCRIPTOR_TypeDef fullStore[MAX_BURST_STORAGE_LENGTH(MEAS_REGS_FULL)];
+    DMA_DESCRIPTOR_TypeDef flowStore[MAX_BURST_STORAGE_LENGTH(MEAS_REGS_FLOW)];
+    DMA_DESCRIPTOR_TypeDef tempStore[MAX_BURST_STORAGE_LENGTH(TEMP_REGS)];
+    DMA_DESCRIPTOR_TypeDef evtStore[MAX_BURST_STORAGE_LENGTH(EVT_REGS)];
+} max_bursts;
+
+/* @var MAX_RAM_BUDGET  Bytes of the 32 KB RAM bursts and device state may take */
+#ifndef MAX_RAM_BUDGET
+#define MAX_RAM_BUDGET       8192
+#endif
+
+_Static_assert(sizeof(max_bursts) + sizeof(max_devices) <= MAX_RAM_BUDGET,
+               "MAX35103 bursts and device state exceed MAX_RAM_BUDGET");
+
+/*******************************************************************************
+ * @var max_active
+ * @abstract Conversions allowed to run at the same time
+ * @discussion MAX_Schedule() starts idle devices in round-robin order until
+ *             max_active of them are converting. The default lets every path
+ *             run freely. 1 fires the paths strictly one after another, for
+ *             paths that hear each other. Even then the readout of one device
+ *             overlaps the conversion of the next.
+ ******************************************************************************/
+#ifndef MAX_ACTIVE_DEFAULT
+#define MAX_ACTIVE_DEFAULT   MAX_DEVICES
+#endif
+
+volatile uint8_t max_active = MAX_ACTIVE_DEFAULT;
+volatile uint32_t sched_idle;
+volatile uint32_t sched_due = (1 << MAX_DEVICES) - 1;
+volatile uint8_t sched_converting;
+uint8_t sched_next;
+
+#define MAX_CS_LOW(dev)         GPIO_PinOutClear((dev)->csPort, (dev)->csPin)
+#define MAX_CS_HIGH(dev)        GPIO_PinOutSet((dev)->csPort, (dev)->csPin)
+
+// MAX SPI Transfer, blocking, only used before the measurement loop starts
+#define MAX_SPI_TX_Config(dev,x) { MAX_CS_LOW(dev); SPIDRV_MTransmitB(spi_handle, x, 3); MAX_CS_HIGH(dev); }
+#define MAX_SPI_TX(dev,x)        { MAX_CS_LOW(dev); SPIDRV_MTransmitB(spi_handle, x, 1); MAX_CS_HIGH(dev); }
+#define MAX_SPI_RX(dev,x)        { MAX_CS_LOW(dev); SPIDRV_MReceiveB(spi_handle, x, 1); MAX_CS_HIGH(dev); }
+#define MAX_SPI_TXRX(dev,x,y)    { MAX_CS_LOW(dev); SPIDRV_MTransferB(spi_handle, x, y, 3); MAX_CS_HIGH(dev); }
+
+
+/*******************************************************************************
+ * @function    MAX_Queue_Command()
+ * @abstract    Queue a single byte execution opcode (TOF_DIFF, TEMPERATURE, ...)
+ *
+ * @return      false if the SPI queue is full
+ ******************************************************************************/
+bool MAX_Queue_Command(MAX_Device_t *dev, uint8_t opcode)
+{
+    SPIQ_Transaction_t t = { { opcode }, 1, NULL, NULL, dev->csPort, dev->csPin, NULL, NULL };
+    return SPIQ_Submit(&t);
+}
+
+/*******************************************************************************
+ * @function    MAX_Queue_Write()
+ * @abstract    Queue a 16 bit register write
+ *
+ * @return      false if the SPI queue is full
+ ******************************************************************************/
+bool MAX_Queue_Write(MAX_Device_t *dev, uint8_t opcode, uint16_t value)
+{
+    SPIQ_Transaction_t t = { { opcode, value >> 8, value & 0xFF }, 3, NULL, NULL,
+                             dev->csPort, dev->csPin, NULL, NULL };
+    return SPIQ_Submit(&t);
+}
 
-// MAX SPI Transfer
-#define MAX_SPI_TX_Config(x)    SPIDRV_MTransmitB(spi_handle, x, 3);
-#define MAX_SPI_TX(x)           SPIDRV_MTransmitB(spi_handle, x, 1);
-#define MAX_SPI_RX(x)           SPIDRV_MReceiveB(spi_handle, x, 1);
-#define MAX_SPI_TXRX(x,y)       SPIDRV_MTransferB(spi_handle, x, y, 3);
+/*******************************************************************************
+ * @function    MAX_Queue_Burst()
+ * @abstract    Queue a register burst read of dev into rx, done runs with dev
+ *              once it has completed
+ *
+ * @return      false if the SPI queue is full
+ ******************************************************************************/
+bool MAX_Queue_Burst(MAX_Device_t *dev, MAX_Burst_t *burst, MAX_Word_t *rx, SPIQ_Callback_t done)
+{
+    SPIQ_Transaction_t t = { { 0 }, 0, (uint8_t *)rx, burst, dev->csPort, dev->csPin, done, dev };
+    return SPIQ_Submit(&t);
+}
 
 
 /* ----- UART Declarations ----- */
@@ -71,84 +403,390 @@ DEFINE_BUF_QUEUE(EMDRV_UARTDRV_MAX_CONCURRENT_TX_BUFS, txBufferQueue);
 UARTDRV_HandleData_t uart_handleData;
 UARTDRV_Handle_t uart_handle = &uart_handleData;
 
-#ifdef SAVE_HEX_DATA
+#define UART_TX_HEX_LENGTH 14
+/*******************************************************************************
+ * @var uart_tx_hex_buffer
+ * @abstract Stores information received from the MAX board
+ * @discussion The measurements and values from the MAX board are stored in the
+ *             address locations:
+ *             uart_rx_buffer[0]  TOF Int
+ *             uart_rx_buffer[1]  Delimiter
+ *             uart_rx_buffer[2]  TOF Frac
+ *             uart_rx_buffer[3]  Delimiter
+ *             uart_rx_buffer[4]  RTC Month_Year
+ *             uart_rx_buffer[5]  Delimiter
+ *             uart_rx_buffer[6]  RTC Day_Date
+ *             uart_rx_buffer[7]  Delimiter
+ *             uart_rx_buffer[8]  RTC Min_Hours
+ *             uart_rx_buffer[9]  Delimiter
+ *             uart_rx_buffer[10] RTC Seconds
+ *             uart_rx_buffer[11] Delimiter
+ *             uart_rx_buffer[12] Device index
+ *             uart_rx_buffer[13] Delimiter
+ *             Points into the uart_tx_ring slot being formatted.
+ ******************************************************************************/
+uint32_t *uart_tx_hex_buffer;
+uint32_t delimiter = 0x00000020;
+
+#define UART_TX_BUF_LENGTH 37
+/*******************************************************************************
+ * @var uart_tx_buffer
+ * @abstract Stores information received from the MAX board
+ * @discussion The measurements and values from the MAX board are stored in the
+ *             address locations:
+ *             uart_tx_buffer[0]     10 Month
+ *             uart_tx_buffer[1]     Month
+ *             uart_tx_buffer[2]     '/'
+ *             uart_tx_buffer[3]     10 Date
+ *             uart_tx_buffer[4]     Date
+ *             uart_tx_buffer[5]     '/'
+ *             uart_tx_buffer[6]     10 Year
+ *             uart_tx_buffer[7]     Year
+ *             uart_tx_buffer[8]     '\t'
+ *             uart_tx_buffer[9]     10 Hour
+ *             uart_tx_buffer[10]    Hour
+ *             uart_tx_buffer[11]    ':'
+ *             uart_tx_buffer[12]    10 Minute
+ *             uart_tx_buffer[13]    Minute
+ *             uart_tx_buffer[14]    ':'
+ *             uart_tx_buffer[15]    10 Seconds
+ *             uart_tx_buffer[16]    Seconds
+ *             uart_tx_buffer[17]    ':'max
+ *             uart_tx_buffer[18]    Tenths of Seconds
+ *             uart_tx_buffer[19]    Hundredths of Seconds
+ *             uart_tx_buffer[20]    '\t'
+ *             uart_tx_buffer[21]    Device index
+ *             uart_tx_buffer[22]    '\t'
+ *             uart_tx_buffer[23:34] TOF Diff in ps, right aligned
+ *             uart_tx_buffer[35]    '\n'
+ *             uart_tx_buffer[36]    '\r'
+ *             Points into the uart_tx_ring slot being formatted.
+ ******************************************************************************/
+uint8_t *uart_tx_buffer;
 
-    #define UART_TX_BUF_LENGTH 12
-    /*******************************************************************************
-     * @var uart_tx_buffer
-     * @abstract Stores information received from the MAX board
-     * @discussion The measurements and values from the MAX board are stored in the
-     *             address locations:
-     *             uart_rx_buffer[0]  TOF Int
-     *             uart_rx_buffer[1]  Delimiter
-     *             uart_rx_buffer[2]  TOF Frac
-     *             uart_rx_buffer[3]  Delimiter
-     *             uart_rx_buffer[4]  RTC Month_Year
-     *             uart_rx_buffer[5]  Delimiter
-     *             uart_rx_buffer[6]  RTC Day_Date
-     *             uart_rx_buffer[7]  Delimiter
-     *             uart_rx_buffer[8]  RTC Min_Hours
-     *             uart_rx_buffer[9]  Delimiter
-     *             uart_rx_buffer[10] RTC Seconds
-     *             uart_rx_buffer[11] Delimiter
-     ******************************************************************************/
-     uint32_t uart_tx_buffer[UART_TX_BUF_LENGTH];
-     uint32_t delimiter = 0x00000020;
+/*******************************************************************************
+ * @var full_record
+ * @abstract Binary record sent per measurement in ACQ_MODE_FULL
+ * @discussion Sync bytes and device index followed by the 2 data bytes of
+ *             every register in list order, MSB first as read from the MAX
+ *             board:
+ *             full_record[0:1]   FULL_RECORD_SYNC
+ *             full_record[2]     Device index
+ *             full_record[3:76]  Registers of meas_regs
+ *             full_record[77:92] Last T1..T4 Int/Frac of temp_regs
+ ******************************************************************************/
+#define FULL_RECORD_SYNC        0xA55A
+#define FULL_RECORD_LENGTH      (3 + 2 * MEAS_REGS_FULL + 2 * (TEMP_REGS - 1))
 
-#else
+/*******************************************************************************
+ * @var uart_batch
+ * @abstract TOF samples collected in the open uart_tx_ring slot
+ * @discussion Up to batch_size samples of one format share a slot and go out
+ *             with a single UARTDRV_Transmit() and callback. Text lines are
+ *             simply concatenated. Binary samples collect in bin_record and
+ *             are framed together, one CRC, COBS code and delimiter per batch,
+ *             the host splits the record every BIN_RECORD_LENGTH bytes. A batch
+ *             is sent once full, once its first sample is batch_latency_ms old
+ *             (0 waits for a full batch) or as soon as anything else needs a
+ *             slot. batch_size 1 sends every sample on its own.
+ *             count     Samples in the open slot, 0 if none is open
+ *             format    out_format of the open slot, BATCH_FLOW for
+ *                       flow_record
+ *             expired   Latency timer fired, sent from the main loop
+ ******************************************************************************/
+#ifndef BATCH_MAX
+#define BATCH_MAX               16
+#endif
+#ifndef BATCH_SIZE_DEFAULT
+#define BATCH_SIZE_DEFAULT      1
+#endif
+#define BATCH_LATENCY_DEFAULT   50
+#define BATCH_FLOW              3
+
+volatile uint8_t batch_size = BATCH_SIZE_DEFAULT;
+volatile uint16_t batch_latency_ms = BATCH_LATENCY_DEFAULT;
+
+struct {
+    uint8_t count;
+    uint8_t format;
+    volatile bool expired;
+} uart_batch;
+
+/*******************************************************************************
+ * @var bin_record
+ * @abstract Compact record sent per sample in OUT_FORMAT_BIN
+ * @discussion Big endian, COBS encoded into a uart_tx_ring slot by
+ *             FRAME_Encode(), 16 bytes on the line instead of 37 for ASCII:
+ *             bin_record[0]      Device index
+ *             bin_record[1]      Sequence number from sample_seq
+ *             bin_record[2:5]    Wall clock ticks (32768 Hz) at readout
+ *             bin_record[6:9]    TOF Diff, Q16.16 in 250 ns periods
+ *             bin_record[10:11]  Interrupt Status Register
+ *             bin_record[12:13]  CRC16, appended by FRAME_Encode()
+ *             sample_seq counts every sample taken, including those dropped
+ *             before they could be sent, so a gap shows a loss. The samples
+ *             of a batch follow each other before the CRC, see uart_batch.
+ ******************************************************************************/
+#define BIN_RECORD_LENGTH       12
+
+/*******************************************************************************
+ * @var temp_report
+ * @abstract Water temperature of a device, sent in OUT_FORMAT_BIN
+ * @discussion Only a sample carrying new T1..T4 has one, so it goes out in a
+ *             frame of its own right after the batch holding that sample,
+ *             11 bytes on the line once per temp_ratio samples:
+ *             temp_record[0]      TEMP_RECORD_TAG, no device has that index
+ *             temp_record[1]      Device index
+ *             temp_record[2]      Sequence number of the sample
+ *             temp_record[3:6]    Water temperature, m degrees C, see
+ *                                 MAX_RtdTemperature()
+ *             temp_record[7:8]    CRC16, appended by FRAME_Encode()
+ *             due     Sent from the main loop once a slot is free
+ ******************************************************************************/
+#define TEMP_RECORD_TAG         0xFC
+#define TEMP_RECORD_LENGTH      7
+
+struct {
+    uint8_t record[TEMP_RECORD_LENGTH + FRAME_CRC_LENGTH];
+    bool due;
+} temp_report;
+
+/*******************************************************************************
+ * @var flow_record
+ * @abstract Record sent per sample in ACQ_MODE_FLOW, whatever out_format is
+ * @discussion Collects in bin_record and is framed and batched like it:
+ *             flow_record[0]      FLOW_RECORD_TAG, no device has that index
+ *             flow_record[1]      Device index
+ *             flow_record[2]      Sequence number from sample_seq
+ *             flow_record[3:6]    Wall clock ticks (32768 Hz) at readout
+ *             flow_record[7:10]   TOF Diff, Q16.16 in 250 ns periods
+ *             flow_record[11:14]  Velocity, um/s, positive downstream
+ *             flow_record[15:18]  Flow rate, uL/s
+ *             flow_record[19:22]  Water temperature, m degrees C
+ *             flow_record[23:24]  Interrupt Status Register
+ *             Velocity and flow rate are FLOW_INVALID (0x80000000) if the
+ *             transit times do not fit the geometry, see FLOW_Compute(), the
+ *             temperature is SOUND_NO_TEMP (0x80000000) before the first RTD
+ *             reading of the device or out of range.
+ ******************************************************************************/
+#define FLOW_RECORD_TAG         0xFD
+#define FLOW_RECORD_LENGTH      25
+
+uint8_t bin_record[FLOW_RECORD_LENGTH * BATCH_MAX + FRAME_CRC_LENGTH];
+uint8_t sample_seq;
+
+/*******************************************************************************
+ * @var flow_geometry
+ * @abstract Geometry FLOW_Configure() takes at reset
+ * @discussion An axial 100 mm path in a 20 mm bore. The offset is the mean
+ *             hit of the default profile, 7.5 periods of a 1 MHz transducer
+ *             into the received wave, in 250 ns periods.
+ ******************************************************************************/
+const FLOW_Geometry_t flow_geometry = { 100000, 0, 20000, 30 << 16 };
+
+/*******************************************************************************
+ * @var flow_temp
+ * @abstract Water temperature at each device, from its last RTD reading
+ * @discussion m degrees C, SOUND_NO_TEMP until the first reading. Updated in
+ *             the main loop by every sample carrying new T1..T4, every flow
+ *             sample is compensated with it, see FLOW_Compute().
+ ******************************************************************************/
+int32_t flow_temp[MAX_DEVICES];
+
+/*******************************************************************************
+ * @var tof_filter
+ * @abstract Filter stage of each device, see filter.h
+ * @discussion Every sample but those of ACQ_MODE_FULL has its TOF difference
+ *             replaced by the filtered one in the main loop, before it is
+ *             formatted, summarized, turned into flow or totalized. Set by
+ *             HOST_CMD_FILTER, TOF_FILTER_DEFAULT at reset.
+ ******************************************************************************/
+#ifndef TOF_FILTER_DEFAULT
+#define TOF_FILTER_DEFAULT      FILTER_NONE
+#define TOF_FILTER_PARAM        0
+#endif
+
+FILTER_t tof_filter[MAX_DEVICES];
+
+/*******************************************************************************
+ * @var hampel_k
+ * @abstract Outlier threshold of ACQ_MODE_HITS in 0.1 standard deviations
+ * @discussion A hit whose TOF difference is further than that from the median
+ *             of the measurement, the deviation estimated from the MAD, is
+ *             left out of its TOF difference, see HAMPEL_Diff(). 0 averages
+ *             every hit. Set by HOST_CMD_HAMPEL.
+ ******************************************************************************/
+#ifndef HAMPEL_K_DEFAULT
+#define HAMPEL_K_DEFAULT        30
+#endif
+
+volatile uint8_t hampel_k = HAMPEL_K_DEFAULT;
+
+/*******************************************************************************
+ * @var RTD_R0_OHM/RTD_REF_OHM
+ * @abstract RTD resistance at 0 degrees C and the reference resistor next to
+ *           it, a PT1000 against 1 kOhm on the board
+ ******************************************************************************/
+#ifndef RTD_R0_OHM
+#define RTD_R0_OHM              1000
+#endif
+#ifndef RTD_REF_OHM
+#define RTD_REF_OHM             1000
+#endif
+
+/*******************************************************************************
+ * @var meas_stats
+ * @abstract Per device statistics over a reporting interval
+ * @discussion With stats_interval_ms set, every sample goes into tof of its
+ *             device on its way out and, if it carries new T1..T4, its water
+ *             temperature into temp. Every stats_interval_ms a summary record per
+ *             device is sent and its accumulators start over. stats_raw false
+ *             stops sending the samples themselves, only the summaries remain.
+ *             Summaries are framed like bin_record whatever out_format is:
+ *             stats_record[0]      STATS_RECORD_TAG, no device has that index
+ *             stats_record[1]      Device index
+ *             stats_record[2:5]    Wall clock ticks (32768 Hz) at the end of
+ *                                  the interval
+ *             stats_record[6:25]   TOF Diff, Q16.16 in 250 ns periods, see
+ *                                  STATS_Put()
+ *             stats_record[26:45]  Water temperature, m degrees C, see
+ *                                  MAX_RtdTemperature()
+ *             stats_record[46:47]  CRC16, appended by FRAME_Encode()
+ *             due     Interval timer fired, summaries go out from the main
+ *                     loop starting with device next
+ ******************************************************************************/
+#define STATS_RECORD_TAG        0xFE
+#define STATS_RECORD_LENGTH     (6 + 2 * STATS_PUT_LENGTH)
+#define STATS_INTERVAL_DEFAULT  0
+
+volatile uint16_t stats_interval_ms = STATS_INTERVAL_DEFAULT;
+volatile bool stats_raw = true;
 
-    #define UART_TX_BUF_LENGTH 35
-    /*******************************************************************************
-     * @var uart_tx_buffer
-     * @abstract Stores information received from the MAX board
-     * @discussion The measurements and values from the MAX board are stored in the
-     *             address locations:
-     *             uart_tx_buffer[0]     10 Month
-     *             uart_tx_buffer[1]     Month
-     *             uart_tx_buffer[2]     '/'
-     *             uart_tx_buffer[3]     10 Date
-     *             uart_tx_buffer[4]     Date
-     *             uart_tx_buffer[5]     '/'
-     *             uart_tx_buffer[6]     10 Year
-     *             uart_tx_buffer[7]     Year
-     *             uart_tx_buffer[8]     '\t'
-     *             uart_tx_buffer[9]     10 Hour
-     *             uart_tx_buffer[10]    Hour
-     *             uart_tx_buffer[11]    ':'
-     *             uart_tx_buffer[12]    10 Minute
-     *             uart_tx_buffer[13]    Minute
-     *             uart_tx_buffer[14]    ':'
-     *             uart_tx_buffer[15]    10 Seconds
-     *             uart_tx_buffer[16]    Seconds
-     *             uart_tx_buffer[17]    ':'max
-     *             uart_tx_buffer[18]    Tenths of Seconds
-     *             uart_tx_buffer[19]    Hundredths of Seconds
-     *             uart_tx_buffer[20]    '\t'
-     *             uart_tx_buffer[21:32] TOF Diff
-     *             uart_tx_buffer[33]    '\n'
-     *             uart_tx_buffer[34]    '\r'
-     ******************************************************************************/
-    uint8_t uart_tx_buffer[UART_TX_BUF_LENGTH];
+struct {
+    STATS_Acc_t tof[MAX_DEVICES];
+    STATS_Acc_t temp[MAX_DEVICES];
+    volatile bool due;
+    uint8_t next;
+} meas_stats;
+
+/*******************************************************************************
+ * @var meas_total
+ * @abstract Per device volume totals, see total.h
+ * @discussion Every ACQ_MODE_FLOW sample goes into acc of its device, any
+ *             other sample pauses it. Once TOTAL_CHECKPOINT_MS have passed
+ *             since the last checkpoint and anything changed, the main loop
+ *             writes one as it goes through the samples, no timer has to wake
+ *             it. HOST_CMD_TOTAL can write one right away. After a reset the
+ *             totals go on from the last checkpoint.
+ *             saved   Wall clock tick of the last checkpoint
+ ******************************************************************************/
+#ifndef TOTAL_CHECKPOINT_MS
+#define TOTAL_CHECKPOINT_MS     600000
+#endif
+
+#if MAX_DEVICES > TOTAL_ACC_MAX
+#error "Every device needs a totalizer in the checkpoint record"
+#endif
+
+struct {
+    TOTAL_Acc_t acc[MAX_DEVICES];
+    bool dirty;
+    uint32_t saved;
+} meas_total;
+
+/*******************************************************************************
+ * @var uart_tx_ring
+ * @abstract Frame slots handed to the UART DMA while they are sent
+ * @discussion The main loop formats a frame in place in slot[tail] and passes
+ *             it to UARTDRV_Transmit(), which sends its buffers in order.
+ *             callback_UARTTX() gives slot[head] back once it has left. Only
+ *             the main loop writes tail and only the callback writes head, both
+ *             run freely and tail - head slots are in flight. Formatting the
+ *             next sample thus overlaps sending the previous ones, and no
+ *             slot is written while the DMA still reads it.
+ *             With every slot in flight the UART is the bottleneck. Samples
+ *             then wait in sample_queue and are counted in its dropped once
+ *             that is full too. dropped here counts frames UARTDRV refused.
+ ******************************************************************************/
+#define UART_TX_SLOTS           4   // power of 2
+
+#if UART_TX_SLOTS > EMDRV_UARTDRV_MAX_CONCURRENT_TX_BUFS || UART_TX_SLOTS > LEUART_TX_DEPTH
+#error "Every TX slot must fit the UARTDRV and LEUART transmit queues"
+#endif
+
+#if UART_TX_HEX_LENGTH * 4 * BATCH_MAX > LEUART_TX_MAX
+#error "A full batch must fit one LEUART DMA cycle"
 #endif
 
+typedef union {
+    uint8_t text[UART_TX_BUF_LENGTH * BATCH_MAX];
+    uint32_t hex[UART_TX_HEX_LENGTH * BATCH_MAX];
+    uint8_t full[FULL_RECORD_LENGTH];
+    uint8_t bin[FRAME_LENGTH(FLOW_RECORD_LENGTH * BATCH_MAX)];
+    uint8_t reply[FRAME_LENGTH(HOST_REPLY_MAX_LENGTH)];
+    uint8_t stats[FRAME_LENGTH(STATS_RECORD_LENGTH)];
+    uint8_t temp[FRAME_LENGTH(TEMP_RECORD_LENGTH)];
+} UART_TxSlot_t;
+
+struct {
+    UART_TxSlot_t slot[UART_TX_SLOTS];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+    volatile uint32_t dropped;
+} uart_tx_ring;
+
 /* ----- RTC Declarations ----- */
 RTCDRV_TimerID_t rtc_id;
 
+/* @var MEAS_TIMEOUT_MS  Recover a device if no INT arrives in time */
+#define MEAS_TIMEOUT_MS 100
 
 /*******************************************************************************
- * @function    MAX_Init()
- * @abstract    Initialize MAX35103 settings
- * @discussion  Set up TOF1/2/3/4/5/6/7 registers and initialize MAX board
- *
- * @return      void
+ * @var supervise
+ * @abstract Deadline the one-shot supervision timer rtc_id is armed for
+ * @discussion The timer is only running while a device is busy and fires at
+ *             the earliest started plus timeout among them, see
+ *             MAX_Supervise(). armed is false once it fired or was stopped.
  ******************************************************************************/
-void MAX_Init()
-{
-	spi_tx_buffer[0] = RESET;            // Initialize
-	MAX_SPI_TX(&spi_tx_buffer[0]);
+struct {
+    bool armed;
+    uint32_t deadline;
+} supervise;
+
+void callback_RTC( RTCDRV_TimerID_t id, void * user );
+
+/*******************************************************************************
+ * @var meas_period_ms
+ * @abstract Time between the measurements of a device, 0 for back to back
+ * @discussion Every period the pacing timer marks all devices due in
+ *             sched_due, MAX_Schedule() only starts devices that are idle and
+ *             due. Temperature measurements take their turn like any other.
+ *             Without a period every device is always due and converts as
+ *             fast as it is read out. Event timing paces itself through
+ *             EVT_TIMING1 instead.
+ ******************************************************************************/
+#ifndef MEAS_PERIOD_DEFAULT
+#define MEAS_PERIOD_DEFAULT     0
+#endif
+
+volatile uint16_t meas_period_ms = MEAS_PERIOD_DEFAULT;
+RTCDRV_TimerID_t period_id;
+
+/* @var batch_id  Latency timer of the open uart_batch */
+RTCDRV_TimerID_t batch_id;
+
+/* @var stats_id  Interval timer of meas_stats */
+RTCDRV_TimerID_t stats_id;
 
-    /* ----- Begin configuration register setup ----- */
 
+/*******************************************************************************
+ * @var max_profile
+ * @abstract Configuration the MAX35103 should run with
+ * @discussion Values in MAX_CFG_* order, the same for every device.
+ *             MAX_Device_t.shadow mirrors what is actually in each device, only
+ *             registers that differ from it are ever written.
+ ******************************************************************************/
+MAX_Config_t max_profile = { {
     /***************************************************************************
      * TOF1 Register - basic operating parameters for TOF measurements
      * TOF1[15:8]   Pulse Launcher Size
@@ -157,10 +795,7 @@ void MAX_Init()
      * TOF1[2]      Reserved (No effect)
      * TOF1[1:0]    Bias Charge Time
      **************************************************************************/
-    spi_tx_config_buffer[0] = WRITE_TOF1;
-    spi_tx_config_buffer[1] = 0x0C;
-    spi_tx_config_buffer[2] = 0x10;
-    MAX_SPI_TX_Config(&spi_tx_config_buffer[0]);
+    0x0C10,
 
     /***************************************************************************
      * TOF2 Register - details of how TOF will be measured
@@ -170,10 +805,7 @@ void MAX_Init()
      * TOF2[3]      Reserved (No effect)
      * TOF2[2:0]    Timeout
      **************************************************************************/
-    spi_tx_config_buffer[0] = WRITE_TOF2;
-    spi_tx_config_buffer[1] = 0xA1;
-    spi_tx_config_buffer[2] = 0x00;
-    MAX_SPI_TX_Config(&spi_tx_config_buffer[0]);
+    0xA100,
 
     /***************************************************************************
      * TOF3 Register - select which waves will be used in time measurements
@@ -182,10 +814,7 @@ void MAX_Init()
      * TOF3[7:6]    Reserved
      * TOF3[5:0]    HIT2 Wave Select
      **************************************************************************/
-    spi_tx_config_buffer[0] = WRITE_TOF3;
-    spi_tx_config_buffer[1] = 0x05;
-    spi_tx_config_buffer[2] = 0x06;
-    MAX_SPI_TX_Config(&spi_tx_config_buffer[0]);
+    0x0506,
 
     /***************************************************************************
      * TOF4 Register - select which waves will be used in time measurements
@@ -194,10 +823,7 @@ void MAX_Init()
      * TOF4[7:6]    Reserved
      * TOF4[5:0]    HIT4 Wave Select
      **************************************************************************/
-    spi_tx_config_buffer[0] = WRITE_TOF4;
-    spi_tx_config_buffer[1] = 0x07;
-    spi_tx_config_buffer[2] = 0x08;
-    MAX_SPI_TX_Config(&spi_tx_config_buffer[0]);
+    0x0708,
 
     /***************************************************************************
      * TOF5 Register - select which waves will be used in time measurements
@@ -206,40 +832,36 @@ void MAX_Init()
      * TOF5[7:6]    Reserved
      * TOF5[5:0]    HIT6 Wave Select
      **************************************************************************/
-    spi_tx_config_buffer[0] = WRITE_TOF5;
-    spi_tx_config_buffer[1] = 0x09;
-    spi_tx_config_buffer[2] = 0x0A;
-    MAX_SPI_TX_Config(&spi_tx_config_buffer[0]);
+    0x090A,
 
     /***************************************************************************
      * TOF6 Register - comparator upstream
      * TOF6[15:8]   Comparator Return Offset Upstream
      * TOF6[7:0]    Comparator Offset Upstream
      **************************************************************************/
-    spi_tx_config_buffer[0] = WRITE_TOF6;
-    spi_tx_config_buffer[1] = 0x23;
-    spi_tx_config_buffer[2] = 0x0A;
-    MAX_SPI_TX_Config(&spi_tx_config_buffer[0]);
+    0x230A,
 
     /***************************************************************************
      * TOF7 Register - comparator downstream
      * TOF7[15:8]   Comparator Return Offset Downstream
      * TOF7[7:0]    Comparator Offset Downstream
      **************************************************************************/
-    spi_tx_config_buffer[0] = WRITE_TOF7;
-    spi_tx_config_buffer[1] = 0x23;
-    spi_tx_config_buffer[2] = 0x0A;
-    MAX_SPI_TX_Config(&spi_tx_config_buffer[0]);
+    0x230A,
+
+    /***************************************************************************
+     * Event Timing 1 Register - sequence timing for the event timing modes
+     * EVT1[15:12]  TOF_DIFF Measurement Period
+     * EVT1[11:7]   TOF_DIFF Measurements per Sequence
+     * EVT1[6:1]    Temperature Measurement Period
+     **************************************************************************/
+    0x1488,
 
     /***************************************************************************
      * TOF Measurement Delay - delay between start of pulse launch and receiver
      *                         enable
      * DLY[15:8]    Delay
      **************************************************************************/
-    spi_tx_config_buffer[0] = WRITE_TOF_MEAS_DELAY;
-    spi_tx_config_buffer[1] = 0x00;
-    spi_tx_config_buffer[2] = 0xC8;
-    MAX_SPI_TX_Config(&spi_tx_config_buffer[0]);
+    0x00C8,
 
     /***************************************************************************
      * Calibration and Control Register - calibration settings
@@ -250,29 +872,118 @@ void MAX_Init()
      * CLBRT[4:2]   Preamble Temperature Cycle
      * CLBRT[1:0]   Port Cycle Time
      **************************************************************************/
-    spi_tx_config_buffer[0] = WRITE_CLBRT_CTRL;
-    spi_tx_config_buffer[1] = 0x0F;
-    spi_tx_config_buffer[2] = 0xDF;
-    MAX_SPI_TX_Config(&spi_tx_config_buffer[0]);
+    0x0FDF
+} };
+
+/*******************************************************************************
+ * @function    MAX_Init()
+ * @abstract    Initialize MAX35103 settings
+ * @discussion  After RESET the MAX35103 loads its configuration from flash.
+ *              Read it back into the device shadow, write only the registers
+ *              that differ from max_profile and only commit to the
+ *              configuration flash when something actually changed.
+ *
+ * @param       dev     Device to bring up
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_Init(MAX_Device_t *dev)
+{
+    uint8_t rx[3];
+    uint32_t changed;
+    uint32_t i;
 
+	spi_tx_buffer[0] = RESET;            // Initialize
+	MAX_SPI_TX(dev, &spi_tx_buffer[0]);
+
+    for(i = 0; i < MAX_CFG_REGS; i++) {
+        spi_tx_config_buffer[0] = max_config_read_opcodes[i];
+        spi_tx_config_buffer[1] = 0x00;
+        spi_tx_config_buffer[2] = 0x00;
+        MAX_SPI_TXRX(dev, &spi_tx_config_buffer[0], &rx[0]);
+        dev->shadow.word[i] = (rx[1] << 8) | rx[2];
+    }
 
-    /* ----- End configuration register setup ----- */
+    changed = MAX_Config_Diff(&dev->shadow, &max_profile);
+    for(i = 0; i < MAX_CFG_REGS; i++) {
+        if(changed & (1 << i)) {
+            spi_tx_config_buffer[0] = MAX_CFG_WRITE_OPCODE(i);
+            spi_tx_config_buffer[1] = max_profile.word[i] >> 8;
+            spi_tx_config_buffer[2] = max_profile.word[i] & 0xFF;
+            MAX_SPI_TX_Config(dev, &spi_tx_config_buffer[0]);
+            dev->shadow.word[i] = max_profile.word[i];
+        }
+    }
 
-    spi_tx_buffer[0] = TX_CONFIG_FLASH;       // Transfer Configuration to Flash Command
-    MAX_SPI_TX(&spi_tx_buffer[0]);
+    if(changed) {
+        spi_tx_buffer[0] = TX_CONFIG_FLASH;       // Transfer Configuration to Flash Command
+        MAX_SPI_TX(dev, &spi_tx_buffer[0]);
+    }
 
     spi_tx_buffer[0] = INITIALIZE;            // Initialize
-    MAX_SPI_TX(&spi_tx_buffer[0]);
+    MAX_SPI_TX(dev, &spi_tx_buffer[0]);
+}
+
+/*******************************************************************************
+ * @function    MAX_Config_Apply()
+ * @abstract    Reconfigure the running MAX35103 devices
+ * @discussion  Queues writes for the registers of profile that differ from
+ *              the shadow of each device, nothing else. With commit set the
+ *              new configuration is also stored in the configuration flash,
+ *              again only if anything changed. The shadow only takes the
+ *              writes that got into the SPI queue, and a device is only
+ *              committed once all of its writes are in, so calling it again
+ *              with the same profile queues exactly what is missing.
+ *
+ * @param       profile  Wanted configuration
+ * @param       commit   Issue TX_CONFIG_FLASH after the writes
+ *
+ * @return      false if the SPI queue was full before everything was queued
+ ******************************************************************************/
+#if SPIQ_DEPTH - 1 < MAX_CFG_REGS + 2
+#error "SPIQ_DEPTH must hold a full configuration change next to a readout"
+#endif
+
+bool MAX_Config_Apply(const MAX_Config_t *profile, bool commit)
+{
+    MAX_Device_t *dev;
+    uint32_t changed;
+    uint32_t i;
+
+    for(dev = max_devices; dev < max_devices + MAX_DEVICES; dev++) {
+        changed = MAX_Config_Diff(&dev->shadow, profile);
+
+        for(i = 0; i < MAX_CFG_REGS; i++) {
+            if(changed & (1 << i)) {
+                if(!MAX_Queue_Write(dev, MAX_CFG_WRITE_OPCODE(i), profile->word[i])) {
+                    return false;
+                }
+                dev->shadow.word[i] = profile->word[i];
+            }
+        }
+
+        dev->flashDue |= changed && commit;
+        if(dev->flashDue) {
+            if(!MAX_Queue_Command(dev, TX_CONFIG_FLASH)) {
+                return false;
+            }
+            dev->flashDue = false;
+        }
+    }
+    return true;
 }
 
 /*******************************************************************************
  * @function    SPI_Init()
  * @abstract    Set up SPI
- * @discussion  SPI transfer between Wonder Gecko and MAX35103
+ * @discussion  SPI transfer between Wonder Gecko and the MAX35103 devices
  *
  * @return      void
  ******************************************************************************/
 void SPI_Init() {
+    uint8_t opcodes[SPI_RX_BUF_LENGTH];
+    MAX_Device_t *dev;
+
     SPIDRV_Init_t initData = {                                                        \
               USART1,                       /* USART port                       */    \
               _USART_ROUTE_LOCATION_LOC1,   /* USART pins location number       */    \
@@ -282,12 +993,46 @@ void SPI_Init() {
               spidrvMaster,                 /* SPI mode                         */    \
               spidrvBitOrderMsbFirst,       /* Bit order on bus                 */    \
               spidrvClockMode1,             /* SPI clock/phase mode             */    \
-              spidrvCsControlAuto,          /* CS controlled by the driver      */    \
+              spidrvCsControlApplication,   /* CS controlled by the application */    \
               spidrvSlaveStartImmediate     /* Slave start transfers immediately*/    \
     };
 
     // Initialize a SPI driver instance
     SPIDRV_Init( spi_handle, &initData );
+
+    // Chip selects idle high
+    for(dev = max_devices; dev < max_devices + MAX_DEVICES; dev++) {
+        GPIO_PinModeSet(dev->csPort, dev->csPin, gpioModePushPull, 1);
+    }
+
+    // Measurement loop accesses are queued and chained from completion callbacks
+    SPIQ_Init(spi_handle);
+
+    // All per-measurement register reads go out as one DMA burst. The bursts
+    // are built for the first device, the queue retargets them per readout.
+    MAX_Burst_Init(USART1, DMAREQ_USART1_TXEMPTY, DMAREQ_USART1_RXDATAV);
+    dev = max_devices;
+
+    MAX_Regs_Opcodes(meas_regs, MEAS_REGS_FULL, opcodes);
+    MAX_Burst_Build(&max_bursts.meas[ACQ_MODE_TOF], max_bursts.tofStore,
+                    MAX_BURST_STORAGE_LENGTH(MEAS_REGS_TOF), opcodes, MEAS_REGS_TOF,
+                    dev->rx, dev->csPort, dev->csPin);
+    MAX_Burst_Build(&max_bursts.meas[ACQ_MODE_FULL], max_bursts.fullStore,
+                    MAX_BURST_STORAGE_LENGTH(MEAS_REGS_FULL), opcodes, MEAS_REGS_FULL,
+                    dev->rx, dev->csPort, dev->csPin);
+
+    MAX_Regs_Opcodes(flow_regs, MEAS_REGS_FLOW, opcodes);
+    MAX_Burst_Build(&max_bursts.meas[ACQ_MODE_FLOW], max_bursts.flowStore,
+                    MAX_BURST_STORAGE_LENGTH(MEAS_REGS_FLOW), opcodes, MEAS_REGS_FLOW,
+                    dev->rx, dev->csPort, dev->csPin);
+
+    MAX_Regs_Opcodes(temp_regs, TEMP_REGS, opcodes);
+    MAX_Burst_Build(&max_bursts.temp, max_bursts.tempStore, MAX_BURST_STORAGE_LENGTH(TEMP_REGS),
+                    opcodes, TEMP_REGS, dev->tempRx, dev->csPort, dev->csPin);
+
+    MAX_Regs_Opcodes(evt_regs, EVT_REGS, opcodes);
+    MAX_Burst_Build(&max_bursts.evt, max_bursts.evtStore, MAX_BURST_STORAGE_LENGTH(EVT_REGS),
+                    opcodes, EVT_REGS, dev->rx, dev->csPort, dev->csPin);
 }
 
 
@@ -319,7 +1064,28 @@ void UART_Init() {
 	UARTDRV_InitUart(uart_handle, &uartInitData);
 }
 
-// Function required for non-blocking transmit
+/*******************************************************************************
+ * @function    UART_TxClaim()
+ * @abstract    Next free uart_tx_ring slot, to be filled and passed to UART_TxSend()
+ *
+ * @return      NULL if every slot is in flight
+ ******************************************************************************/
+UART_TxSlot_t *UART_TxClaim()
+{
+    uint8_t tail = uart_tx_ring.tail;
+
+    if((uint8_t)(tail - uart_tx_ring.head) >= UART_TX_SLOTS) {
+        return NULL;
+    }
+    return &uart_tx_ring.slot[tail & (UART_TX_SLOTS - 1)];
+}
+
+bool UART_TxFree()
+{
+    return (uint8_t)(uart_tx_ring.tail - uart_tx_ring.head) < UART_TX_SLOTS;
+}
+
+// Function required for non-blocking transmit, the oldest slot has been sent
 void callback_UARTTX(UARTDRV_Handle_t handle,
                            Ecode_t transferStatus,
                            uint8_t *data,
@@ -329,219 +1095,1538 @@ void callback_UARTTX(UARTDRV_Handle_t handle,
   (void)transferStatus;
   (void)data;
   (void)transferCount;
+
+  uart_tx_ring.head++;
+  SLEEP_SleepBlockEnd(sleepEM2);
 }
 
-// Function required for non-blocking receive
-void callback_UARTRX(UARTDRV_Handle_t handle,
-                           Ecode_t transferStatus,
-                           uint8_t *data,
-                           UARTDRV_Count_t transferCount)
+// Same for LEUART0
+void callback_LEUARTTX(uint8_t *data, uint32_t count)
 {
-    (void)handle;
-    (void)transferStatus;
-    (void)data;
-    (void)transferCount;
-}
+  (void)data;
+  (void)count;
 
+  uart_tx_ring.head++;
+}
 
-void callback_RTC( RTCDRV_TimerID_t id, void * user )
+// Command bytes from the host on LEUART0, also in EM2
+void callback_LEUARTRX(uint8_t byte)
 {
-    (void) user; // unused argument
-
-    // TOF Interrupt (bit 12)
-    if((0x10 & spi_rx_buffer[1]) == 0x10) {
-
-        // Read data from MAX board registers
-        pollRTC();
-        pollTOF();
-
-        #ifdef SAVE_HEX_DATA
-            // Convert data into hex format
-            processRTC_HEX();
-            processTOF_HEX();
-        #else
-            // Convert data into ASCII format
-            processRTC_ASCII();
-            processTOF_ASCII();
-        #endif
-
-        // Send each register individually
-        // TODO: Include delimiter in uart_TX buffer and send all registers at once
-        //       Potentially will fix bug where last two registers are not properly transmitted
-        UARTDRV_Transmit(uart_handle, uart_tx_buffer, sizeof(uint32_t) * UART_TX_BUF_LENGTH, callback_UARTTX);
-        //for(int i = 0; i < UART_TX_BUF_LENGTH; i++) {
-        //    UARTDRV_Transmit(uart_handle, &uart_tx_buffer[i], sizeof(uint32_t), callback_UARTTX);
-        //    UARTDRV_Transmit(uart_handle, &delimiter, sizeof(uint8_t), callback_UARTTX);
-        //}
-
-        // Reset interrupt
-        spi_rx_buffer[1] = 0x00;
-        GPIO_IntEnable(0x0010);
-
-        // Make new TOF measurement
-        spi_tx_buffer[0] = TOF_DIFF;
-        MAX_SPI_TX(&spi_tx_buffer[0]);
+    HOST_CMD_Byte(byte);
+}
 
+/*******************************************************************************
+ * @function    UART_TxSend()
+ * @abstract    Hand the slot returned by UART_TxClaim() to the UART DMA
+ * @discussion  A frame on USART0 holds off EM2 until it has left.
+ *
+ * @param       length  Bytes of the slot to send
+ *
+ * @return      void
+ ******************************************************************************/
+void UART_TxSend(uint32_t length)
+{
+    UART_TxSlot_t *slot = &uart_tx_ring.slot[uart_tx_ring.tail & (UART_TX_SLOTS - 1)];
+
+    // The callback may run before UARTDRV_Transmit() returns, so the slot is
+    // in flight first
+    uart_tx_ring.tail++;
+    if(out_port == OUT_PORT_LEUART) {
+        if(!LEUART_TX_Transmit((uint8_t *)slot, length)) {
+            uart_tx_ring.tail--;
+            uart_tx_ring.dropped++;
+        }
     }
     else {
-        spi_tx_buffer[0] = READ_INT_STAT_REG;
-        MAX_SPI_TXRX(&spi_tx_buffer[0], &spi_rx_buffer[0]);
+        SLEEP_SleepBlockBegin(sleepEM2);
+        if(UARTDRV_Transmit(uart_handle, (uint8_t *)slot, length, callback_UARTTX) != ECODE_OK) {
+            SLEEP_SleepBlockEnd(sleepEM2);
+            uart_tx_ring.tail--;
+            uart_tx_ring.dropped++;
+        }
     }
-
 }
 
-void GPIOINT_callback(void) {
-    // TODO Multiple interrupts on EVEN_IRQHandler
-
-    GPIO_IntDisable(0x0010);
-
-    spi_tx_buffer[0] = READ_INT_STAT_REG;
-    MAX_SPI_TXRX(&spi_tx_buffer[0], &spi_rx_buffer[0]);      // Read status register
-
-    GPIO_IntClear(0x0010);
+/*******************************************************************************
+ * @function    UART_TxDrain()
+ * @abstract    Wait until every uart_tx_ring slot has been sent
+ * @discussion  Slots are given back in order, so out_port may only change
+ *              while none is in flight.
+ *
+ * @return      void
+ ******************************************************************************/
+void UART_TxDrain()
+{
+    CORE_DECLARE_IRQ_STATE;
+
+    while(true) {
+        CORE_ENTER_ATOMIC();
+        if(uart_tx_ring.tail == uart_tx_ring.head) {
+            CORE_EXIT_ATOMIC();
+            return;
+        }
+        SLEEP_Sleep();
+        CORE_EXIT_ATOMIC();
+    }
 }
 
-
 /*******************************************************************************
- * @function    setupGPIOInt()
- * @abstract    Enable GPIO Interrupts
- * @discussion
+ * @function    UART_SetPort()
+ * @abstract    Move the output to another OUT_PORT_*
+ * @discussion  OUT_PORT_UART holds off EM2 for as long as it is selected, so
+ *              that USART0 keeps receiving host commands. With
+ *              OUT_PORT_LEUART they have to come in on LEUART0 RX.
+ *
+ * @param       port    OUT_PORT_*
  *
  * @return      void
  ******************************************************************************/
-void setupGPIOInt() {
-
-    GPIO_PinModeSet(gpioPortD, 4, gpioModeInput, 1);  // MAX Interrupt
-    GPIO_ExtIntConfig(gpioPortD, 4, 4, true, true, true);
+void UART_SetPort(uint8_t port)
+{
+    UART_TxDrain();
+    if(port == out_port) {
+        return;
+    }
+    if(port == OUT_PORT_UART) {
+        SLEEP_SleepBlockBegin(sleepEM2);
+    }
+    else if(out_port == OUT_PORT_UART) {
+        SLEEP_SleepBlockEnd(sleepEM2);
+    }
+    out_port = port;
+}
 
-    GPIOINT_Init();
-    GPIOINT_CallbackRegister(4, (GPIOINT_IrqCallbackPtr_t) GPIOINT_callback);
+// Command bytes from the host, one per buffer, queued again right away
+void callback_UARTRX(UARTDRV_Handle_t handle,
+                           Ecode_t transferStatus,
+                           uint8_t *data,
+                           UARTDRV_Count_t transferCount)
+{
+    (void)transferCount;
 
-    GPIO_IntEnable(0x0010);
+    if(transferStatus == ECODE_OK) {
+        HOST_CMD_Byte(*data);
+    }
+    UARTDRV_Receive(handle, data, 1, callback_UARTRX);
 }
 
 
-void pollRTC() {
-	spi_tx_buffer[0] = READ_RTC_M_Y;
-    MAX_SPI_TXRX(&spi_tx_buffer[0] , &spi_rx_buffer[9]);
+/* ----- Formatting, see below ----- */
+void processRTC_HEX(const int32_t *slots);
+void processTOF_HEX(const int32_t *slots);
+void processHEX_Delimiters();
+void processASCII_Delimiters();
+void processFULL_BIN(const SMPQ_Sample_t *s, uint8_t *out);
+void processTOF_BIN(const SMPQ_Sample_t *s, uint8_t *record);
+void processFLOW_BIN(const SMPQ_Sample_t *s, uint8_t *record);
+void processRTC_ASCII(const int32_t *slots);
+void processTOF_ASCII(const int32_t *slots);
+
+/*******************************************************************************
+ * @function    UART_BatchFlush()
+ * @abstract    Send the open uart_batch, if any
+ *
+ * @return      void
+ ******************************************************************************/
+void UART_BatchFlush()
+{
+    UART_TxSlot_t *slot = UART_TxClaim();
+    uint32_t length;
 
-	spi_tx_buffer[0] = READ_RTC_DAY_DATE;
-    MAX_SPI_TXRX(&spi_tx_buffer[0] , &spi_rx_buffer[12]);
+    if(!uart_batch.count) {
+        return;
+    }
 
-	spi_tx_buffer[0] = READ_RTC_MIN_HRS;
-    MAX_SPI_TXRX(&spi_tx_buffer[0] , &spi_rx_buffer[15]);
+    RTCDRV_StopTimer(batch_id);
+    if(uart_batch.format == OUT_FORMAT_BIN) {
+        length = FRAME_Encode(bin_record, uart_batch.count * BIN_RECORD_LENGTH, slot->bin);
+    }
+    else if(uart_batch.format == BATCH_FLOW) {
+        length = FRAME_Encode(bin_record, uart_batch.count * FLOW_RECORD_LENGTH, slot->bin);
+    }
+    else if(uart_batch.format == OUT_FORMAT_HEX) {
+        length = uart_batch.count * sizeof(slot->hex[0]) * UART_TX_HEX_LENGTH;
+    }
+    else {
+        length = uart_batch.count * UART_TX_BUF_LENGTH;
+    }
+    uart_batch.count = 0;
 
-	spi_tx_buffer[0] = READ_RTC_SECS;
-    MAX_SPI_TXRX(&spi_tx_buffer[0] , &spi_rx_buffer[18]);
+    UART_TxSend(length);
 }
 
-void pollTOF() {
-	spi_tx_buffer[0] = TOF_DIFF_INT;
-    MAX_SPI_TXRX(&spi_tx_buffer[0], &spi_rx_buffer[3]);
+// Latency timer of the open batch, only flags it for the main loop
+void callback_Batch( RTCDRV_TimerID_t id, void * user )
+{
+    (void) id;   // unused argument
+    (void) user; // unused argument
+
+    uart_batch.expired = true;
+}
 
-    spi_tx_buffer[0] = TOF_DIFF_FRAC;
-    MAX_SPI_TXRX(&spi_tx_buffer[0], &spi_rx_buffer[6]);
+// Batch format a sample goes out in
+uint8_t MAX_SampleFormat(const SMPQ_Sample_t *s)
+{
+    return s->acq == ACQ_MODE_FLOW ? BATCH_FLOW : out_format;
 }
 
-void processRTC_HEX(){
-    uart_tx_buffer[4] = int16_2hex(*((uint16_t*)&spi_rx_buffer[10]));
-    uart_tx_buffer[6] = int16_2hex(*((uint16_t*)&spi_rx_buffer[13]));
-    uart_tx_buffer[8] = int16_2hex(*((uint16_t*)&spi_rx_buffer[16]));
-    uart_tx_buffer[10] = int16_2hex(*((uint16_t*)&spi_rx_buffer[19]));
+/*******************************************************************************
+ * @function    MAX_SendSample()
+ * @abstract    Send the TOF and RTC slots of a sample in the selected format
+ * @discussion  Formats straight into the open uart_batch, a free uart_tx_ring
+ *              slot opens a new one. The batch goes out once it holds
+ *              batch_size samples.
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_SendSample(const SMPQ_Sample_t *s)
+{
+    UART_TxSlot_t *slot = UART_TxClaim();
+    uint8_t n = uart_batch.count;
+
+    if(!n) {
+        uart_batch.format = MAX_SampleFormat(s);
+        uart_batch.expired = false;
+        if(batch_size > 1 && batch_latency_ms) {
+            RTCDRV_StartTimer(batch_id, rtcdrvTimerTypeOneshot, batch_latency_ms, callback_Batch, NULL);
+        }
+    }
+
+    if(uart_batch.format == OUT_FORMAT_BIN) {
+        processTOF_BIN(s, &bin_record[n * BIN_RECORD_LENGTH]);
+    }
+    else if(uart_batch.format == BATCH_FLOW) {
+        processFLOW_BIN(s, &bin_record[n * FLOW_RECORD_LENGTH]);
+    }
+    else if(uart_batch.format == OUT_FORMAT_HEX) {
+        // Convert data into hex format
+        uart_tx_hex_buffer = &slot->hex[n * UART_TX_HEX_LENGTH];
+        processHEX_Delimiters();
+        processRTC_HEX(s->slots);
+        processTOF_HEX(s->slots);
+        uart_tx_hex_buffer[12] = int16_2hex(s->device);
+    }
+    else {
+        // Convert data into ASCII format
+        uart_tx_buffer = &slot->text[n * UART_TX_BUF_LENGTH];
+        processASCII_Delimiters();
+        processRTC_ASCII(s->slots);
+        processTOF_ASCII(s->slots);
+        uart_tx_buffer[21] = '0' + s->device;
+    }
+
+    uart_batch.count = n + 1;
+    if(uart_batch.count >= batch_size) {
+        UART_BatchFlush();
+    }
 }
 
-void processTOF_HEX(){
-    uart_tx_buffer[0] = int16_2hex(*((uint16_t*)&spi_rx_buffer[4]));
-    uart_tx_buffer[2] = int16_2hex(*((uint16_t*)&spi_rx_buffer[7]));
+/*******************************************************************************
+ * @function    MAX_PushSample()
+ * @abstract    Queue the decoded slots of a device for the main loop
+ * @discussion  Only called from the burst callbacks, the single producer of
+ *              sample_queue. A full queue drops the sample.
+ *
+ * @param       dev     Device whose slots were just decoded
+ * @param       acq     ACQ_MODE_* of the register list decoded
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_PushSample(MAX_Device_t *dev, uint8_t acq)
+{
+    uint8_t seq = sample_seq++;
+    SMPQ_Sample_t *s = SMPQ_Claim();
+
+    energy.samples++;
+    if(!s) {
+        return;
+    }
+    s->device = MAX_INDEX(dev);
+    s->acq = acq;
+    s->temp = dev->tempFresh;
+    dev->tempFresh = false;
+    s->seq = seq;
+    s->ticks = RTCDRV_GetWallClockTicks32();
+    memcpy(s->slots, dev->slots, sizeof(s->slots));
+    SMPQ_Publish();
 }
 
-void processRTC_ASCII(){
-    // Bitwise operations to separate data in each register
-    uart_tx_buffer[0] = ((spi_rx_buffer[10] & 0x10) >> 4) + 0x30;   // 10 Month
-    uart_tx_buffer[1] = (spi_rx_buffer[10] & 0x0F) + 0x30;          // Month
-    uart_tx_buffer[3] = ((spi_rx_buffer[14] & 0x30) >> 4) + 0x30;   // 10 Date
-    uart_tx_buffer[4] = (spi_rx_buffer[14] & 0x0F) + 0x30;          // Date
-    uart_tx_buffer[6] = ((spi_rx_buffer[11] & 0xF0) >> 4) + 0x30;   // 10 Year
-    uart_tx_buffer[7] = (spi_rx_buffer[11] & 0x0F) + 0x30;          // Year
-	uart_tx_buffer[9] = ((spi_rx_buffer[17] & 0x30) >> 4) + 0x30;   // 10 Hour (tens digit stays the same regardless 12/24 hr)
-    if((spi_rx_buffer[17] & 0x40) == 0x40){                         // if 12 hour mode
-    	uart_tx_buffer[10] = (spi_rx_buffer[17] & 0x0F) + 0x32;      // Hour (add 2)
+/*******************************************************************************
+ * @function    MAX_RtdTemperature()
+ * @abstract    Water temperature of a sample from both RTD pairs
+ * @discussion  T2 / T1 and T4 / T3 in Q2.30, scaled by RTD_REF_OHM / RTD_R0_OHM,
+ *              are the resistances of the two RTDs over R0. Their mean goes
+ *              through SOUND_Temperature(). A pair without a valid reference
+ *              time is left out.
+ *
+ * @param       slots   Decoded slots holding T1..T4
+ *
+ * @return      m degrees C, SOUND_NO_TEMP without a valid pair
+ ******************************************************************************/
+int32_t MAX_RtdTemperature(const int32_t *slots)
+{
+    uint64_t sum = 0;
+    uint32_t pairs = 0;
+    uint32_t ref;
+    uint32_t i;
+
+    for(i = 0; i < 4; i += 2) {
+        ref = slots[MAX_SLOT_T + i];
+        if(ref) {
+            sum += ((uint64_t)(uint32_t)slots[MAX_SLOT_T + i + 1] << 30) / ref;
+            pairs++;
+        }
     }
-    else {                                                          // if 24 hour mode
-    	uart_tx_buffer[10] = (spi_rx_buffer[17] & 0x0F) + 0x30;      // Hour
+    if(!pairs) {
+        return SOUND_NO_TEMP;
     }
-    uart_tx_buffer[12] = ((spi_rx_buffer[16] & 0x70) >> 4) + 0x30;   // 10 Minute
-    uart_tx_buffer[13] = (spi_rx_buffer[16] & 0x0F) + 0x30;          // Minute
-    uart_tx_buffer[15] = ((spi_rx_buffer[20] & 0x70) >> 4) + 0x30;  // 10 Second
-    uart_tx_buffer[16] = (spi_rx_buffer[20] & 0x0F) + 0x30;         // Second
-    uart_tx_buffer[18] = ((spi_rx_buffer[19] & 0xF0) >> 4) + 0x30;  // Tenth of Second
-    uart_tx_buffer[19] = (spi_rx_buffer[19] & 0x0F) + 0x30;         // Hundredth of Second
+    sum = sum * RTD_REF_OHM / RTD_R0_OHM / pairs;
+    return sum > UINT32_MAX ? SOUND_NO_TEMP : SOUND_Temperature((uint32_t)sum);
 }
 
-void processTOF_ASCII(){
-	char tmp_buffer[12];
+// Interval timer of meas_stats, only flags it for the main loop
+void callback_Stats( RTCDRV_TimerID_t id, void * user )
+{
+    (void) id;   // unused argument
+    (void) user; // unused argument
+
+    meas_stats.due = true;
+}
+
+/*******************************************************************************
+ * @function    MAX_SetStats()
+ * @abstract    Change the statistics interval, the running one is discarded
+ *
+ * @param       ms      Reporting interval, 0 turns the statistics off
+ * @param       raw     Keep sending every sample, ignored without an interval
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_SetStats(uint16_t ms, bool raw)
+{
+    uint32_t i;
+
+    RTCDRV_StopTimer(stats_id);
+    for(i = 0; i < MAX_DEVICES; i++) {
+        STATS_Reset(&meas_stats.tof[i]);
+        STATS_Reset(&meas_stats.temp[i]);
+    }
+    meas_stats.due = false;
+    meas_stats.next = 0;
 
-	int16_t tofDiffInt = ((spi_rx_buffer[4] & 0x00FF) << 8) | (spi_rx_buffer[5] & 0x00FF);
-	uint16_t tofDiffFrac = ((spi_rx_buffer[7] & 0x00FF) << 8) | (spi_rx_buffer[8] & 0x00FF);
+    stats_interval_ms = ms;
+    stats_raw = raw || !ms;
+    if(ms) {
+        RTCDRV_StartTimer(stats_id, rtcdrvTimerTypePeriodic, ms, callback_Stats, NULL);
+    }
+}
 
-	float tofValue = (float) tofDiffInt;
-	float tofValueFrac = ((float) tofDiffFrac) / (65536);
-	tofValue += tofValueFrac;
+// Account a sample to the interval of its device
+void MAX_StatsAdd(const SMPQ_Sample_t *s)
+{
+    int32_t temp;
+
+    STATS_Add(&meas_stats.tof[s->device], s->slots[MAX_SLOT_TOF_DIFF]);
+    if(s->temp) {
+        temp = MAX_RtdTemperature(s->slots);
+        if(temp != SOUND_NO_TEMP) {
+            STATS_Add(&meas_stats.temp[s->device], temp);
+        }
+    }
+}
 
-	gcvt(tofValue, 12, tmp_buffer);
-	sprintf(&uart_tx_buffer[21], "%12s\n\r", tmp_buffer);
+// Account a sample to the totalizer of its device
+void MAX_TotalAdd(const SMPQ_Sample_t *s)
+{
+    if(s->acq != ACQ_MODE_FLOW) {
+        TOTAL_Pause(&meas_total.acc[s->device]);
+    }
+    else if(TOTAL_Add(&meas_total.acc[s->device], s->ticks, s->slots[MAX_SLOT_FLOW])) {
+        meas_total.dirty = true;
+    }
+}
+
+// Checkpoint every totalizer
+bool MAX_SaveTotals()
+{
+    meas_total.dirty = false;
+    meas_total.saved = RTCDRV_GetWallClockTicks32();
+    return TOTAL_Save(meas_total.acc, MAX_DEVICES);
+}
+
+/*******************************************************************************
+ * @function    MAX_CheckpointTotals()
+ * @abstract    Write the checkpoint once due, from the main loop
+ * @discussion  The totals only change with samples, which wake the main loop
+ *              anyway.
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_CheckpointTotals()
+{
+    if(meas_total.dirty &&
+       RTCDRV_GetWallClockTicks32() - meas_total.saved >= RTCDRV_MsecsToTicks(TOTAL_CHECKPOINT_MS)) {
+        MAX_SaveTotals();
+    }
+}
+
+/*******************************************************************************
+ * @function    MAX_SendStats()
+ * @abstract    Send the summary of a device and start its next interval
+ * @discussion  Needs a free uart_tx_ring slot.
+ *
+ * @param       device  Device index
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_SendStats(uint8_t device)
+{
+    uint8_t record[STATS_RECORD_LENGTH + FRAME_CRC_LENGTH];
+    uint32_t ticks = RTCDRV_GetWallClockTicks32();
+
+    record[0] = STATS_RECORD_TAG;
+    record[1] = device;
+    record[2] = ticks >> 24;
+    record[3] = ticks >> 16;
+    record[4] = ticks >> 8;
+    record[5] = ticks;
+    STATS_Put(&meas_stats.tof[device], &record[6]);
+    STATS_Put(&meas_stats.temp[device], &record[6 + STATS_PUT_LENGTH]);
+    STATS_Reset(&meas_stats.tof[device]);
+    STATS_Reset(&meas_stats.temp[device]);
+
+    UART_TxSend(FRAME_Encode(record, STATS_RECORD_LENGTH, UART_TxClaim()->stats));
+}
+
+/*******************************************************************************
+ * @function    MAX_ConditionSample()
+ * @abstract    Clean up the TOF difference of a sample and derive its flow
+ * @discussion  Runs exactly once per sample, the filters keep state.
+ *
+ * @param       s       Oldest queued sample
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_ConditionSample(SMPQ_Sample_t *s)
+{
+    if(s->temp) {
+        flow_temp[s->device] = MAX_RtdTemperature(s->slots);
+    }
+    if(s->acq == ACQ_MODE_HITS) {
+        // TOF2[15:13] Stop Hits, the device runs max_profile
+        HAMPEL_Diff(&s->slots[MAX_SLOT_HIT_UP], &s->slots[MAX_SLOT_HIT_DN],
+                    (max_profile.r.tof2 >> 13) + 1, hampel_k, &s->slots[MAX_SLOT_TOF_DIFF]);
+    }
+    if(s->acq != ACQ_MODE_FULL) {
+        s->slots[MAX_SLOT_TOF_DIFF] = FILTER_Add(&tof_filter[s->device],
+                                                 s->slots[MAX_SLOT_TOF_DIFF]);
+    }
+    if(s->acq == ACQ_MODE_FLOW) {
+        s->slots[MAX_SLOT_WATER] = flow_temp[s->device];
+        FLOW_Compute(s->slots[MAX_SLOT_TOF_DIFF], s->slots[MAX_SLOT_AVG_UP],
+                     s->slots[MAX_SLOT_AVG_DN], s->slots[MAX_SLOT_WATER],
+                     &s->slots[MAX_SLOT_VELOCITY], &s->slots[MAX_SLOT_FLOW]);
+    }
+}
+
+/*******************************************************************************
+ * @function    MAX_ReportTemp()
+ * @abstract    Prepare the temp_report of a sample carrying new T1..T4
+ * @discussion  Goes out from MAX_ProcessSamples() before the next sample.
+ *
+ * @param       s       Sample just sent in OUT_FORMAT_BIN, conditioned
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_ReportTemp(const SMPQ_Sample_t *s)
+{
+    uint32_t temp = flow_temp[s->device];
+
+    temp_report.record[0] = TEMP_RECORD_TAG;
+    temp_report.record[1] = s->device;
+    temp_report.record[2] = s->seq;
+    temp_report.record[3] = temp >> 24;
+    temp_report.record[4] = temp >> 16;
+    temp_report.record[5] = temp >> 8;
+    temp_report.record[6] = temp & 0xFF;
+    temp_report.due = true;
+}
+
+/*******************************************************************************
+ * @function    MAX_SamplesReady()
+ * @abstract    Whether MAX_ProcessSamples() has anything to do
+ *
+ * @return      true if a sample is queued and a uart_tx_ring slot is free or
+ *              not needed, the open batch is due, or the interval summaries
+ *              or a temp_report are due and a slot is free
+ ******************************************************************************/
+bool MAX_SamplesReady()
+{
+    if(uart_batch.expired) {
+        return true;
+    }
+    if(meas_stats.due || temp_report.due) {
+        return UART_TxFree();
+    }
+    return !SMPQ_Empty() && (UART_TxFree() || !stats_raw);
+}
+
+/*******************************************************************************
+ * @function    MAX_ProcessSamples()
+ * @abstract    Format and send the oldest queued sample, from the main loop
+ * @discussion  Up to UART_TX_SLOTS frames are in flight, so this keeps up with
+ *              the line as long as the main loop gets to run once per frame.
+ *              Also sends the open batch once its latency timer fired, the
+ *              summaries of meas_stats at the end of an interval and a due
+ *              temp_report.
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_ProcessSamples()
+{
+    SMPQ_Sample_t *s;
+
+    if(uart_batch.expired) {
+        uart_batch.expired = false;
+        UART_BatchFlush();
+    }
+
+    // No sample is accounted until every summary of the interval is out
+    if(meas_stats.due) {
+        UART_BatchFlush();
+        while(meas_stats.next < MAX_DEVICES) {
+            if(!UART_TxFree()) {
+                return;
+            }
+            MAX_SendStats(meas_stats.next++);
+        }
+        meas_stats.next = 0;
+        meas_stats.due = false;
+    }
+
+    // The temperature follows the batch of the sample that carried it
+    if(temp_report.due) {
+        UART_BatchFlush();
+        if(!UART_TxFree()) {
+            return;
+        }
+        UART_TxSend(FRAME_Encode(temp_report.record, TEMP_RECORD_LENGTH, UART_TxClaim()->temp));
+        temp_report.due = false;
+    }
+
+    if(!MAX_SamplesReady()) {
+        return;
+    }
+
+    s = SMPQ_Peek();
+
+    // A sample that can not join the open batch sends it first, and then waits
+    // for a free slot of its own
+    if(stats_raw && uart_batch.count &&
+       (s->acq == ACQ_MODE_FULL || uart_batch.format != MAX_SampleFormat(s))) {
+        UART_BatchFlush();
+        return;
+    }
+
+    MAX_ConditionSample(s);
+    if(!stats_raw) {
+        MAX_StatsAdd(s);
+        MAX_TotalAdd(s);
+        SMPQ_Release();
+        return;
+    }
+
+    if(s->acq == ACQ_MODE_FULL) {
+        processFULL_BIN(s, UART_TxClaim()->full);
+        UART_TxSend(FULL_RECORD_LENGTH);
+    }
+    else {
+        MAX_SendSample(s);
+        if(s->temp && MAX_SampleFormat(s) == OUT_FORMAT_BIN) {
+            MAX_ReportTemp(s);
+        }
+    }
+    if(stats_interval_ms) {
+        MAX_StatsAdd(s);
+    }
+    MAX_TotalAdd(s);
+    SMPQ_Release();
+}
+
+/*******************************************************************************
+ * @function    MAX_StartMeasurement()
+ * @abstract    Start the next TOF or temperature measurement of a device
+ * @discussion  Every temp_ratio-th measurement is a TEMPERATURE instead of a
+ *              TOF_DIFF. The MAX35103 pulls INT low once the measurement is
+ *              done. The supervision timer only steps in if that interrupt
+ *              never shows up. Only called from MAX_Schedule().
+ *
+ * @return      false if the SPI queue is full, the device is left idle
+ ******************************************************************************/
+bool MAX_StartMeasurement(MAX_Device_t *dev)
+{
+    bool temp = temp_ratio && dev->flowCount + 1 >= temp_ratio;
+
+    dev->state = MAX_DEV_CONVERTING;
+    dev->started = RTCDRV_GetWallClockTicks32();
+    dev->measPending = temp ? MEAS_TEMP : MEAS_TOF;
+
+    if(!MAX_Queue_Command(dev, temp ? TEMPERATURE : TOF_DIFF)) {
+        dev->state = MAX_DEV_IDLE;
+        return false;
+    }
+    dev->flowCount = temp ? 0 : dev->flowCount + 1;
+    return true;
+}
+
+/*******************************************************************************
+ * @function    MAX_Supervise()
+ * @abstract    Arm the supervision timer for the earliest device timeout
+ * @discussion  Called whenever a device may have started or gone idle. With
+ *              no device busy the timer stops, so an idle board or one waiting
+ *              for the next period does not wake for it. Re-arming writes the
+ *              RTC compare register through the 32 kHz domain, so by default a
+ *              deadline that moved later, as with every back to back
+ *              conversion, is left to the timer firing early, callback_RTC()
+ *              then arms it again. In event timing mode the deadline moves
+ *              once per sequence, there it is re-armed right away and the
+ *              timer never fires while the sequences keep coming.
+ *
+ * @param       later   Also re-arm if the earliest deadline moved later
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_Supervise(bool later)
+{
+    MAX_Device_t *dev;
+    uint32_t timeout = RTCDRV_MsecsToTicks(evt_mode == EVT_MODE_OFF ? MEAS_TIMEOUT_MS
+                                                                    : EVT_TIMEOUT_MS);
+    uint32_t deadline = 0;
+    uint32_t now;
+    bool busy = false;
+    CORE_DECLARE_IRQ_STATE;
+
+    CORE_ENTER_ATOMIC();
+    for(dev = max_devices; dev < max_devices + MAX_DEVICES; dev++) {
+        if(dev->state != MAX_DEV_IDLE &&
+           (!busy || (int32_t)(dev->started + timeout - deadline) < 0)) {
+            deadline = dev->started + timeout;
+            busy = true;
+        }
+    }
+
+    if(!busy) {
+        if(supervise.armed) {
+            RTCDRV_StopTimer(rtc_id);
+            supervise.armed = false;
+        }
+    }
+    else if(!supervise.armed || (int32_t)(deadline - supervise.deadline) < 0 ||
+            (later && deadline != supervise.deadline)) {
+        // Rounded up, callback_RTC() must find the device past its timeout
+        now = RTCDRV_GetWallClockTicks32();
+        RTCDRV_StartTimer(rtc_id, rtcdrvTimerTypeOneshot,
+                          (int32_t)(deadline - now) > 0 ? RTCDRV_TicksToMsec(deadline - now) + 1 : 1,
+                          callback_RTC, NULL);
+        supervise.armed = true;
+        supervise.deadline = deadline;
+    }
+    CORE_EXIT_ATOMIC();
+}
+
+void MAX_RetryQueue(void *user);
+
+/*******************************************************************************
+ * @function    MAX_Schedule()
+ * @abstract    Start idle devices until max_active are converting
+ * @discussion  Devices are taken round-robin from sched_next on, so no path
+ *              can starve the others. With meas_period_ms set, only devices
+ *              due in sched_due are started, once per period. Runs whenever a conversion ends or a
+ *              device becomes idle. In event timing mode the devices time
+ *              themselves and nothing is started here. A device that finds
+ *              the SPI queue full goes back to idle and due, the next queue
+ *              completion schedules again.
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_Schedule()
+{
+    uint32_t ready;
+    uint32_t i;
+    CORE_DECLARE_IRQ_STATE;
+
+    while(true) {
+        CORE_ENTER_ATOMIC();
+        ready = sched_idle & sched_due;
+        if(evt_mode != EVT_MODE_OFF || !ready || sched_converting >= max_active) {
+            CORE_EXIT_ATOMIC();
+            MAX_Supervise(false);
+            return;
+        }
+        for(i = sched_next; !(ready & (1 << i)); i = (i + 1) % MAX_DEVICES);
+        sched_idle &= ~(1 << i);
+        if(meas_period_ms) {
+            sched_due &= ~(1 << i);
+        }
+        sched_next = (i + 1) % MAX_DEVICES;
+        sched_converting++;
+        CORE_EXIT_ATOMIC();
+
+        if(!MAX_StartMeasurement(&max_devices[i])) {
+            // Hand its place back, MAX_RetryQueue() schedules again
+            CORE_ENTER_ATOMIC();
+            sched_idle |= 1 << i;
+            sched_due |= 1 << i;
+            sched_next = i;
+            sched_converting--;
+            CORE_EXIT_ATOMIC();
+
+            SPIQ_OnSpace(MAX_RetryQueue, NULL);
+            MAX_Supervise(false);
+            return;
+        }
+    }
+}
+
+/*******************************************************************************
+ * @function    MAX_ConversionDone()
+ * @abstract    A device stopped converting, its results are about to be read
+ * @discussion  Hands its place among the max_active conversions to the next
+ *              device.
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_ConversionDone(MAX_Device_t *dev)
+{
+    CORE_DECLARE_IRQ_STATE;
+
+    CORE_ENTER_ATOMIC();
+    if(dev->state == MAX_DEV_CONVERTING && evt_mode == EVT_MODE_OFF) {
+        sched_converting--;
+    }
+    dev->state = MAX_DEV_READOUT;
+    dev->started = RTCDRV_GetWallClockTicks32();
+    CORE_EXIT_ATOMIC();
+}
+
+/*******************************************************************************
+ * @function    MAX_DeviceIdle()
+ * @abstract    A device has been read out and may convert again
+ * @discussion  Ignored unless the device is in readout, so a late recovery
+ *              burst cannot start a device twice.
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_DeviceIdle(MAX_Device_t *dev)
+{
+    CORE_DECLARE_IRQ_STATE;
+
+    CORE_ENTER_ATOMIC();
+    if(dev->state != MAX_DEV_READOUT) {
+        CORE_EXIT_ATOMIC();
+        return;
+    }
+    dev->state = MAX_DEV_IDLE;
+    sched_idle |= 1 << MAX_INDEX(dev);
+    CORE_EXIT_ATOMIC();
+
+    MAX_Schedule();
+}
+
+/*******************************************************************************
+ * @function    callback_MeasBurst()
+ * @abstract    Handle a completed measurement burst
+ * @discussion  Runs from the SPI queue completion with the device as user.
+ *              Its rx buffer now holds the interrupt status together with the
+ *              TOF and RTC registers, so a finished TOF measurement is queued
+ *              for the main loop and the device handed back to the scheduler
+ *              right away, at the conversion rate of the MAX35103.
+ *
+ * @return      void
+ ******************************************************************************/
+void callback_MeasBurst(void *user)
+{
+    MAX_Device_t *dev = user;
+    uint16_t status = MAX_INT_STAT(dev->rx);
+    uint8_t acq = dev->acqPending;
+
+    if(status & INT_STAT_TOF) {
+        if(acq == ACQ_MODE_FLOW) {
+            MAX_Regs_Decode(flow_regs, MEAS_REGS_FLOW, dev->rx, dev->slots);
+        }
+        else {
+            MAX_Regs_Decode(meas_regs, acq == ACQ_MODE_TOF ? MEAS_REGS_TOF : MEAS_REGS_FULL,
+                            dev->rx, dev->slots);
+        }
+        MAX_PushSample(dev, acq);
+    }
+
+    // Reading the status released INT, rearm for the next falling edge
+    GPIO_IntClear(MAX_INT_MASK(dev));
+    GPIO_IntEnable(MAX_INT_MASK(dev));
+
+    // Make new measurement
+    if((status & (INT_STAT_TOF | INT_STAT_TO)) || dev->recover) {
+        dev->recover = false;
+        MAX_DeviceIdle(dev);
+    }
+}
+
+/*******************************************************************************
+ * @function    callback_TempBurst()
+ * @abstract    Handle a completed temperature burst
+ * @discussion  Only updates the T1..T4 slots of the device, its following
+ *              flow samples carry them.
+ *
+ * @return      void
+ ******************************************************************************/
+void callback_TempBurst(void *user)
+{
+    MAX_Device_t *dev = user;
+    uint16_t status = MAX_INT_STAT(dev->tempRx);
+
+    if(status & INT_STAT_TE) {
+        MAX_Regs_Decode(temp_regs, TEMP_REGS, dev->tempRx, dev->slots);
+        dev->tempFresh = true;
+    }
+
+    GPIO_IntClear(MAX_INT_MASK(dev));
+    GPIO_IntEnable(MAX_INT_MASK(dev));
+
+    if((status & (INT_STAT_TE | INT_STAT_TO)) || dev->recover) {
+        dev->recover = false;
+        MAX_DeviceIdle(dev);
+    }
+}
+
+/*******************************************************************************
+ * @function    MAX_StartEventTiming()
+ * @abstract    Hand measurement timing of a device to the MAX35103
+ * @discussion  Issues the EVTMG command of evt_mode, sequence timing comes
+ *              from EVT_TIMING1 in max_profile. The supervision timer allows
+ *              the longer EVT_TIMEOUT_MS per sequence.
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_StartEventTiming(MAX_Device_t *dev)
+{
+    dev->state = MAX_DEV_CONVERTING;
+    dev->started = RTCDRV_GetWallClockTicks32();
+
+    MAX_Queue_Command(dev, evt_commands[evt_mode]);
+}
+
+/*******************************************************************************
+ * @function    MAX_SetEventMode()
+ * @abstract    Switch between firmware and event timing driven measurements
+ *
+ * @param       mode    One of EVT_MODE_*
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_SetEventMode(uint8_t mode)
+{
+    MAX_Device_t *dev;
+
+    // Stop whatever sequence or measurement is running
+    for(dev = max_devices; dev < max_devices + MAX_DEVICES; dev++) {
+        MAX_Queue_Command(dev, HALT);
+        dev->state = MAX_DEV_IDLE;
+        dev->readoutDue = false;
+    }
+
+    evt_mode = mode;
+    sched_converting = 0;
+    if(mode == EVT_MODE_OFF) {
+        sched_idle = (1 << MAX_DEVICES) - 1;
+        MAX_Schedule();
+    }
+    else {
+        for(dev = max_devices; dev < max_devices + MAX_DEVICES; dev++) {
+            MAX_StartEventTiming(dev);
+        }
+        MAX_Supervise(true);
+    }
+}
+
+/*******************************************************************************
+ * @function    callback_Period()
+ * @abstract    Pacing timer, every meas_period_ms
+ * @discussion  Marks every device due, those still busy start as soon as they
+ *              are idle again.
+ *
+ * @return      void
+ ******************************************************************************/
+void callback_Period( RTCDRV_TimerID_t id, void * user )
+{
+    (void) id;   // unused argument
+    (void) user; // unused argument
+
+    sched_due = (1 << MAX_DEVICES) - 1;
+    MAX_Schedule();
+}
+
+/*******************************************************************************
+ * @function    MAX_SetPeriod()
+ * @abstract    Change the time between the measurements of a device
+ *
+ * @param       ms      New meas_period_ms, 0 for back to back
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_SetPeriod(uint16_t ms)
+{
+    RTCDRV_StopTimer(period_id);
+
+    meas_period_ms = ms;
+    sched_due = (1 << MAX_DEVICES) - 1;
+    if(ms) {
+        RTCDRV_StartTimer(period_id, rtcdrvTimerTypePeriodic, ms, callback_Period, NULL);
+    }
+    MAX_Schedule();
+}
+
+/*******************************************************************************
+ * @function    callback_EvtBurst()
+ * @abstract    Handle the burst drained after an event timing sequence
+ * @discussion  A finished TOF_DIFF sequence is queued like a single measurement
+ *              with the sequence average as TOF value. Temperature sequence
+ *              averages update the T1..T4 slots. Nothing has to be restarted, the
+ *              MAX35103 schedules the next sequence itself.
+ *
+ * @return      void
+ ******************************************************************************/
+void callback_EvtBurst(void *user)
+{
+    MAX_Device_t *dev = user;
+    uint16_t status = MAX_INT_STAT(dev->rx);
+
+    // Result registers keep the last sequence, so all of them are valid here
+    if(status & (INT_STAT_TOF_EVTMG | INT_STAT_TEMP_EVTMG)) {
+        MAX_Regs_Decode(evt_regs, EVT_REGS, dev->rx, dev->slots);
+    }
+    if(status & INT_STAT_TEMP_EVTMG) {
+        dev->tempFresh = true;
+    }
+
+    if(status & INT_STAT_TOF_EVTMG) {
+        MAX_PushSample(dev, ACQ_MODE_TOF);
+    }
+
+    GPIO_IntClear(MAX_INT_MASK(dev));
+    GPIO_IntEnable(MAX_INT_MASK(dev));
+
+    if(dev->recover) {
+        dev->recover = false;
+        MAX_StartEventTiming(dev);
+    }
+    else if(status & (INT_STAT_TOF_EVTMG | INT_STAT_TEMP_EVTMG)) {
+        dev->state = MAX_DEV_CONVERTING;
+        dev->started = RTCDRV_GetWallClockTicks32();
+    }
+    MAX_Supervise(true);
+}
+
+/*******************************************************************************
+ * @function    MAX_QueueReadout()
+ * @abstract    Queue the result burst of the running measurement of a device
+ * @discussion  If the SPI queue is full the device keeps readoutDue set and
+ *              MAX_RetryQueue() queues the burst from the next completion.
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_QueueReadout(MAX_Device_t *dev)
+{
+    bool queued;
+
+    if(evt_mode != EVT_MODE_OFF) {
+        queued = MAX_Queue_Burst(dev, &max_bursts.evt, dev->rx, callback_EvtBurst);
+    }
+    else if(dev->measPending == MEAS_TEMP) {
+        queued = MAX_Queue_Burst(dev, &max_bursts.temp, dev->tempRx, callback_TempBurst);
+    }
+    else {
+        dev->acqPending = acq_mode;
+        queued = MAX_Queue_Burst(dev, &max_bursts.meas[dev->acqPending == ACQ_MODE_HITS ?
+                                                       ACQ_MODE_FULL : dev->acqPending],
+                                 dev->rx, callback_MeasBurst);
+    }
+
+    dev->readoutDue = !queued;
+    if(!queued) {
+        SPIQ_OnSpace(MAX_RetryQueue, NULL);
+    }
+}
+
+/*******************************************************************************
+ * @function    MAX_RetryQueue()
+ * @abstract    Queue again what found the SPI queue full
+ * @discussion  Runs once from the next SPI queue completion, see SPIQ_OnSpace().
+ *              Readouts go first, they hand their devices back to the
+ *              scheduler. The refusals are counted in spi_queue.dropped.
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_RetryQueue(void *user)
+{
+    MAX_Device_t *dev;
+
+    (void) user; // unused argument
+
+    for(dev = max_devices; dev < max_devices + MAX_DEVICES; dev++) {
+        if(dev->readoutDue) {
+            MAX_QueueReadout(dev);
+        }
+    }
+    MAX_Schedule();
+}
+
+/*******************************************************************************
+ * @function    callback_RTC()
+ * @abstract    Supervision timer, at the earliest deadline of MAX_Supervise()
+ * @discussion  A device that has not raised INT within MEAS_TIMEOUT_MS
+ *              (EVT_TIMEOUT_MS in event timing mode) of starting, or has not
+ *              been handed back after its readout, is read out anyway and
+ *              restarted. The timer is then armed for the devices still busy.
+ *
+ * @return      void
+ ******************************************************************************/
+void callback_RTC( RTCDRV_TimerID_t id, void * user )
+{
+    MAX_Device_t *dev;
+    uint32_t now = RTCDRV_GetWallClockTicks32();
+    uint32_t timeout = RTCDRV_MsecsToTicks(evt_mode == EVT_MODE_OFF ? MEAS_TIMEOUT_MS
+                                                                    : EVT_TIMEOUT_MS);
+
+    (void) id;   // unused argument
+    (void) user; // unused argument
+
+    supervise.armed = false;
+    for(dev = max_devices; dev < max_devices + MAX_DEVICES; dev++) {
+        if(dev->state != MAX_DEV_IDLE && now - dev->started > timeout) {
+            // No INT since the last measurement, read the status anyway and restart
+            GPIO_IntDisable(MAX_INT_MASK(dev));
+            MAX_ConversionDone(dev);
+            dev->recover = true;
+            MAX_QueueReadout(dev);
+        }
+    }
+
+    MAX_Schedule();
+}
+
+void GPIOINT_callback(uint8_t pin) {
+    MAX_Device_t *dev;
+
+    for(dev = max_devices; dev < max_devices + MAX_DEVICES && dev->intPin != pin; dev++);
+    if(dev == max_devices + MAX_DEVICES) {
+        return;
+    }
+
+    GPIO_IntDisable(MAX_INT_MASK(dev));
+    GPIO_IntClear(MAX_INT_MASK(dev));
+
+    // Measurement finished. The next device goes onto the bus first so that it
+    // converts while this one is read out in one burst.
+    MAX_ConversionDone(dev);
+    MAX_Schedule();
+    MAX_QueueReadout(dev);
+}
+
+
+/*******************************************************************************
+ * @function    HOST_Execute()
+ * @abstract    Run a decoded command record from the host
+ * @discussion  See HOST_CMD_* for the records. Runs in the main loop, changes
+ *              that the interrupt handlers act on take effect with the next
+ *              measurement: a burst already queued finishes in the acquisition
+ *              mode it was built for. Register writes go out through
+ *              MAX_Config_Apply(), so only registers that actually change are
+ *              written and the flash only if asked to.
+ *
+ * @param       cmd         Record, opcode first
+ * @param       length      Record length
+ * @param       data        Receives what the reply carries after the status
+ * @param       dataLength  Set for commands whose reply carries data
+ *
+ * @return      HOST_STATUS_*
+ ******************************************************************************/
+uint8_t HOST_Execute(const uint8_t *cmd, uint32_t length, uint8_t *data, uint32_t *dataLength)
+{
+    uint32_t report[HOST_ENERGY_LENGTH / 4];
+    uint64_t ticks[ENERGY_MODES];
+    FLOW_Geometry_t geometry;
+    TOTAL_Acc_t *acc;
+    uint64_t volume[HOST_TOTAL_LENGTH / 8];
+    uint32_t i;
+    CORE_DECLARE_IRQ_STATE;
+
+    switch(cmd[0]) {
+    case HOST_CMD_PERIOD:
+        if(length != 3) {
+            return HOST_STATUS_BAD_ARG;
+        }
+        MAX_SetPeriod((cmd[1] << 8) | cmd[2]);
+        break;
+
+    case HOST_CMD_FORMAT:
+        if(length != 2 || cmd[1] > OUT_FORMAT_HEX) {
+            return HOST_STATUS_BAD_ARG;
+        }
+        out_format = cmd[1];
+        break;
+
+    case HOST_CMD_BATCH:
+        if(length != 4 || !cmd[1] || cmd[1] > BATCH_MAX) {
+            return HOST_STATUS_BAD_ARG;
+        }
+        batch_size = cmd[1];
+        batch_latency_ms = (cmd[2] << 8) | cmd[3];
+        break;
+
+    case HOST_CMD_PORT:
+        if(length != 2 || cmd[1] > OUT_PORT_LEUART) {
+            return HOST_STATUS_BAD_ARG;
+        }
+        // The reply already goes out on the new port
+        UART_SetPort(cmd[1]);
+        break;
+
+    case HOST_CMD_STATS:
+        if(length != 4) {
+            return HOST_STATUS_BAD_ARG;
+        }
+        MAX_SetStats((cmd[1] << 8) | cmd[2], cmd[3]);
+        break;
+
+    case HOST_CMD_ENERGY:
+        if(length != 1) {
+            return HOST_STATUS_BAD_ARG;
+        }
+        report[ENERGY_MODES] = ENERGY_Snapshot(ticks);
+        report[ENERGY_MODES + 1] = ENERGY_PerSample(ticks, report[ENERGY_MODES]);
+        for(i = 0; i < ENERGY_MODES; i++) {
+            report[i] = RTCDRV_TicksToMsec(ticks[i]);
+        }
+        for(i = 0; i < HOST_ENERGY_LENGTH; i++) {
+            data[i] = report[i / 4] >> (24 - 8 * (i % 4));
+        }
+        *dataLength = HOST_ENERGY_LENGTH;
+        break;
+
+    case HOST_CMD_ACQ:
+        if(length != 2 || cmd[1] >= ACQ_MODES) {
+            return HOST_STATUS_BAD_ARG;
+        }
+        acq_mode = cmd[1];
+        break;
+
+    case HOST_CMD_GEOMETRY:
+        if(length != HOST_GEOMETRY_LENGTH) {
+            return HOST_STATUS_BAD_ARG;
+        }
+        geometry.pathUm = HOST_CMD_Word(&cmd[1]);
+        geometry.angle = (cmd[5] << 8) | cmd[6];
+        geometry.diameterUm = HOST_CMD_Word(&cmd[7]);
+        geometry.offset = HOST_CMD_Word(&cmd[11]);
+        // The burst callbacks do not use the engine, only the main loop does
+        if(!FLOW_Configure(&geometry)) {
+            return HOST_STATUS_BAD_ARG;
+        }
+        break;
+
+    case HOST_CMD_FILTER:
+        if(length != 3) {
+            return HOST_STATUS_BAD_ARG;
+        }
+        // Only the main loop runs the filters, every device starts over
+        for(i = 0; i < MAX_DEVICES; i++) {
+            if(!FILTER_Configure(&tof_filter[i], cmd[1], cmd[2])) {
+                return HOST_STATUS_BAD_ARG;
+            }
+        }
+        break;
+
+    case HOST_CMD_HAMPEL:
+        if(length != 2) {
+            return HOST_STATUS_BAD_ARG;
+        }
+        hampel_k = cmd[1];
+        break;
+
+    case HOST_CMD_TOTAL:
+        if(length != 3 || cmd[1] >= MAX_DEVICES || cmd[2] > HOST_TOTAL_CLEAR) {
+            return HOST_STATUS_BAD_ARG;
+        }
+        acc = &meas_total.acc[cmd[1]];
+        if(cmd[2] == HOST_TOTAL_CLEAR) {
+            TOTAL_Clear(acc);
+        }
+        if(cmd[2] != HOST_TOTAL_READ && !MAX_SaveTotals()) {
+            return HOST_STATUS_FLASH;
+        }
+        volume[0] = acc->forward;
+        volume[1] = acc->reverse;
+        volume[2] = acc->forward - acc->reverse;
+        for(i = 0; i < HOST_TOTAL_LENGTH; i++) {
+            data[i] = volume[i / 8] >> (56 - 8 * (i % 8));
+        }
+        *dataLength = HOST_TOTAL_LENGTH;
+        break;
+
+    case HOST_CMD_EVENT:
+        if(length != 2 || cmd[1] > EVT_MODE_BOTH) {
+            return HOST_STATUS_BAD_ARG;
+        }
+        // Device states must not change under the INT and burst handlers
+        CORE_ENTER_ATOMIC();
+        MAX_SetEventMode(cmd[1]);
+        CORE_EXIT_ATOMIC();
+        break;
+
+    case HOST_CMD_REG:
+        if(length != 5 || cmd[1] >= MAX_CFG_REGS) {
+            return HOST_STATUS_BAD_ARG;
+        }
+        max_profile.word[cmd[1]] = (cmd[2] << 8) | cmd[3];
+        if(!MAX_Config_Apply(&max_profile, cmd[4])) {
+            return HOST_STATUS_BUSY;
+        }
+        break;
+
+    case HOST_CMD_PROFILE:
+        if(length != HOST_CMD_MAX_LENGTH) {
+            return HOST_STATUS_BAD_ARG;
+        }
+        for(i = 0; i < MAX_CFG_REGS; i++) {
+            max_profile.word[i] = (cmd[1 + 2 * i] << 8) | cmd[2 + 2 * i];
+        }
+        if(!MAX_Config_Apply(&max_profile, cmd[length - 1])) {
+            return HOST_STATUS_BUSY;
+        }
+        break;
+
+    default:
+        return HOST_STATUS_UNKNOWN;
+    }
+
+    return HOST_STATUS_OK;
+}
+
+/*******************************************************************************
+ * @function    HOST_CommandReady()
+ * @abstract    Whether HOST_ProcessCommand() has anything to do
+ *
+ * @return      true if a command is waiting and its reply has a free slot
+ ******************************************************************************/
+bool HOST_CommandReady()
+{
+    return host_cmd.ready && UART_TxFree();
+}
+
+/*******************************************************************************
+ * @function    HOST_ProcessCommand()
+ * @abstract    Run the waiting host command and send its reply, from the main
+ *              loop
+ *
+ * @return      void
+ ******************************************************************************/
+void HOST_ProcessCommand()
+{
+    uint8_t reply[HOST_REPLY_MAX_LENGTH + FRAME_CRC_LENGTH];
+    uint32_t dataLength = 0;
+    uint8_t *cmd;
+    uint32_t length;
+
+    if(!HOST_CommandReady()) {
+        return;
+    }
+
+    // The reply needs a slot of its own
+    if(uart_batch.count) {
+        UART_BatchFlush();
+        if(!UART_TxFree()) {
+            return;
+        }
+    }
+
+    length = HOST_CMD_Decode(&cmd);
+    reply[0] = HOST_CMD_REPLY;
+    reply[1] = length ? cmd[0] : 0;
+    reply[2] = length ? HOST_Execute(cmd, length, &reply[HOST_REPLY_LENGTH], &dataLength)
+                      : HOST_STATUS_BAD_FRAME;
+    HOST_CMD_Release();
+
+    UART_TxSend(FRAME_Encode(reply, HOST_REPLY_LENGTH + dataLength, UART_TxClaim()->reply));
+}
+
+/*******************************************************************************
+ * @function    processHEX_Delimiters()
+ * @abstract    Fixed characters between the fields of uart_tx_hex_buffer
+ * @discussion  Written for every frame, the uart_tx_ring slots are shared by
+ *              all formats.
+ *
+ * @return      void
+ ******************************************************************************/
+void processHEX_Delimiters(){
+    uart_tx_hex_buffer[1] = uart_tx_hex_buffer[3] = uart_tx_hex_buffer[5] = uart_tx_hex_buffer[7] = uart_tx_hex_buffer[9] = uart_tx_hex_buffer[11] = delimiter;
+    uart_tx_hex_buffer[13] = delimiter;
+}
+
+void processASCII_Delimiters(){
+    uart_tx_buffer[2] = uart_tx_buffer[5] = '/';
+    uart_tx_buffer[8] = uart_tx_buffer[20] = uart_tx_buffer[22] = 0x20;
+    uart_tx_buffer[11] = uart_tx_buffer[14] = uart_tx_buffer[17] = ':';
+    uart_tx_buffer[35] = '\n';
+    uart_tx_buffer[36] = '\r';
+}
+
+/*******************************************************************************
+ * @function    setupGPIOInt()
+ * @abstract    Enable GPIO Interrupts
+ * @discussion  One falling edge interrupt per device INT line, GPIOINT
+ *              dispatches on the pin number
+ *
+ * @return      void
+ ******************************************************************************/
+void setupGPIOInt() {
+    MAX_Device_t *dev;
+
+    GPIOINT_Init();
+
+    for(dev = max_devices; dev < max_devices + MAX_DEVICES; dev++) {
+        GPIO_PinModeSet(dev->intPort, dev->intPin, gpioModeInput, 1);  // MAX Interrupt
+        GPIO_ExtIntConfig(dev->intPort, dev->intPin, dev->intPin, false, true, false);   // INT is active low
+        GPIOINT_CallbackRegister(dev->intPin, GPIOINT_callback);
+        GPIO_IntEnable(MAX_INT_MASK(dev));
+    }
+}
+
+
+void processRTC_HEX(const int32_t *slots){
+    uart_tx_hex_buffer[4] = int16_2hex(slots[MAX_SLOT_RTC_M_Y]);
+    uart_tx_hex_buffer[6] = int16_2hex(slots[MAX_SLOT_RTC_DAY_DATE]);
+    uart_tx_hex_buffer[8] = int16_2hex(slots[MAX_SLOT_RTC_MIN_HRS]);
+    uart_tx_hex_buffer[10] = int16_2hex(slots[MAX_SLOT_RTC_SECS]);
+}
+
+void processTOF_HEX(const int32_t *slots){
+    uart_tx_hex_buffer[0] = int16_2hex((uint32_t)slots[MAX_SLOT_TOF_DIFF] >> 16);
+    uart_tx_hex_buffer[2] = int16_2hex(slots[MAX_SLOT_TOF_DIFF] & 0xFFFF);
+}
+
+void processFULL_BIN(const SMPQ_Sample_t *s, uint8_t *full_record){
+    uint32_t length = 3;
+
+    full_record[0] = FULL_RECORD_SYNC >> 8;
+    full_record[1] = FULL_RECORD_SYNC & 0xFF;
+    full_record[2] = s->device;
+
+    length += MAX_Regs_Pack(meas_regs, MEAS_REGS_FULL, s->slots, &full_record[length]);
+    MAX_Regs_Pack(&temp_regs[1], TEMP_REGS - 1, s->slots, &full_record[length]);
+}
+
+void processTOF_BIN(const SMPQ_Sample_t *s, uint8_t *record){
+    uint32_t tof = s->slots[MAX_SLOT_TOF_DIFF];
+    uint16_t status = s->slots[MAX_SLOT_INT_STAT];
+
+    record[0] = s->device;
+    record[1] = s->seq;
+    record[2] = s->ticks >> 24;
+    record[3] = s->ticks >> 16;
+    record[4] = s->ticks >> 8;
+    record[5] = s->ticks & 0xFF;
+    record[6] = tof >> 24;
+    record[7] = tof >> 16;
+    record[8] = tof >> 8;
+    record[9] = tof & 0xFF;
+    record[10] = status >> 8;
+    record[11] = status & 0xFF;
+}
+
+void processFLOW_BIN(const SMPQ_Sample_t *s, uint8_t *record){
+    uint32_t word[5];
+    uint16_t status = s->slots[MAX_SLOT_INT_STAT];
+    uint32_t i;
+
+    word[0] = s->ticks;
+    word[1] = s->slots[MAX_SLOT_TOF_DIFF];
+    word[2] = s->slots[MAX_SLOT_VELOCITY];
+    word[3] = s->slots[MAX_SLOT_FLOW];
+    word[4] = s->slots[MAX_SLOT_WATER];
+
+    record[0] = FLOW_RECORD_TAG;
+    record[1] = s->device;
+    record[2] = s->seq;
+    for(i = 0; i < sizeof(word); i++) {
+        record[3 + i] = word[i / 4] >> (24 - 8 * (i % 4));
+    }
+    record[23] = status >> 8;
+    record[24] = status & 0xFF;
+}
+
+void processRTC_ASCII(const int32_t *slots){
+    uint8_t month = slots[MAX_SLOT_RTC_M_Y] >> 8;
+    uint8_t year = slots[MAX_SLOT_RTC_M_Y] & 0xFF;
+    uint8_t date = slots[MAX_SLOT_RTC_DAY_DATE] & 0xFF;
+    uint8_t minutes = slots[MAX_SLOT_RTC_MIN_HRS] >> 8;
+    uint8_t hours = slots[MAX_SLOT_RTC_MIN_HRS] & 0xFF;
+    uint8_t subsec = slots[MAX_SLOT_RTC_SECS] >> 8;
+    uint8_t seconds = slots[MAX_SLOT_RTC_SECS] & 0xFF;
+
+    // Bitwise operations to separate data in each register
+    uart_tx_buffer[0] = ((month & 0x10) >> 4) + 0x30;       // 10 Month
+    uart_tx_buffer[1] = (month & 0x0F) + 0x30;              // Month
+    uart_tx_buffer[3] = ((date & 0x30) >> 4) + 0x30;        // 10 Date
+    uart_tx_buffer[4] = (date & 0x0F) + 0x30;               // Date
+    uart_tx_buffer[6] = ((year & 0xF0) >> 4) + 0x30;        // 10 Year
+    uart_tx_buffer[7] = (year & 0x0F) + 0x30;               // Year
+	uart_tx_buffer[9] = ((hours & 0x30) >> 4) + 0x30;       // 10 Hour (tens digit stays the same regardless 12/24 hr)
+    if((hours & 0x40) == 0x40){                             // if 12 hour mode
+    	uart_tx_buffer[10] = (hours & 0x0F) + 0x32;         // Hour (add 2)
+    }
+    else {                                                  // if 24 hour mode
+    	uart_tx_buffer[10] = (hours & 0x0F) + 0x30;         // Hour
+    }
+    uart_tx_buffer[12] = ((minutes & 0x70) >> 4) + 0x30;    // 10 Minute
+    uart_tx_buffer[13] = (minutes & 0x0F) + 0x30;           // Minute
+    uart_tx_buffer[15] = ((seconds & 0x70) >> 4) + 0x30;    // 10 Second
+    uart_tx_buffer[16] = (seconds & 0x0F) + 0x30;           // Second
+    uart_tx_buffer[18] = ((subsec & 0xF0) >> 4) + 0x30;     // Tenth of Second
+    uart_tx_buffer[19] = (subsec & 0x0F) + 0x30;            // Hundredth of Second
+}
+
+/*******************************************************************************
+ * @function    processTOF_ASCII()
+ * @abstract    Write the TOF difference in picoseconds, integer only
+ * @discussion  TOF_DIFF is Q16.16 in periods of the 4 MHz reference, 250000 ps
+ *              each, so one Q16.16 LSB is 250000 / 65536 = 15625 / 4096 ps.
+ *              The magnitude is split into whole periods and fraction so that
+ *              every product fits 32 bits, ns then carries all but the last
+ *              three digits. Rounded to the nearest ps, the full register
+ *              range of +-8.2 ms fits the 12 characters.
+ *
+ * @return      void
+ ******************************************************************************/
+void processTOF_ASCII(const int32_t *slots){
+	int32_t tof = slots[MAX_SLOT_TOF_DIFF];
+	uint32_t mag = tof < 0 ? -(uint32_t)tof : (uint32_t)tof;
+	uint32_t ns = (mag >> 16) * 250;
+	uint32_t ps = ((mag & 0xFFFF) * 15625 + 2048) >> 12;
+	uint8_t *field = &uart_tx_buffer[23];
+	uint32_t digits;
+
+	ns += ps / 1000;
+	ps %= 1000;
+
+	if(ns) {
+		uint32_2dec(ps, &field[9], 3, '0');
+		digits = uint32_2dec(ns, field, 9, ' ') + 3;
+	}
+	else {
+		digits = uint32_2dec(ps, field, 12, ' ');
+	}
+
+	if(tof < 0 && (ns || ps)) {
+		field[11 - digits] = '-';
+	}
 }
 
 
 /*******************************************************************************
  * @function    main()
  * @abstract    Set up communication with MAX board, poll for measurements
- * @discussion  Initialize WonderGecko, SPIDRV, UART, MAX board, check interrupt
- *              status, start RTC Timer
+ * @discussion  Initialize WonderGecko, SPIDRV, UART, MAX boards, check interrupt
+ *              status, start RTC Timer. Measurements run from interrupts, the
+ *              main loop formats and sends the samples they queue and runs
+ *              the commands the host sends.
  *
  * @return      void
  ******************************************************************************/
 int main(void) {
+    MAX_Device_t *dev;
+    uint8_t rx[3];
+    CORE_DECLARE_IRQ_STATE;
 
     /* Chip errata */
     CHIP_Init();
 
+    // Initialization of RTCDRV driver, the energy accounting counts its ticks
+    // and has to be in place before any driver blocks an energy mode
+    RTCDRV_Init();
+    ENERGY_Init();
+
+    FLOW_Configure(&flow_geometry);
+    for(dev = max_devices; dev < max_devices + MAX_DEVICES; dev++) {
+        flow_temp[MAX_INDEX(dev)] = SOUND_NO_TEMP;
+        FILTER_Configure(&tof_filter[MAX_INDEX(dev)], TOF_FILTER_DEFAULT, TOF_FILTER_PARAM);
+    }
+    TOTAL_Load(meas_total.acc, MAX_DEVICES);
+
     SPI_Init();
     UART_Init();
-    MAX_Init();
-    setupGPIOInt();
 
-    // Initialization of RTCDRV driver
-    RTCDRV_Init();
-    // Reserve a timer
-    Ecode_t max_timer = RTCDRV_AllocateTimer( &rtc_id );
+    // Low energy output and command path, runs next to USART0
+    LEUART_TX_Init(callback_LEUARTTX, callback_LEUARTRX);
+    if(out_port == OUT_PORT_UART) {
+        SLEEP_SleepBlockBegin(sleepEM2);
+    }
 
-    #ifdef SAVE_HEX_DATA
-        uart_tx_buffer[1] = uart_tx_buffer[3] = uart_tx_buffer[5] = uart_tx_buffer[7] = uart_tx_buffer[9] = uart_tx_buffer[11] = delimiter;
-    #else
-        uart_tx_buffer[2] = uart_tx_buffer[5] = '/';
-        uart_tx_buffer[8] = uart_tx_buffer[20] = 0x20;
-        uart_tx_buffer[11] = uart_tx_buffer[14] = uart_tx_buffer[17] = ':';
-        //uart_tx_buffer[33] = 0x0D;
-        //uart_tx_buffer[34] = 0x0A;
-    #endif
+    // Host commands arrive one byte per buffer, the second is queued while
+    // the first is handled
+    UARTDRV_Receive(uart_handle, &host_cmd.rx[0], 1, callback_UARTRX);
+    UARTDRV_Receive(uart_handle, &host_cmd.rx[1], 1, callback_UARTRX);
 
-    // Initial measurement
-    spi_tx_buffer[0] = TOF_DIFF;
-    MAX_SPI_TX(&spi_tx_buffer[0]);
+    for(dev = max_devices; dev < max_devices + MAX_DEVICES; dev++) {
+        MAX_Init(dev);
 
-    spi_tx_buffer[0] = READ_INT_STAT_REG;
+        // Clear any interrupt left over from initialization
+        spi_tx_config_buffer[0] = READ_INT_STAT_REG;
+        spi_tx_config_buffer[1] = 0x00;
+        spi_tx_config_buffer[2] = 0x00;
+        MAX_SPI_TXRX(dev, &spi_tx_config_buffer[0], &rx[0]);
+    }
 
-    SPIDRV_MTransferB(spi_handle, &spi_tx_buffer[0], &spi_rx_buffer[0], 3);
-    //MAX_SPI_TXRX(&spi_tx_buffer[0], &spi_rx_buffer[0]);
-    //test
-    int i = 0;
-    for (i=0; i<3;i++)
-    	spi_rx_buffer[i]=0;
+    setupGPIOInt();
 
-    // Start a periodic timer with 1000 millisecond timeout
-    RTCDRV_StartTimer( rtc_id, rtcdrvTimerTypePeriodic, 1000, callback_RTC, NULL );
+    // Reserve a timer supervising all devices, armed as they start
+    Ecode_t max_timer = RTCDRV_AllocateTimer( &rtc_id );
+    // One bounding the latency of batched samples
+    RTCDRV_AllocateTimer( &batch_id );
+    // And one pacing the measurements
+    RTCDRV_AllocateTimer( &period_id );
+    MAX_SetPeriod(meas_period_ms);
+    // And one ending the statistics intervals
+    RTCDRV_AllocateTimer( &stats_id );
+    MAX_SetStats(stats_interval_ms, stats_raw);
+
+    // Initial measurements, the rest are started by the scheduler as devices
+    // are read out or timed by the MAX35103 itself in event timing mode
+    if(evt_mode == EVT_MODE_OFF) {
+        sched_idle = (1 << MAX_DEVICES) - 1;
+        MAX_Schedule();
+    }
+    else {
+        for(dev = max_devices; dev < max_devices + MAX_DEVICES; dev++) {
+            MAX_StartEventTiming(dev);
+        }
+        MAX_Supervise(true);
+    }
 
+    while(1) {
+        HOST_ProcessCommand();
+        MAX_ProcessSamples();
+        MAX_CheckpointTotals();
+
+        // Interrupts are masked so none can slip in between the check and the
+        // sleep, a pending one still wakes the core. The sleep driver picks
+        // EM2 unless SPI, USART0 output or OUT_PORT_UART block it.
+        CORE_ENTER_ATOMIC();
+        if(!MAX_SamplesReady() && !HOST_CommandReady()) {
+            SLEEP_Sleep();
+        }
+        CORE_EXIT_ATOMIC();
+    }
 }
 
 
@@ -0,0 +1,309 @@
+/*
+ * max_burst.h
+ *
+ * DMA scatter-gather burst reads of MAX35103 registers
+ */
+
+#ifndef MAX_BURST
+#define MAX_BURST
+
+#include <stdbool.h>
+#include "em_device.h"
+#include "em_dma.h"
+#include "em_gpio.h"
+#include "dmadrv.h"
+#include "max_regs.h"
+
+/* @var MAX_BURST_FRAME_LENGTH  Opcode byte followed by 2 clocked-in data bytes */
+#define MAX_BURST_FRAME_LENGTH      3
+/* @var MAX_BURST_DESCR_PER_REG  CS low, opcode frame, CS high */
+#define MAX_BURST_DESCR_PER_REG     3
+/* @var MAX_BURST_RX_DESCR_PER_REG  Byte clocked in with the opcode, data word */
+#define MAX_BURST_RX_DESCR_PER_REG  2
+
+/*******************************************************************************
+ * @var MAX_BURST_STORAGE_LENGTH
+ * @abstract Descriptors of storage a burst of regs registers needs
+ * @discussion The caller sizes the storage of every burst to its own list:
+ *             DMA_DESCRIPTOR_TypeDef store[MAX_BURST_STORAGE_LENGTH(n)];
+ *             It holds both descriptor chains followed by the opcode frames.
+ ******************************************************************************/
+#define MAX_BURST_STORAGE_LENGTH(regs)                                          \
+    ((regs) * (MAX_BURST_DESCR_PER_REG + MAX_BURST_RX_DESCR_PER_REG) +          \
+     ((regs) * MAX_BURST_FRAME_LENGTH + sizeof(DMA_DESCRIPTOR_TypeDef) - 1) /   \
+     sizeof(DMA_DESCRIPTOR_TypeDef))
+
+typedef void (*MAX_Burst_Callback_t)(void *user);
+
+/*******************************************************************************
+ * @struct      MAX_Burst_t
+ * @abstract    Prepared register list and its TX and RX descriptor chains
+ * @discussion  Every register read is three alternate descriptors, all paced
+ *              by the USART TXEMPTY request so that each one only runs after
+ *              the previous byte has left the shift register:
+ *              txDescr[3n+0]   csMask -> GPIO DOUTCLR   (CS low)
+ *              txDescr[3n+1]   txFrame[n][0:2] -> TXDATA (opcode, 2 dummies)
+ *              txDescr[3n+2]   csMask -> GPIO DOUTSET   (CS high)
+ *              The RX channel is a chain of its own, paced by RXDATAV:
+ *              rxDescr[2n+0]   RXDATA -> max_burst_engine.sink (byte clocked
+ *                              in with the opcode, carries no data)
+ *              rxDescr[2n+1]   RXDATA -> rx[n], 2 bytes
+ *              so rx holds exactly the data words of the list, in order.
+ *              The chains and frames point into the storage the burst was
+ *              built in, see MAX_BURST_STORAGE_LENGTH. A burst is not tied to
+ *              a device, MAX_Burst_Target() moves CS and rx to another one.
+ ******************************************************************************/
+typedef struct {
+    DMA_DESCRIPTOR_TypeDef *txDescr;
+    DMA_DESCRIPTOR_TypeDef *rxDescr;
+    uint8_t (*txFrame)[MAX_BURST_FRAME_LENGTH];
+    MAX_Word_t *rx;
+    uint32_t count;
+    uint32_t csMask;
+    GPIO_Port_TypeDef csPort;
+} MAX_Burst_t;
+
+/*******************************************************************************
+ * @var max_burst_engine
+ * @abstract Shared DMA channels and completion state of the burst engine
+ * @discussion A burst is done once both the TX chain (last CS high written)
+ *             and the RX chain have completed, tracked by pending. sink
+ *             takes the unused byte of every register read.
+ ******************************************************************************/
+struct {
+    USART_TypeDef *usart;
+    unsigned int txChannel;
+    unsigned int rxChannel;
+    DMA_CB_TypeDef txCb;
+    DMA_CB_TypeDef rxCb;
+    uint8_t sink;
+    volatile uint8_t pending;
+    MAX_Burst_Callback_t done;
+    void *user;
+} max_burst_engine;
+
+
+void MAX_Burst_DMADone(unsigned int channel, bool primary, void *user)
+{
+    (void)channel;
+    (void)primary;
+    (void)user;
+
+    if(max_burst_engine.pending && --max_burst_engine.pending == 0) {
+        if(max_burst_engine.done) {
+            max_burst_engine.done(max_burst_engine.user);
+        }
+    }
+}
+
+/*******************************************************************************
+ * @function    MAX_Burst_Init()
+ * @abstract    Reserve and configure the burst DMA channels
+ * @discussion  Must run after SPIDRV_Init() so DMADRV is already initialized.
+ *              The SPI driver must use spidrvCsControlApplication, since CS is
+ *              driven by the descriptor chain.
+ *
+ * @param       usart   SPI USART shared with SPIDRV
+ * @param       txReq   DMAREQ_<usart>_TXEMPTY
+ * @param       rxReq   DMAREQ_<usart>_RXDATAV
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_Burst_Init(USART_TypeDef *usart, uint32_t txReq, uint32_t rxReq)
+{
+    DMA_CfgChannel_TypeDef chnlCfg;
+
+    max_burst_engine.usart = usart;
+    max_burst_engine.pending = 0;
+
+    DMADRV_AllocateChannel(&max_burst_engine.txChannel, NULL);
+    DMADRV_AllocateChannel(&max_burst_engine.rxChannel, NULL);
+
+    max_burst_engine.txCb.cbFunc = MAX_Burst_DMADone;
+    max_burst_engine.txCb.userPtr = NULL;
+    max_burst_engine.rxCb.cbFunc = MAX_Burst_DMADone;
+    max_burst_engine.rxCb.userPtr = NULL;
+
+    chnlCfg.highPri = false;
+    chnlCfg.enableInt = true;
+    chnlCfg.select = txReq;
+    chnlCfg.cb = &max_burst_engine.txCb;
+    DMA_CfgChannel(max_burst_engine.txChannel, &chnlCfg);
+
+    // RX has priority so no received byte is lost while TX copies descriptors
+    chnlCfg.highPri = true;
+    chnlCfg.select = rxReq;
+    chnlCfg.cb = &max_burst_engine.rxCb;
+    DMA_CfgChannel(max_burst_engine.rxChannel, &chnlCfg);
+}
+
+/*******************************************************************************
+ * @function    MAX_Burst_Build()
+ * @abstract    Prepare the descriptor chain for a list of register opcodes
+ * @discussion  Only touches memory, so a burst can be built once at startup
+ *              and started any number of times.
+ *
+ * @param       burst    Burst to prepare
+ * @param       storage  Descriptor storage, kept by the burst
+ * @param       length   Descriptors in storage, MAX_BURST_STORAGE_LENGTH(count)
+ *                       or more
+ * @param       opcodes  Register read opcodes, in transfer order
+ * @param       count    Number of opcodes
+ * @param       rx       Receive buffer, one word per opcode
+ * @param       csPort   Chip select port of the MAX35103
+ * @param       csPin    Chip select pin of the MAX35103
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_Burst_Build(MAX_Burst_t *burst, DMA_DESCRIPTOR_TypeDef *storage, uint32_t length,
+                     const uint8_t *opcodes, uint32_t count,
+                     MAX_Word_t *rx, GPIO_Port_TypeDef csPort, unsigned int csPin)
+{
+    DMA_CfgDescrSGAlt_TypeDef csCfg;
+    DMA_CfgDescrSGAlt_TypeDef frameCfg;
+    DMA_CfgDescrSGAlt_TypeDef sinkCfg;
+    DMA_CfgDescrSGAlt_TypeDef wordCfg;
+    uint32_t i;
+
+    EFM_ASSERT(count && MAX_BURST_STORAGE_LENGTH(count) <= length);
+
+    burst->txDescr = storage;
+    burst->rxDescr = storage + count * MAX_BURST_DESCR_PER_REG;
+    burst->txFrame = (uint8_t (*)[MAX_BURST_FRAME_LENGTH])
+                     (burst->rxDescr + count * MAX_BURST_RX_DESCR_PER_REG);
+    burst->rx = rx;
+    burst->count = count;
+    burst->csMask = 1 << csPin;
+    burst->csPort = csPort;
+
+    csCfg.src = &burst->csMask;
+    csCfg.nMinus1 = 0;
+    csCfg.dstInc = dmaDataIncNone;
+    csCfg.srcInc = dmaDataIncNone;
+    csCfg.size = dmaDataSize4;
+    csCfg.arbRate = dmaArbitrate1;
+    csCfg.hprot = 0;
+    csCfg.peripheral = true;
+
+    frameCfg.dst = (void *)&max_burst_engine.usart->TXDATA;
+    frameCfg.nMinus1 = MAX_BURST_FRAME_LENGTH - 1;
+    frameCfg.dstInc = dmaDataIncNone;
+    frameCfg.srcInc = dmaDataInc1;
+    frameCfg.size = dmaDataSize1;
+    frameCfg.arbRate = dmaArbitrate1;
+    frameCfg.hprot = 0;
+    frameCfg.peripheral = true;
+
+    sinkCfg.src = (void *)&max_burst_engine.usart->RXDATA;
+    sinkCfg.dst = &max_burst_engine.sink;
+    sinkCfg.nMinus1 = 0;
+    sinkCfg.dstInc = dmaDataIncNone;
+    sinkCfg.srcInc = dmaDataIncNone;
+    sinkCfg.size = dmaDataSize1;
+    sinkCfg.arbRate = dmaArbitrate1;
+    sinkCfg.hprot = 0;
+    sinkCfg.peripheral = true;
+
+    wordCfg = sinkCfg;
+    wordCfg.nMinus1 = sizeof(MAX_Word_t) - 1;
+    wordCfg.dstInc = dmaDataInc1;
+
+    for(i = 0; i < count; i++) {
+        burst->txFrame[i][0] = opcodes[i];
+        burst->txFrame[i][1] = 0x00;
+        burst->txFrame[i][2] = 0x00;
+
+        csCfg.dst = (void *)&GPIO->P[csPort].DOUTCLR;
+        DMA_CfgDescrScatterGather(burst->txDescr, i * MAX_BURST_DESCR_PER_REG, &csCfg);
+
+        frameCfg.src = burst->txFrame[i];
+        DMA_CfgDescrScatterGather(burst->txDescr, i * MAX_BURST_DESCR_PER_REG + 1, &frameCfg);
+
+        csCfg.dst = (void *)&GPIO->P[csPort].DOUTSET;
+        DMA_CfgDescrScatterGather(burst->txDescr, i * MAX_BURST_DESCR_PER_REG + 2, &csCfg);
+
+        DMA_CfgDescrScatterGather(burst->rxDescr, i * MAX_BURST_RX_DESCR_PER_REG, &sinkCfg);
+
+        wordCfg.dst = &rx[i];
+        DMA_CfgDescrScatterGather(burst->rxDescr, i * MAX_BURST_RX_DESCR_PER_REG + 1, &wordCfg);
+    }
+}
+
+/*******************************************************************************
+ * @function    MAX_Burst_Target()
+ * @abstract    Point a prepared burst at another device
+ * @discussion  Rewrites only the CS and data word destinations, the end
+ *              pointers of single transfers and 2 byte words, so one burst per
+ *              register list serves every device on the bus. Must not be called
+ *              while the burst runs. Returns at once if nothing changes.
+ *
+ * @param       burst   Burst prepared with MAX_Burst_Build()
+ * @param       rx      Receive buffer, one word per opcode
+ * @param       csPort  Chip select port of the MAX35103
+ * @param       csPin   Chip select pin of the MAX35103
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_Burst_Target(MAX_Burst_t *burst, MAX_Word_t *rx,
+                      GPIO_Port_TypeDef csPort, unsigned int csPin)
+{
+    DMA_DESCRIPTOR_TypeDef *d;
+    uint32_t i;
+
+    if(burst->csPort != csPort) {
+        burst->csPort = csPort;
+        for(i = 0, d = burst->txDescr; i < burst->count; i++, d += MAX_BURST_DESCR_PER_REG) {
+            d[0].DSTEND = (void *)&GPIO->P[csPort].DOUTCLR;
+            d[2].DSTEND = (void *)&GPIO->P[csPort].DOUTSET;
+        }
+    }
+
+    if(burst->rx != rx) {
+        burst->rx = rx;
+        for(i = 0, d = burst->rxDescr; i < burst->count; i++, d += MAX_BURST_RX_DESCR_PER_REG) {
+            d[1].DSTEND = &rx[i].lsb;
+        }
+    }
+
+    // Read by the TX chain itself
+    burst->csMask = 1 << csPin;
+}
+
+bool MAX_Burst_Busy()
+{
+    return max_burst_engine.pending != 0;
+}
+
+/*******************************************************************************
+ * @function    MAX_Burst_Start()
+ * @abstract    Run a prepared burst
+ * @discussion  The SPI driver must be idle. done is called from the DMA
+ *              interrupt once CS is released after the last register.
+ *
+ * @param       burst   Burst prepared with MAX_Burst_Build()
+ * @param       done    Completion callback, may be NULL
+ * @param       user    Passed to done
+ *
+ * @return      false if a burst is already running
+ ******************************************************************************/
+bool MAX_Burst_Start(MAX_Burst_t *burst, MAX_Burst_Callback_t done, void *user)
+{
+    if(MAX_Burst_Busy()) {
+        return false;
+    }
+
+    max_burst_engine.done = done;
+    max_burst_engine.user = user;
+    max_burst_engine.pending = 2;
+
+    max_burst_engine.usart->CMD = USART_CMD_CLEARRX;
+
+    DMA_ActivateScatterGather(max_burst_engine.rxChannel, false,
+                              burst->rxDescr, burst->count * MAX_BURST_RX_DESCR_PER_REG);
+    DMA_ActivateScatterGather(max_burst_engine.txChannel, false,
+                              burst->txDescr, burst->count * MAX_BURST_DESCR_PER_REG);
+
+    return true;
+}
+
+#endif /* MAX_BURST */
@@ -0,0 +1,85 @@
+/*
+ * max_config.h
+ *
+ * RAM shadow of the MAX35103 configuration registers
+ */
+
+#ifndef MAX_CONFIG
+#define MAX_CONFIG
+
+#include <stdint.h>
+#include "max_macros.h"
+
+/* ----- Shadow register indices, same order as max_config_read_opcodes ----- */
+#define MAX_CFG_TOF1            0
+#define MAX_CFG_TOF2            1
+#define MAX_CFG_TOF3            2
+#define MAX_CFG_TOF4            3
+#define MAX_CFG_TOF5            4
+#define MAX_CFG_TOF6            5
+#define MAX_CFG_TOF7            6
+#define MAX_CFG_EVT_TIMING1     7
+#define MAX_CFG_TOF_MEAS_DELAY  8
+#define MAX_CFG_CLBRT_CTRL      9
+#define MAX_CFG_REGS            10
+
+/* Write opcode of a configuration register is its read opcode without bit 7 */
+#define MAX_CFG_WRITE_OPCODE(i) (max_config_read_opcodes[i] & 0x7F)
+
+const uint8_t max_config_read_opcodes[MAX_CFG_REGS] = {
+    READ_TOF1,
+    READ_TOF2,
+    READ_TOF3,
+    READ_TOF4,
+    READ_TOF5,
+    READ_TOF6,
+    READ_TOF7,
+    READ_EVT_TIMING1,
+    READ_TOF_MEAS_DELAY,
+    READ_CLBRT_CTRL
+};
+
+/*******************************************************************************
+ * @union       MAX_Config_t
+ * @abstract    Value of every configuration register
+ * @discussion  Fields by name through r, or by MAX_CFG_* index through word.
+ ******************************************************************************/
+typedef union {
+    struct {
+        uint16_t tof1;
+        uint16_t tof2;
+        uint16_t tof3;
+        uint16_t tof4;
+        uint16_t tof5;
+        uint16_t tof6;
+        uint16_t tof7;
+        uint16_t evtTiming1;
+        uint16_t tofMeasDelay;
+        uint16_t clbrtCtrl;
+    } r;
+    uint16_t word[MAX_CFG_REGS];
+} MAX_Config_t;
+
+/*******************************************************************************
+ * @function    MAX_Config_Diff()
+ * @abstract    Find the registers that have to be written
+ *
+ * @param       shadow  Current device state
+ * @param       target  Wanted device state
+ *
+ * @return      Bit i set if register MAX_CFG_i differs
+ ******************************************************************************/
+uint32_t MAX_Config_Diff(const MAX_Config_t *shadow, const MAX_Config_t *target)
+{
+    uint32_t changed = 0;
+    uint32_t i;
+
+    for(i = 0; i < MAX_CFG_REGS; i++) {
+        if(shadow->word[i] != target->word[i]) {
+            changed |= 1 << i;
+        }
+    }
+    return changed;
+}
+
+#endif /* MAX_CONFIG */
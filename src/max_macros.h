@@ -64,7 +64,8 @@
 #define READ_EVT_TIMING1        0xBF
 #define WRITE_EVT_TIMING1       0x3F
 #define READ_EVT_TIMING2        0xC0
-#define WRITE_EVT_TIMING3       0x40
+#define WRITE_EVT_TIMING2       0x40
+#define WRITE_EVT_TIMING3       WRITE_EVT_TIMING2  // Old name, no EVT_TIMING3 register
 
 #define READ_TOF_MEAS_DELAY     0xC1
 #define WRITE_TOF_MEAS_DELAY    0x41
@@ -104,7 +105,7 @@
 #define HIT5_DN_INT             0xDC
 #define HIT5_DN_FRAC            0xDD
 #define HIT6_DN_INT             0xDE
-#define HIT7_DN_FRAC            0xDF
+#define HIT6_DN_FRAC            0xDF
 #define AVG_DN_INT              0xE0
 #define AVG_DN_FRAC             0xE1
 
@@ -141,6 +142,13 @@
 #define READ_CTRL_REG           0x7F
 #define WRITE_CTRL_REG          0xFF  // Can only be written to 0
 
+// Interrupt Status Register bits (cleared on read)
+#define INT_STAT_TO             0x8000  // Timeout
+#define INT_STAT_TOF            0x1000  // TOF measurement complete
+#define INT_STAT_TE             0x0800  // Temperature measurement complete
+#define INT_STAT_TOF_EVTMG      0x0200  // Event timing TOF_DIFF sequence complete
+#define INT_STAT_TEMP_EVTMG     0x0100  // Event timing temperature sequence complete
+
 /* ----- End Macros ----- */
 
 #endif /* MAX_MACROS */
@@ -0,0 +1,178 @@
+/*
+ * max_regs.h
+ *
+ * Register descriptors and generic decoding of MAX35103 result registers
+ */
+
+#ifndef MAX_REGS
+#define MAX_REGS
+
+#include <stdint.h>
+#include "max_macros.h"
+
+/* ----- Result slots, one decoded value each ----- */
+#define MAX_SLOT_INT_STAT       0
+#define MAX_SLOT_TOF_DIFF       1   // Q16.16, signed
+#define MAX_SLOT_RTC_M_Y        2
+#define MAX_SLOT_RTC_DAY_DATE   3
+#define MAX_SLOT_RTC_MIN_HRS    4
+#define MAX_SLOT_RTC_SECS       5
+#define MAX_SLOT_WVRUP          6
+#define MAX_SLOT_HIT_UP         7   // HIT1..HIT6 Up, Q16.16
+#define MAX_SLOT_AVG_UP         13  // Q16.16
+#define MAX_SLOT_WVRDN          14
+#define MAX_SLOT_HIT_DN         15  // HIT1..HIT6 Down, Q16.16
+#define MAX_SLOT_AVG_DN         21  // Q16.16
+#define MAX_SLOT_T              22  // T1..T4, Q16.16
+#define MAX_SLOT_VELOCITY       26  // um/s, FLOW_Compute() in the main loop
+#define MAX_SLOT_FLOW           27  // uL/s, FLOW_Compute() in the main loop
+#define MAX_SLOT_WATER          28  // m degrees C, from the RTD in the main loop
+#define MAX_SLOTS               29
+
+/*******************************************************************************
+ * @struct      MAX_Word_t
+ * @abstract    One register as clocked in, MSB first
+ ******************************************************************************/
+typedef struct {
+    uint8_t msb;
+    uint8_t lsb;
+} MAX_Word_t;
+
+#define MAX_WORD(w)             (((uint16_t)(w).msb << 8) | (w).lsb)
+
+/* ----- Descriptor flags ----- */
+#define MAX_REG_UNSIGNED        0x00
+#define MAX_REG_SIGNED          0x01
+
+/*******************************************************************************
+ * @struct      MAX_RegDescr_t
+ * @abstract    How one register read is turned into a result slot
+ * @discussion  The low width bits of the register are sign extended if
+ *              MAX_REG_SIGNED, shifted left by shift and added to the slot.
+ *              An INT/FRAC pair is two descriptors on the same slot, INT with
+ *              shift 16 and FRAC with shift 0, giving a Q16.16 value.
+ ******************************************************************************/
+typedef struct {
+    uint8_t opcode;
+    uint8_t width;
+    uint8_t flags;
+    uint8_t shift;
+    uint8_t slot;
+} MAX_RegDescr_t;
+
+/* ----- Descriptor table ----- */
+#define MAX_REG_WORD(op, slot)          { op, 16, MAX_REG_UNSIGNED, 0, slot }
+#define MAX_REG_Q16(opInt, opFrac, slot, sign) \
+                                        { opInt, 16, sign, 16, slot }, \
+                                        { opFrac, 16, MAX_REG_UNSIGNED, 0, slot }
+
+#define MAX_DESCR_INT_STAT      MAX_REG_WORD(READ_INT_STAT_REG, MAX_SLOT_INT_STAT)
+#define MAX_DESCR_TOF_DIFF      MAX_REG_Q16(TOF_DIFF_INT, TOF_DIFF_FRAC, MAX_SLOT_TOF_DIFF, MAX_REG_SIGNED)
+#define MAX_DESCR_TOF_DIFF_AVG  MAX_REG_Q16(TOF_DIFF_AVG_INT, TOF_DIFF_AVG_FRAC, MAX_SLOT_TOF_DIFF, MAX_REG_SIGNED)
+#define MAX_DESCR_RTC           MAX_REG_WORD(READ_RTC_M_Y, MAX_SLOT_RTC_M_Y), \
+                                MAX_REG_WORD(READ_RTC_DAY_DATE, MAX_SLOT_RTC_DAY_DATE), \
+                                MAX_REG_WORD(READ_RTC_MIN_HRS, MAX_SLOT_RTC_MIN_HRS), \
+                                MAX_REG_WORD(READ_RTC_SECS, MAX_SLOT_RTC_SECS)
+
+#define MAX_DESCR_HITS_UP       MAX_REG_WORD(WVRUP, MAX_SLOT_WVRUP), \
+                                MAX_REG_Q16(HIT1_UP_INT, HIT1_UP_FRAC, MAX_SLOT_HIT_UP + 0, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(HIT2_UP_INT, HIT2_UP_FRAC, MAX_SLOT_HIT_UP + 1, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(HIT3_UP_INT, HIT3_UP_FRAC, MAX_SLOT_HIT_UP + 2, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(HIT4_UP_INT, HIT4_UP_FRAC, MAX_SLOT_HIT_UP + 3, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(HIT5_UP_INT, HIT5_UP_FRAC, MAX_SLOT_HIT_UP + 4, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(HIT6_UP_INT, HIT6_UP_FRAC, MAX_SLOT_HIT_UP + 5, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(AVG_UP_INT, AVG_UP_FRAC, MAX_SLOT_AVG_UP, MAX_REG_UNSIGNED)
+
+#define MAX_DESCR_HITS_DN       MAX_REG_WORD(WVRDN, MAX_SLOT_WVRDN), \
+                                MAX_REG_Q16(HIT1_DN_INT, HIT1_DN_FRAC, MAX_SLOT_HIT_DN + 0, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(HIT2_DN_INT, HIT2_DN_FRAC, MAX_SLOT_HIT_DN + 1, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(HIT3_DN_INT, HIT3_DN_FRAC, MAX_SLOT_HIT_DN + 2, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(HIT4_DN_INT, HIT4_DN_FRAC, MAX_SLOT_HIT_DN + 3, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(HIT5_DN_INT, HIT5_DN_FRAC, MAX_SLOT_HIT_DN + 4, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(HIT6_DN_INT, HIT6_DN_FRAC, MAX_SLOT_HIT_DN + 5, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(AVG_DN_INT, AVG_DN_FRAC, MAX_SLOT_AVG_DN, MAX_REG_UNSIGNED)
+
+#define MAX_DESCR_AVG           MAX_REG_Q16(AVG_UP_INT, AVG_UP_FRAC, MAX_SLOT_AVG_UP, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(AVG_DN_INT, AVG_DN_FRAC, MAX_SLOT_AVG_DN, MAX_REG_UNSIGNED)
+
+#define MAX_DESCR_TEMP          MAX_REG_Q16(T1_INT, T1_FRAC, MAX_SLOT_T + 0, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(T2_INT, T2_FRAC, MAX_SLOT_T + 1, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(T3_INT, T3_FRAC, MAX_SLOT_T + 2, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(T4_INT, T4_FRAC, MAX_SLOT_T + 3, MAX_REG_UNSIGNED)
+
+#define MAX_DESCR_TEMP_AVG      MAX_REG_Q16(T1_AVG_INT, T1_AVG_FRAC, MAX_SLOT_T + 0, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(T2_AVG_INT, T2_AVG_FRAC, MAX_SLOT_T + 1, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(T3_AVG_INT, T3_AVG_FRAC, MAX_SLOT_T + 2, MAX_REG_UNSIGNED), \
+                                MAX_REG_Q16(T4_AVG_INT, T4_AVG_FRAC, MAX_SLOT_T + 3, MAX_REG_UNSIGNED)
+
+
+/*******************************************************************************
+ * @function    MAX_Regs_Opcodes()
+ * @abstract    Extract the read opcodes of an acquisition list
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_Regs_Opcodes(const MAX_RegDescr_t *regs, uint32_t count, uint8_t *opcodes)
+{
+    uint32_t i;
+
+    for(i = 0; i < count; i++) {
+        opcodes[i] = regs[i].opcode;
+    }
+}
+
+/*******************************************************************************
+ * @function    MAX_Regs_Decode()
+ * @abstract    Decode a burst receive buffer into result slots
+ * @discussion  rx holds one word per descriptor. Only the slots named in regs
+ *              are modified.
+ *
+ * @param       regs    Acquisition list the burst was built from
+ * @param       count   Number of descriptors
+ * @param       rx      Burst receive buffer
+ * @param       slots   MAX_SLOTS result values
+ *
+ * @return      void
+ ******************************************************************************/
+void MAX_Regs_Decode(const MAX_RegDescr_t *regs, uint32_t count, const MAX_Word_t *rx, int32_t *slots)
+{
+    uint32_t i;
+    uint32_t raw;
+    uint32_t mask;
+
+    for(i = 0; i < count; i++) {
+        slots[regs[i].slot] = 0;
+    }
+
+    for(i = 0; i < count; i++) {
+        mask = (1UL << regs[i].width) - 1;
+        raw = MAX_WORD(rx[i]) & mask;
+        if((regs[i].flags & MAX_REG_SIGNED) && (raw & ~(mask >> 1))) {
+            raw |= ~mask;
+        }
+        slots[regs[i].slot] += (int32_t)(raw << regs[i].shift);
+    }
+}
+
+/*******************************************************************************
+ * @function    MAX_Regs_Pack()
+ * @abstract    Write the raw register words of an acquisition list
+ * @discussion  Inverse of MAX_Regs_Decode(), 2 bytes per descriptor, MSB
+ *              first, taken back out of the result slots.
+ *
+ * @return      Number of bytes written
+ ******************************************************************************/
+uint32_t MAX_Regs_Pack(const MAX_RegDescr_t *regs, uint32_t count, const int32_t *slots, uint8_t *out)
+{
+    uint32_t i;
+    uint32_t raw;
+
+    for(i = 0; i < count; i++) {
+        raw = ((uint32_t)slots[regs[i].slot] >> regs[i].shift) & ((1UL << regs[i].width) - 1);
+        out[2 * i] = raw >> 8;
+        out[2 * i + 1] = raw & 0xFF;
+    }
+    return 2 * count;
+}
+
+#endif /* MAX_REGS */
@@ -0,0 +1,119 @@
+/*
+ * sample_queue.h
+ *
+ * Lock-free single producer, single consumer queue of decoded samples
+ */
+
+#ifndef SAMPLE_QUEUE
+#define SAMPLE_QUEUE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "em_device.h"
+#include "max_regs.h"
+
+/* @var SMPQ_DEPTH  Samples that can wait for the main loop, power of 2, at most 128 */
+#define SMPQ_DEPTH          8
+
+/*******************************************************************************
+ * @struct      SMPQ_Sample_t
+ * @abstract    One measurement result on its way to the UART
+ * @discussion  slots is a copy of the device slots taken when the result burst
+ *              completed, so the device can measure again right away. acq is
+ *              the ACQ_MODE_* the burst was built for and selects the record
+ *              the sample is sent as. seq
+ *              and ticks are stamped by the producer. temp is set if T1..T4
+ *              hold results the previous sample of the device did not have.
+ ******************************************************************************/
+typedef struct {
+    uint8_t device;
+    uint8_t acq;
+    bool temp;
+    uint8_t seq;
+    uint32_t ticks;
+    int32_t slots[MAX_SLOTS];
+} SMPQ_Sample_t;
+
+/*******************************************************************************
+ * @var sample_queue
+ * @abstract Samples between the burst callbacks and the main loop
+ * @discussion Only the producer (burst completions, all in the DMA interrupt)
+ *             writes tail and only the consumer (main loop) writes head, so
+ *             neither side needs a critical section. Both run freely, tail -
+ *             head is the number of queued samples. A slot is filled in place
+ *             before tail moves past it and read in place before head does.
+ *             dropped counts samples lost to a full queue.
+ ******************************************************************************/
+struct {
+    SMPQ_Sample_t queue[SMPQ_DEPTH];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+    volatile uint32_t dropped;
+} sample_queue;
+
+/*******************************************************************************
+ * @function    SMPQ_Claim()
+ * @abstract    Producer: next free slot, to be filled and then published
+ *
+ * @return      NULL if the queue is full, the sample is counted as dropped
+ ******************************************************************************/
+SMPQ_Sample_t *SMPQ_Claim()
+{
+    uint8_t tail = sample_queue.tail;
+
+    if((uint8_t)(tail - sample_queue.head) >= SMPQ_DEPTH) {
+        sample_queue.dropped++;
+        return NULL;
+    }
+    return &sample_queue.queue[tail & (SMPQ_DEPTH - 1)];
+}
+
+/*******************************************************************************
+ * @function    SMPQ_Publish()
+ * @abstract    Producer: hand the slot returned by SMPQ_Claim() to the consumer
+ *
+ * @return      void
+ ******************************************************************************/
+void SMPQ_Publish()
+{
+    // Slot contents must be in memory before the consumer can see the slot
+    __DMB();
+    sample_queue.tail++;
+}
+
+/*******************************************************************************
+ * @function    SMPQ_Peek()
+ * @abstract    Consumer: oldest queued sample, stays valid until SMPQ_Release()
+ *
+ * @return      NULL if the queue is empty
+ ******************************************************************************/
+SMPQ_Sample_t *SMPQ_Peek()
+{
+    uint8_t head = sample_queue.head;
+
+    if(head == sample_queue.tail) {
+        return NULL;
+    }
+    __DMB();
+    return &sample_queue.queue[head & (SMPQ_DEPTH - 1)];
+}
+
+/*******************************************************************************
+ * @function    SMPQ_Release()
+ * @abstract    Consumer: give the slot returned by SMPQ_Peek() back
+ *
+ * @return      void
+ ******************************************************************************/
+void SMPQ_Release()
+{
+    // Done reading the slot before the producer may fill it again
+    __DMB();
+    sample_queue.head++;
+}
+
+bool SMPQ_Empty()
+{
+    return sample_queue.head == sample_queue.tail;
+}
+
+#endif /* SAMPLE_QUEUE */
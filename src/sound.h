@@ -0,0 +1,115 @@
+/*
+ * sound.h
+ *
+ * Water temperature from the RTD and the speed of sound at that temperature,
+ * table lookups built by the compiler
+ */
+
+#ifndef SOUND
+#define SOUND
+
+#include <stdint.h>
+
+/* @var SOUND_NO_TEMP  Temperature of a device without a valid RTD reading */
+#define SOUND_NO_TEMP           INT32_MIN
+
+/*******************************************************************************
+ * @var SOUND_POINTS
+ * @abstract Table grid, 0 to 100 degrees C in steps of 1 degree
+ * @discussion Linear interpolation between the points of sound_speed is off
+ *             by less than 0.015 m/s, about 10 ppm of the speed of sound, and
+ *             between those of sound_rtd by less than 0.001 degrees C.
+ ******************************************************************************/
+#define SOUND_POINTS            101
+#define SOUND_STEP_MDEG         1000
+
+/*******************************************************************************
+ * @var SOUND_WATER/SOUND_PT
+ * @abstract Curves the tables are built from, t in degrees C
+ * @discussion SOUND_WATER  Speed of sound in pure water in m/s, Marczak 1997,
+ *                          valid 0 to 95 degrees C
+ *             SOUND_PT     Platinum RTD resistance over R0, IEC 60751 above
+ *                          0 degrees C
+ *             Both only appear in the initializers of const tables, so the
+ *             compiler evaluates them and no floating point reaches the
+ *             target code.
+ ******************************************************************************/
+#define SOUND_WATER(t)          (1.402385e3 + 5.038813 * (t) - 5.799136e-2 * (t) * (t) + \
+                                 3.287156e-4 * (t) * (t) * (t) - \
+                                 1.398845e-6 * (t) * (t) * (t) * (t) + \
+                                 2.787860e-9 * (t) * (t) * (t) * (t) * (t))
+#define SOUND_PT(t)             (1 + 3.9083e-3 * (t) - 5.775e-7 * (t) * (t))
+
+#define SOUND_SPEED_MM(t)       (uint32_t)(SOUND_WATER(t) * 1000 + 0.5)
+#define SOUND_RTD_Q30(t)        (uint32_t)(SOUND_PT(t) * 1073741824.0 + 0.5)
+
+#define SOUND_ROW(f, t)         f(t), f(t + 1), f(t + 2), f(t + 3), f(t + 4), \
+                                f(t + 5), f(t + 6), f(t + 7), f(t + 8), f(t + 9)
+#define SOUND_TABLE(f)          { SOUND_ROW(f, 0), SOUND_ROW(f, 10), SOUND_ROW(f, 20), \
+                                  SOUND_ROW(f, 30), SOUND_ROW(f, 40), SOUND_ROW(f, 50), \
+                                  SOUND_ROW(f, 60), SOUND_ROW(f, 70), SOUND_ROW(f, 80), \
+                                  SOUND_ROW(f, 90), f(100) }
+
+/* @var sound_speed  Speed of sound in water per grid point, mm/s */
+const uint32_t sound_speed[SOUND_POINTS] = SOUND_TABLE(SOUND_SPEED_MM);
+
+/* @var sound_rtd  RTD resistance over R0 per grid point, Q2.30 */
+const uint32_t sound_rtd[SOUND_POINTS] = SOUND_TABLE(SOUND_RTD_Q30);
+
+/*******************************************************************************
+ * @function    SOUND_Temperature()
+ * @abstract    Temperature of a platinum RTD
+ * @discussion  Binary search of sound_rtd, which rises with the temperature,
+ *              and linear interpolation within the step.
+ *
+ * @param       ratio   RTD resistance over R0, Q2.30
+ *
+ * @return      m degrees C, SOUND_NO_TEMP outside 0 to 100 degrees C
+ ******************************************************************************/
+int32_t SOUND_Temperature(uint32_t ratio)
+{
+    uint32_t lo = 0;
+    uint32_t hi = SOUND_POINTS - 1;
+    uint32_t mid;
+    uint32_t step;
+
+    if(ratio < sound_rtd[lo] || ratio > sound_rtd[hi]) {
+        return SOUND_NO_TEMP;
+    }
+    while(hi - lo > 1) {
+        mid = (lo + hi) / 2;
+        if(sound_rtd[mid] <= ratio) {
+            lo = mid;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    step = sound_rtd[hi] - sound_rtd[lo];
+    return lo * SOUND_STEP_MDEG +
+           (int32_t)(((uint64_t)(ratio - sound_rtd[lo]) * SOUND_STEP_MDEG + step / 2) / step);
+}
+
+/*******************************************************************************
+ * @function    SOUND_Speed()
+ * @abstract    Speed of sound in water, interpolated in sound_speed
+ *
+ * @param       temp    m degrees C, 0 to 100000
+ *
+ * @return      mm/s
+ ******************************************************************************/
+uint32_t SOUND_Speed(int32_t temp)
+{
+    uint32_t i = temp / SOUND_STEP_MDEG;
+    int32_t frac = temp % SOUND_STEP_MDEG;
+
+    if(i >= SOUND_POINTS - 1) {
+        return sound_speed[SOUND_POINTS - 1];
+    }
+    // Falls again above 74 degrees C
+    return sound_speed[i] + ((int32_t)(sound_speed[i + 1] - sound_speed[i]) * frac +
+                             SOUND_STEP_MDEG / 2) / SOUND_STEP_MDEG;
+}
+
+#endif /* SOUND */
@@ -0,0 +1,240 @@
+/*
+ * spi_queue.h
+ *
+ * Non-blocking SPI transaction queue on top of SPIDRV
+ */
+
+#ifndef SPI_QUEUE
+#define SPI_QUEUE
+
+#include <stdbool.h>
+#include <string.h>
+#include "em_device.h"
+#include "em_core.h"
+#include "em_gpio.h"
+#include "spidrv.h"
+#include "sleep.h"
+#include "max_burst.h"
+
+/* @var SPIQ_DEPTH  Transactions that can wait for the bus, power of 2 */
+#define SPIQ_DEPTH          16
+/* @var SPIQ_TX_LENGTH  Opcode plus one 16 bit register value */
+#define SPIQ_TX_LENGTH      3
+
+typedef void (*SPIQ_Callback_t)(void *user);
+
+/*******************************************************************************
+ * @struct      SPIQ_Transaction_t
+ * @abstract    One queued bus access
+ * @discussion  tx is copied into the queue slot, so commands and register
+ *              writes need no buffer of their own. With rx set the transfer is
+ *              full duplex, otherwise transmit only. A transaction with burst
+ *              set runs that DMA burst instead, which drives CS itself. It is
+ *              pointed at csPort/csPin and reads into rx, as MAX_Word_t.
+ ******************************************************************************/
+typedef struct {
+    uint8_t tx[SPIQ_TX_LENGTH];
+    uint8_t count;
+    uint8_t *rx;
+    MAX_Burst_t *burst;
+    GPIO_Port_TypeDef csPort;
+    uint8_t csPin;
+    SPIQ_Callback_t done;
+    void *user;
+} SPIQ_Transaction_t;
+
+/*******************************************************************************
+ * @var spi_queue
+ * @abstract Pending transactions, queue[head] is the one on the bus
+ * @discussion The entry at head is only released once its transfer is
+ *             complete, since SPIDRV reads tx from the slot by DMA. While busy
+ *             the queue holds off EM2, which stops the USART1 clock. dropped
+ *             counts transactions refused by a full queue, space is the one
+ *             shot callback of SPIQ_OnSpace().
+ ******************************************************************************/
+struct {
+    SPIDRV_Handle_t handle;
+    SPIQ_Transaction_t queue[SPIQ_DEPTH];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+    volatile bool busy;
+    volatile uint32_t dropped;
+    SPIQ_Callback_t space;
+    void *spaceUser;
+} spi_queue;
+
+void SPIQ_StartNext();
+
+void SPIQ_Complete()
+{
+    SPIQ_Transaction_t *t = &spi_queue.queue[spi_queue.head];
+    SPIQ_Callback_t done = t->done;
+    void *user = t->user;
+    SPIQ_Callback_t space;
+    bool next;
+    CORE_DECLARE_IRQ_STATE;
+
+    if(!t->burst) {
+        GPIO_PinOutSet(t->csPort, t->csPin);
+    }
+
+    CORE_ENTER_ATOMIC();
+    spi_queue.head = (spi_queue.head + 1) & (SPIQ_DEPTH - 1);
+    CORE_EXIT_ATOMIC();
+
+    // May queue follow-up transactions, they start once it returns
+    if(done) {
+        done(user);
+    }
+
+    // Someone found the queue full, a slot is free again
+    CORE_ENTER_ATOMIC();
+    space = spi_queue.space;
+    spi_queue.space = NULL;
+    CORE_EXIT_ATOMIC();
+    if(space) {
+        space(spi_queue.spaceUser);
+    }
+
+    CORE_ENTER_ATOMIC();
+    next = spi_queue.head != spi_queue.tail;
+    spi_queue.busy = next;
+    if(!next) {
+        SLEEP_SleepBlockEnd(sleepEM2);
+    }
+    CORE_EXIT_ATOMIC();
+
+    if(next) {
+        SPIQ_StartNext();
+    }
+}
+
+void SPIQ_SPIDone(SPIDRV_Handle_t handle, Ecode_t transferStatus, int itemsTransferred)
+{
+    (void)handle;
+    (void)transferStatus;
+    (void)itemsTransferred;
+
+    SPIQ_Complete();
+}
+
+void SPIQ_BurstDone(void *user)
+{
+    (void)user;
+
+    SPIQ_Complete();
+}
+
+void SPIQ_StartNext()
+{
+    SPIQ_Transaction_t *t = &spi_queue.queue[spi_queue.head];
+
+    if(t->burst) {
+        MAX_Burst_Target(t->burst, (MAX_Word_t *)t->rx, t->csPort, t->csPin);
+        MAX_Burst_Start(t->burst, SPIQ_BurstDone, NULL);
+        return;
+    }
+
+    GPIO_PinOutClear(t->csPort, t->csPin);
+    if(t->rx) {
+        SPIDRV_MTransfer(spi_queue.handle, t->tx, t->rx, t->count, SPIQ_SPIDone);
+    }
+    else {
+        SPIDRV_MTransmit(spi_queue.handle, t->tx, t->count, SPIQ_SPIDone);
+    }
+}
+
+/*******************************************************************************
+ * @function    SPIQ_Init()
+ * @abstract    Attach the queue to an initialized SPI driver
+ *
+ * @param       handle  SPIDRV instance using spidrvCsControlApplication
+ *
+ * @return      void
+ ******************************************************************************/
+void SPIQ_Init(SPIDRV_Handle_t handle)
+{
+    spi_queue.handle = handle;
+    spi_queue.head = 0;
+    spi_queue.tail = 0;
+    spi_queue.busy = false;
+    spi_queue.dropped = 0;
+    spi_queue.space = NULL;
+}
+
+/*******************************************************************************
+ * @function    SPIQ_Submit()
+ * @abstract    Queue a transaction
+ * @discussion  Safe from interrupt context. Starts the bus right away if it is
+ *              idle, otherwise the transaction follows the ones before it from
+ *              their completion callbacks. done runs in interrupt context.
+ *
+ * @param       t   Transaction, copied into the queue
+ *
+ * @return      false if the queue is full, the transaction is counted as dropped
+ ******************************************************************************/
+bool SPIQ_Submit(const SPIQ_Transaction_t *t)
+{
+    bool start;
+    uint8_t next;
+    CORE_DECLARE_IRQ_STATE;
+
+    CORE_ENTER_ATOMIC();
+    next = (spi_queue.tail + 1) & (SPIQ_DEPTH - 1);
+    if(next == spi_queue.head) {
+        spi_queue.dropped++;
+        CORE_EXIT_ATOMIC();
+        return false;
+    }
+    memcpy(&spi_queue.queue[spi_queue.tail], t, sizeof(SPIQ_Transaction_t));
+    spi_queue.tail = next;
+    start = !spi_queue.busy;
+    spi_queue.busy = true;
+    if(start) {
+        SLEEP_SleepBlockBegin(sleepEM2);
+    }
+    CORE_EXIT_ATOMIC();
+
+    if(start) {
+        SPIQ_StartNext();
+    }
+    return true;
+}
+
+bool SPIQ_Idle()
+{
+    return !spi_queue.busy;
+}
+
+/*******************************************************************************
+ * @function    SPIQ_OnSpace()
+ * @abstract    Run a callback once the queue has a free slot again
+ * @discussion  For submitters that found the queue full. cb runs once, from
+ *              the next completion after its done(), or right away if the
+ *              queue has drained in the meantime. A later call replaces a
+ *              callback still waiting.
+ *
+ * @param       cb      Callback, runs in interrupt context
+ * @param       user    Passed to cb
+ *
+ * @return      void
+ ******************************************************************************/
+void SPIQ_OnSpace(SPIQ_Callback_t cb, void *user)
+{
+    bool now;
+    CORE_DECLARE_IRQ_STATE;
+
+    CORE_ENTER_ATOMIC();
+    now = !spi_queue.busy;
+    if(!now) {
+        spi_queue.space = cb;
+        spi_queue.spaceUser = user;
+    }
+    CORE_EXIT_ATOMIC();
+
+    if(now) {
+        cb(user);
+    }
+}
+
+#endif /* SPI_QUEUE */
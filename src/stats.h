@@ -0,0 +1,134 @@
+/*
+ * stats.h
+ *
+ * Running mean, variance, minimum and maximum of a signed fixed point value
+ */
+
+#ifndef STATS
+#define STATS
+
+#include <stdint.h>
+
+/* @var STATS_FRAC  Fraction bits the mean carries beyond those of the value */
+#define STATS_FRAC              8
+/* @var STATS_PUT_LENGTH  Bytes written by STATS_Put() */
+#define STATS_PUT_LENGTH        20
+
+/*******************************************************************************
+ * @struct      STATS_Acc_t
+ * @abstract    Welford accumulator
+ * @discussion  Every value updates the mean by delta / n and the sum of
+ *              squared deviations m2 by delta * (x - new mean), so neither grows
+ *              with the magnitude of the values and no sum of squares has to
+ *              fit 64 bits. mean is scaled by 2^STATS_FRAC so the division
+ *              keeps its fraction, m2 by 2^(2 * STATS_FRAC). Deltas are clamped
+ *              to 31 bits so a wild value can not overflow the product, it
+ *              still counts in min and max.
+ ******************************************************************************/
+typedef struct {
+    uint32_t n;
+    int64_t mean;
+    uint64_t m2;
+    int32_t min;
+    int32_t max;
+} STATS_Acc_t;
+
+void STATS_Reset(STATS_Acc_t *acc)
+{
+    acc->n = 0;
+    acc->mean = 0;
+    acc->m2 = 0;
+    acc->min = INT32_MAX;
+    acc->max = INT32_MIN;
+}
+
+int64_t STATS_Clamp(int64_t delta)
+{
+    if(delta > INT32_MAX) {
+        return INT32_MAX;
+    }
+    if(delta < -INT32_MAX) {
+        return -INT32_MAX;
+    }
+    return delta;
+}
+
+/*******************************************************************************
+ * @function    STATS_Add()
+ * @abstract    Add one value, constant time
+ *
+ * @param       acc     Accumulator
+ * @param       x       Value
+ *
+ * @return      void
+ ******************************************************************************/
+void STATS_Add(STATS_Acc_t *acc, int32_t x)
+{
+    int64_t scaled = (int64_t)x << STATS_FRAC;
+    int64_t delta = STATS_Clamp(scaled - acc->mean);
+
+    acc->n++;
+    acc->mean += delta / (int64_t)acc->n;
+    acc->m2 += (uint64_t)(delta * STATS_Clamp(scaled - acc->mean));
+
+    if(x < acc->min) {
+        acc->min = x;
+    }
+    if(x > acc->max) {
+        acc->max = x;
+    }
+}
+
+// Rounded integer square root
+uint32_t STATS_Sqrt(uint64_t v)
+{
+    uint64_t root = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while(bit > v) {
+        bit >>= 2;
+    }
+    while(bit) {
+        if(v >= root + bit) {
+            v -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)(v > root ? root + 1 : root);
+}
+
+/*******************************************************************************
+ * @function    STATS_Put()
+ * @abstract    Write the summary, big endian, in the units of the values
+ * @discussion  out[0:3] count, out[4:7] mean, out[8:11] sample standard
+ *              deviation, out[12:15] minimum, out[16:19] maximum. With no
+ *              values everything but the count is 0.
+ *
+ * @param       acc     Accumulator
+ * @param       out     STATS_PUT_LENGTH bytes
+ *
+ * @return      void
+ ******************************************************************************/
+void STATS_Put(const STATS_Acc_t *acc, uint8_t *out)
+{
+    uint32_t word[STATS_PUT_LENGTH / 4] = { acc->n, 0, 0, 0, 0 };
+    uint32_t i;
+
+    if(acc->n) {
+        word[1] = (uint32_t)((acc->mean + (1 << (STATS_FRAC - 1))) >> STATS_FRAC);
+        if(acc->n > 1) {
+            word[2] = ((uint64_t)STATS_Sqrt(acc->m2 / (acc->n - 1)) + (1 << (STATS_FRAC - 1))) >> STATS_FRAC;
+        }
+        word[3] = acc->min;
+        word[4] = acc->max;
+    }
+    for(i = 0; i < STATS_PUT_LENGTH; i++) {
+        out[i] = word[i / 4] >> (24 - 8 * (i % 4));
+    }
+}
+
+#endif /* STATS */
@@ -0,0 +1,257 @@
+/*
+ * total.h
+ *
+ * Forward and reverse volume totals, checkpointed to the internal flash
+ */
+
+#ifndef TOTAL
+#define TOTAL
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "em_device.h"
+#include "em_msc.h"
+#include "frame.h"
+#include "flow.h"
+
+/* @var TOTAL_TICK_HZ  Rate of the sample time stamps */
+#define TOTAL_TICK_HZ           32768
+
+/* @var TOTAL_GAP_TICKS  Longest sample interval integrated, above the longest
+ *                       measurement period */
+#define TOTAL_GAP_TICKS         (70 * TOTAL_TICK_HZ)
+
+/*******************************************************************************
+ * @struct      TOTAL_Acc_t
+ * @abstract    Totalizer of one meter
+ * @discussion  Every sample adds its flow rate times the interval since the
+ *              previous one to forward or reverse, whole nL there and the
+ *              rest in fraction as nL / TOTAL_TICK_HZ, so nothing is lost to
+ *              rounding however short the interval. A sample without a valid
+ *              flow rate holds the last one. The first sample after
+ *              TOTAL_Pause() or a gap over TOTAL_GAP_TICKS only starts the
+ *              interval. 2^64 nL do not wrap before 1.8e7 m^3.
+ ******************************************************************************/
+typedef struct {
+    uint64_t forward;       // nL
+    uint64_t reverse;       // nL
+    uint16_t fraction[2];   // forward, reverse
+    uint32_t last;
+    int32_t hold;
+    bool running;
+} TOTAL_Acc_t;
+
+/* The next sample only starts a new interval */
+void TOTAL_Pause(TOTAL_Acc_t *acc)
+{
+    acc->running = false;
+}
+
+void TOTAL_Clear(TOTAL_Acc_t *acc)
+{
+    acc->forward = 0;
+    acc->reverse = 0;
+    acc->fraction[0] = 0;
+    acc->fraction[1] = 0;
+}
+
+/*******************************************************************************
+ * @function    TOTAL_Add()
+ * @abstract    Integrate one sample
+ *
+ * @param       acc     Totalizer
+ * @param       ticks   Time stamp of the sample, TOTAL_TICK_HZ
+ * @param       flow    uL/s, FLOW_INVALID holds the last rate
+ *
+ * @return      true if a volume was added
+ ******************************************************************************/
+bool TOTAL_Add(TOTAL_Acc_t *acc, uint32_t ticks, int32_t flow)
+{
+    uint32_t dt = ticks - acc->last;
+    uint32_t dir;
+    uint64_t part;
+
+    if(!acc->running || dt > TOTAL_GAP_TICKS) {
+        acc->running = flow != FLOW_INVALID;
+        acc->hold = flow;
+        acc->last = ticks;
+        return false;
+    }
+    if(flow != FLOW_INVALID) {
+        acc->hold = flow;
+    }
+    acc->last = ticks;
+
+    // < 2^31 uL/s * 70 s * 32768 * 1000, within 64 bits
+    dir = acc->hold < 0;
+    part = (uint64_t)(dir ? -(int64_t)acc->hold : acc->hold) * dt * 1000 + acc->fraction[dir];
+    acc->fraction[dir] = part % TOTAL_TICK_HZ;
+    part /= TOTAL_TICK_HZ;
+    if(dir) {
+        acc->reverse += part;
+    }
+    else {
+        acc->forward += part;
+    }
+    return true;
+}
+
+/*******************************************************************************
+ * @var TOTAL_PAGES
+ * @abstract Flash pages at the end of the flash holding the checkpoints
+ * @discussion Both must stay out of the firmware image, the FLASH region
+ *             of WonderGecko_MAX35103.ld ends below them. Records of
+ *             total_store.size bytes fill one page, then the other page is
+ *             erased and filled, so every page is erased once per page of
+ *             records: 85 records of one meter on a 2 kB page, a checkpoint
+ *             every 10 minutes wears a page 20000 times in over 60 years.
+ ******************************************************************************/
+#define TOTAL_PAGES             2
+#ifndef TOTAL_BASE
+#define TOTAL_BASE              (FLASH_BASE + FLASH_SIZE - TOTAL_PAGES * FLASH_PAGE_SIZE)
+#endif
+
+/* @var TOTAL_ACC_MAX  Totalizers one record holds at most */
+#ifndef TOTAL_ACC_MAX
+#define TOTAL_ACC_MAX           4
+#endif
+
+#define TOTAL_MAGIC             0x70A1
+#define TOTAL_ERASED            0xFFFFFFFF
+
+/*******************************************************************************
+ * @var total_store
+ * @abstract Checkpoint records in flash
+ * @discussion A record is word[0] TOTAL_MAGIC << 16 | CRC16 of the rest,
+ *             word[1] seq, then forward and reverse of every totalizer. The
+ *             first word is written last, so a record torn by a reset fails
+ *             its check and the one before it is restored. Of the valid
+ *             records the one with the highest seq wins. A page is only
+ *             erased once the newest record is on the other one.
+ *             slot     Next record to write, counting over both pages
+ ******************************************************************************/
+struct {
+    uint32_t words[2 + 4 * TOTAL_ACC_MAX];
+    uint32_t size;
+    uint32_t slots;
+    uint32_t slot;
+    uint32_t seq;
+} total_store;
+
+uint32_t *TOTAL_Slot(uint32_t slot)
+{
+    uint32_t perPage = FLASH_PAGE_SIZE / total_store.size;
+
+    return (uint32_t *)(TOTAL_BASE + (slot / perPage) * FLASH_PAGE_SIZE +
+                        (slot % perPage) * total_store.size);
+}
+
+bool TOTAL_Erased(const uint32_t *p)
+{
+    uint32_t i;
+
+    for(i = 0; i < total_store.size / 4; i++) {
+        if(p[i] != TOTAL_ERASED) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint16_t TOTAL_Check(const uint32_t *p)
+{
+    return FRAME_Crc16((const uint8_t *)&p[1], total_store.size - 4);
+}
+
+/*******************************************************************************
+ * @function    TOTAL_Load()
+ * @abstract    Restore the totals of the newest valid record
+ * @discussion  Runs once at reset, the intervals start with the next samples.
+ *
+ * @param       acc     Totalizers
+ * @param       n       Number of them, 1 to TOTAL_ACC_MAX
+ *
+ * @return      false if no record was found, the totals are then 0
+ ******************************************************************************/
+bool TOTAL_Load(TOTAL_Acc_t *acc, uint32_t n)
+{
+    const uint32_t *best = NULL;
+    const uint32_t *p;
+    uint32_t i;
+
+    EFM_ASSERT(n && n <= TOTAL_ACC_MAX);
+
+    MSC_Init();
+    total_store.size = 4 * (2 + 4 * n);
+    total_store.slots = TOTAL_PAGES * (FLASH_PAGE_SIZE / total_store.size);
+    total_store.slot = 0;
+    total_store.seq = 0;
+
+    for(i = 0; i < total_store.slots; i++) {
+        p = TOTAL_Slot(i);
+        if(p[0] >> 16 == TOTAL_MAGIC && (uint16_t)p[0] == TOTAL_Check(p) &&
+           (!best || (int32_t)(p[1] - best[1]) > 0)) {
+            best = p;
+            total_store.slot = (i + 1) % total_store.slots;
+        }
+    }
+
+    for(i = 0; i < n; i++) {
+        TOTAL_Clear(&acc[i]);
+        TOTAL_Pause(&acc[i]);
+        if(best) {
+            acc[i].forward = best[2 + 4 * i] | (uint64_t)best[3 + 4 * i] << 32;
+            acc[i].reverse = best[4 + 4 * i] | (uint64_t)best[5 + 4 * i] << 32;
+        }
+    }
+    if(best) {
+        total_store.seq = best[1];
+    }
+    return best != NULL;
+}
+
+/*******************************************************************************
+ * @function    TOTAL_Save()
+ * @abstract    Write a checkpoint record
+ * @discussion  Runs from RAM through em_msc, the core stalls on any flash
+ *              fetch meanwhile: some 20 us per word, and up to 20 ms when the
+ *              record opens a page. A MAX35103 keeps its INT asserted until
+ *              read out, so measurements are only delayed. Slots a torn
+ *              record left programmed are skipped.
+ *
+ * @param       acc     Totalizers
+ * @param       n       As passed to TOTAL_Load()
+ *
+ * @return      false if the flash refused the write
+ ******************************************************************************/
+bool TOTAL_Save(const TOTAL_Acc_t *acc, uint32_t n)
+{
+    uint32_t perPage = FLASH_PAGE_SIZE / total_store.size;
+    uint32_t slot;
+    uint32_t *p;
+    uint32_t i;
+
+    total_store.words[1] = ++total_store.seq;
+    for(i = 0; i < n; i++) {
+        total_store.words[2 + 4 * i] = (uint32_t)acc[i].forward;
+        total_store.words[3 + 4 * i] = (uint32_t)(acc[i].forward >> 32);
+        total_store.words[4 + 4 * i] = (uint32_t)acc[i].reverse;
+        total_store.words[5 + 4 * i] = (uint32_t)(acc[i].reverse >> 32);
+    }
+    total_store.words[0] = (uint32_t)TOTAL_MAGIC << 16 | TOTAL_Check(total_store.words);
+
+    while(total_store.slot % perPage && !TOTAL_Erased(TOTAL_Slot(total_store.slot))) {
+        total_store.slot = (total_store.slot + 1) % total_store.slots;
+    }
+    slot = total_store.slot;
+    total_store.slot = (slot + 1) % total_store.slots;
+    p = TOTAL_Slot(slot);
+
+    if(!(slot % perPage) && MSC_ErasePage(p) != mscReturnOk) {
+        return false;
+    }
+    return MSC_WriteWord(&p[1], &total_store.words[1], total_store.size - 4) == mscReturnOk &&
+           MSC_WriteWord(&p[0], &total_store.words[0], 4) == mscReturnOk;
+}
+
+#endif /* TOTAL */